@@ -0,0 +1,110 @@
+#include "alignment.h"
+
+#include <cassert>
+
+namespace
+{
+    // Collects the maximal runs of `kind` in ops, numbered by their position in ops.
+    std::vector<Alignment::GapRun> runs_of(const std::vector<EditOp>& ops, const EditOp& kind)
+    {
+        std::vector<Alignment::GapRun> runs;
+        for (uint32_t c = 0; c < ops.size(); c++)
+        {
+            if (kind != ops[c])
+                continue;
+            if (!runs.empty() && runs.back().column + runs.back().length == c)
+                runs.back().length++;
+            else
+                runs.push_back({ c, 1 });
+        }
+        return runs;
+    }
+}
+
+void Alignment::append(const uint32_t& sequence, const uint32_t& length, const std::vector<EditOp>& ops)
+{
+    if (_rows.empty())
+    {
+        _rows.push_back({ sequence, {} });
+        _inserted.emplace_back();
+        _widths.push_back(length);
+        return;
+    }
+
+    assert(!ops.empty());
+    _rows.push_back({ sequence, runs_of(ops, EditOp::TargetGap) });
+    _inserted.push_back(runs_of(ops, EditOp::ProfileGap));
+    _widths.push_back((uint32_t)ops.size());
+}
+
+void Alignment::clear()
+{
+    _rows.clear();
+    _inserted.clear();
+    _widths.clear();
+}
+
+uint32_t Alignment::rows() const
+{
+    return (uint32_t)_rows.size();
+}
+
+uint32_t Alignment::width() const
+{
+    return _widths.empty() ? 0 : _widths.back();
+}
+
+std::vector<std::string> Alignment::materialize(const std::vector<PackedSequence>& sequences) const
+{
+    std::vector<std::string> res(_rows.size());
+    if (_rows.empty())
+        return res;
+
+    // to_final[c] is where column c of the current step's frame ends up. Walking the steps
+    // backwards, each one drops the columns it inserted, so the map shrinks to the frame
+    // of the step before it.
+    std::vector<uint32_t> to_final(width()), earlier;
+    for (uint32_t c = 0; c < to_final.size(); c++)
+        to_final[c] = c;
+
+    for (size_t k = _rows.size(); k-- > 0;)
+    {
+        const Row& row = _rows[k];
+        const std::string seq = sequences[row.sequence].unpack();
+        std::string& out = res[k];
+        out.assign(width(), '-');
+
+        auto gap = row.gaps.begin();
+        auto residue = seq.begin();
+        for (uint32_t c = 0; c < _widths[k]; c++)
+        {
+            if (gap != row.gaps.end() && c >= gap->column)
+            {
+                c = gap->column + gap->length - 1;
+                ++gap;
+                continue;
+            }
+            out[to_final[c]] = *residue++;
+        }
+        assert(residue == seq.end());
+
+        if (0 == k)
+            break;
+        earlier.clear();
+        auto inserted = _inserted[k].begin();
+        for (uint32_t c = 0; c < _widths[k]; c++)
+        {
+            if (inserted != _inserted[k].end() && c >= inserted->column)
+            {
+                c = inserted->column + inserted->length - 1;
+                ++inserted;
+                continue;
+            }
+            earlier.push_back(to_final[c]);
+        }
+        assert(earlier.size() == _widths[k - 1]);
+        to_final.swap(earlier);
+    }
+
+    return res;
+}
@@ -0,0 +1,50 @@
+//
+// Progressive alignment stored as gap runs, materialized into strings only on request.
+//
+
+#ifndef EXP_ALIGNMENT_H
+#define EXP_ALIGNMENT_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "pairwise.h"
+#include "packed.h"
+
+// Row k is kept in the column frame the alignment had when it was added, as the index of
+// its sequence plus its own gap runs. Step k also records where it opened gap columns in
+// all earlier rows. Adding a row is O(number of runs); no stored row is ever touched again.
+class Alignment
+{
+public:
+    struct GapRun
+    {
+        uint32_t column;    // first column of the run, in the frame of its own step
+        uint32_t length;
+    };
+
+    // Adds sequence `sequence` of length `length` as an ungapped first row, or aligned by
+    // ops (as returned by align_to_profile) when rows are already present.
+    void append(const uint32_t& sequence, const uint32_t& length, const std::vector<EditOp>& ops = {});
+    void clear();
+
+    [[nodiscard]] uint32_t rows() const;
+    [[nodiscard]] uint32_t width() const;
+
+    // Gapped rows in the final frame, in insertion order. O(rows * width) overall.
+    [[nodiscard]] std::vector<std::string> materialize(const std::vector<PackedSequence>& sequences) const;
+
+private:
+    struct Row
+    {
+        uint32_t                sequence;
+        std::vector<GapRun>     gaps;       // ProfileGap columns excluded, see _inserted
+    };
+
+    std::vector<Row>                    _rows;
+    std::vector<std::vector<GapRun>>    _inserted;  // columns opened in the earlier rows, per step
+    std::vector<uint32_t>               _widths;    // width after each step
+};
+
+#endif //EXP_ALIGNMENT_H
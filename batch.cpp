@@ -0,0 +1,267 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <cctype>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include "dqn.h"
+#include "environment.h"
+#include "rollout.h"
+#include "beam.h"
+#include "fasta.h"
+#include "guide.h"
+
+namespace
+{
+    struct Family
+    {
+        std::vector<std::string>    names;
+        std::vector<std::string>    sequences;
+    };
+
+    // Expands @list arguments into the FASTA paths they name, one per line.
+    std::vector<std::string> expand_inputs(const std::vector<std::string>& inputs)
+    {
+        std::vector<std::string> paths;
+        for (const auto& input : inputs)
+        {
+            if (input.empty() || '@' != input[0])
+            {
+                paths.push_back(input);
+                continue;
+            }
+            std::ifstream list(input.substr(1));
+            if (!list.is_open())
+                throw std::runtime_error("Can not open the family list " + input.substr(1));
+            std::string line;
+            while (std::getline(list, line))
+            {
+                while (!line.empty() && std::isspace((unsigned char)line.back()))
+                    line.pop_back();
+                if (!line.empty() && '#' != line[0])
+                    paths.push_back(line);
+            }
+        }
+        return paths;
+    }
+
+    Family load_family(const FastaFile& file, const std::string& path)
+    {
+        Family family;
+        file.for_each([&family](const FastaRecord& record)
+        {
+            family.names.emplace_back(record.name);
+            family.sequences.push_back(FastaFile::normalize(record.data));
+        });
+        if (family.sequences.empty())
+            throw std::runtime_error("No sequences in " + path);
+        return family;
+    }
+
+    // Rough upper bound of what a job holds while training: the parsed family, the replay
+    // memory, the nets with their gradients and Adam moments, the sequence encoding, the
+    // packed sequences and the profile. Sized from the file's records, so it can be
+    // reserved before load_family copies anything out of the mapping.
+    uint64_t estimate_memory(const Config& config, const FastaFile& file)
+    {
+        const uint64_t seq_num = file.size();
+        uint64_t residues = 0, input = 0;
+        for (size_t i = 0; i < seq_num; i++)
+        {
+            residues += file[i].length;
+            input += file[i].name.size() + 2 * sizeof(std::string);
+        }
+        input += residues;
+        const uint64_t replay = (uint64_t)config.replay_memory_size * (2 * seq_num * sizeof(state_type) + 16);
+        const uint64_t width = encoding_width(config.kmer_features);
+        // Net's input, l1, l2 and output layers, weights and biases.
+        const uint64_t hidden = NET_HIDDEN;
+        const uint64_t params = (width + NET_STATE_COLUMNS + 1) * hidden + (hidden + 1) * hidden
+                                + (3 * hidden + 1) * hidden + hidden + 1;
+        const uint64_t encoding = seq_num * width + (config.kmer_features ? 2 * seq_num * seq_num : 0);
+        // Activations and their gradients for a training batch, 4 layers wide per sequence.
+        const uint64_t activations = (uint64_t)config.batch_size * seq_num * 4 * hidden;
+        const uint64_t profile = residues * sizeof(ColumnProfile::Column);
+        return input + replay + (5 * params + 2 * activations + encoding) * sizeof(float) + residues / 4 + profile;
+    }
+
+    // Admits jobs while their estimates fit under the limit, and always admits one when
+    // nothing else is running so an oversized family still gets done.
+    class MemoryBudget
+    {
+    public:
+        explicit MemoryBudget(const uint64_t& limit) : _limit(limit), _used(0), _running(0) {}
+
+        void acquire(const uint64_t& bytes)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _released.wait(lock, [&]() { return 0 == _limit || 0 == _running || _used + bytes <= _limit; });
+            _used += bytes;
+            _running++;
+        }
+
+        void release(const uint64_t& bytes)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _used -= bytes;
+                _running--;
+            }
+            _released.notify_all();
+        }
+
+    private:
+        const uint64_t              _limit;
+        uint64_t                    _used;
+        uint32_t                    _running;
+        std::mutex                  _mutex;
+        std::condition_variable     _released;
+    };
+
+    void write_alignment(const std::string& path, const Family& family, BeamResult& result)
+    {
+        // Rows come out in the chosen order; put each back next to its own name.
+        const auto rows = result.environment.alignment();
+        std::vector<const std::string*> by_sequence(family.sequences.size(), nullptr);
+        for (size_t k = 0; k < result.order.size() && k < rows.size(); k++)
+            by_sequence[result.order[k]] = &rows[k];
+
+        std::ofstream file(path);
+        if (!file.is_open())
+            throw std::runtime_error("Can not write the alignment " + path);
+        for (size_t i = 0; i < family.sequences.size(); i++)
+        {
+            if (nullptr == by_sequence[i])
+                throw std::runtime_error("Sequence " + family.names[i] + " missing from the alignment");
+            file << '>' << family.names[i] << '\n' << *by_sequence[i] << '\n';
+        }
+    }
+
+    void run_job(const Config& config, const Family& family, JobReport& report)
+    {
+        Environment env(family.sequences, config);
+        DQN agent(report.sequences, env.encoding(), config);
+        if (!config.model.empty())
+            agent.load(config.model);
+        else
+        {
+            if (config.warm_start > 0)
+                warm_start(env, agent, guide_order(family.sequences, 1), config.warm_start);
+            for (uint64_t episode = 0; episode < config.episodes; episode++)
+                play_episode(env, agent);
+        }
+
+        env.reset();
+        auto net = agent.inference();
+        auto result = beam_search(net, env, config.beam);
+        report.score = result.score;
+        write_alignment((std::filesystem::path(config.out) / (report.name + ".aln")).string(), family, result);
+    }
+
+    void write_summary(const std::string& path, const std::vector<JobReport>& reports)
+    {
+        std::ofstream file(path);
+        if (!file.is_open())
+            throw std::runtime_error("Can not write the batch summary " + path);
+        file << "name\tsequences\tseconds\tscore\terror\n";
+        for (const auto& report : reports)
+        {
+            file << report.name << '\t' << report.sequences << '\t' << report.seconds << '\t'
+                 << report.score << '\t' << report.error << '\n';
+        }
+    }
+}
+
+std::vector<std::string> job_names(const std::vector<std::string>& paths)
+{
+    std::vector<std::string> names;
+    std::unordered_set<std::string> taken;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        const std::string stem = std::filesystem::path(paths[i]).stem().string();
+        std::string name = stem;
+        // A suffixed name can itself be taken, e.g. by an input called x_2.fa.
+        for (size_t suffix = i; taken.count(name); suffix++)
+            name = stem + "_" + std::to_string(suffix);
+        taken.insert(name);
+        names.push_back(name);
+    }
+    return names;
+}
+
+std::vector<JobReport> run_batch(const Config& config, const std::vector<std::string>& inputs)
+{
+    const auto paths = expand_inputs(inputs);
+    std::filesystem::create_directories(config.out);
+    {
+        std::ofstream file(std::filesystem::path(config.out) / "config.txt");
+        config.write(file);
+    }
+
+    const auto names = job_names(paths);
+    std::vector<JobReport> reports(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        reports[i].path = paths[i];
+        reports[i].name = names[i];
+    }
+
+    // Each job trains on one thread; more would only contend with the other jobs.
+    const uint32_t threads = std::max<uint32_t>(1, std::min<uint32_t>(config.threads, (uint32_t)paths.size()));
+    if (threads > 1)
+        torch::set_num_threads(1);
+
+    MemoryBudget budget(config.memory << 20);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]()
+        {
+            for (size_t job = next++; job < reports.size(); job = next++)
+            {
+                JobReport& report = reports[job];
+                auto start = std::chrono::steady_clock::now();
+                try
+                {
+                    // Only the mapping and the record index exist until the budget admits the job.
+                    const FastaFile file(report.path);
+                    const uint64_t bytes = estimate_memory(config, file);
+                    // Time spent waiting for memory is not the family's own.
+                    const auto wait = std::chrono::steady_clock::now();
+                    budget.acquire(bytes);
+                    start += std::chrono::steady_clock::now() - wait;
+                    try
+                    {
+                        const Family family = load_family(file, report.path);
+                        report.sequences = (uint32_t)family.sequences.size();
+                        run_job(config, family, report);
+                    }
+                    catch (...)
+                    {
+                        budget.release(bytes);
+                        throw;
+                    }
+                    budget.release(bytes);
+                }
+                catch (const std::exception& e)
+                {
+                    report.error = e.what();
+                }
+                report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+
+    write_summary((std::filesystem::path(config.out) / "summary.tsv").string(), reports);
+    return reports;
+}
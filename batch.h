@@ -0,0 +1,36 @@
+//
+// Batch mode: align many independent sequence families in one process.
+//
+
+#ifndef EXP_BATCH_H
+#define EXP_BATCH_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "config.h"
+
+struct JobReport
+{
+    std::string     name;
+    std::string     path;
+    uint32_t        sequences = 0;
+    double          seconds = 0;
+    int32_t         score = 0;
+    std::string     error;                      // empty when the family was aligned
+};
+
+// File stems of paths, in order; one that is already taken, by an earlier path or by an
+// earlier suffixed name, gets "_" and its position or the next free number after it.
+std::vector<std::string> job_names(const std::vector<std::string>& paths);
+
+// Aligns every family of inputs (FASTA files, or @list files of one path per line) on its
+// own Environment and DQN, config.threads at a time and, with a config.memory limit, only
+// as many as their estimated footprint allows (a family that is over the limit on its own
+// still runs, alone). Each one is trained per config, or loaded from config.model, and
+// written to <config.out>/<name>.aln, named by job_names, as FASTA in input order. All of them are summarized
+// in <config.out>/summary.tsv next to the config.txt they ran with. A failing family is
+// reported and does not stop the others. Reports are in input order.
+std::vector<JobReport> run_batch(const Config& config, const std::vector<std::string>& inputs);
+
+#endif //EXP_BATCH_H
@@ -0,0 +1,76 @@
+#include "beam.h"
+
+#include <algorithm>
+
+namespace
+{
+    struct Beam
+    {
+        Environment                 env;
+        std::vector<state_type>     state;
+        float                       reward;
+    };
+
+    struct Candidate
+    {
+        uint32_t    beam;
+        int64_t     action;
+        float       value;
+    };
+}
+
+BeamResult beam_search(InferenceNet& net, const Environment& env, const uint32_t& width)
+{
+    const uint32_t seq_num = net.seq_num();
+    std::vector<Beam> beams{ { env, std::vector<state_type>(seq_num, -1), 0.f } };
+    std::vector<float> values;
+    std::vector<Candidate> candidates;
+    std::vector<uint8_t> taken(seq_num);
+
+    for (uint32_t depth = 0; depth < seq_num; depth++)
+    {
+        values.resize((size_t)beams.size() * seq_num);
+        for (size_t b = 0; b < beams.size(); b++)
+            net.q_values(beams[b].state, values.data() + b * seq_num);
+
+        candidates.clear();
+        for (uint32_t b = 0; b < beams.size(); b++)
+        {
+            std::fill(taken.begin(), taken.end(), 0);
+            for (uint32_t k = 0; k < depth; k++)
+                taken[beams[b].state[k]] = 1;
+            for (uint32_t a = 0; a < seq_num; a++)
+            {
+                if (!taken[a])
+                    candidates.push_back({ b, a, beams[b].reward + values[b * seq_num + a] });
+            }
+        }
+
+        const auto keep = std::min<size_t>(std::max<uint32_t>(1, width), candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + keep, candidates.end(),
+                          [](const Candidate& lhs, const Candidate& rhs) { return lhs.value > rhs.value; });
+
+        std::vector<Beam> next;
+        next.reserve(keep);
+        for (size_t c = 0; c < keep; c++)
+        {
+            const Candidate& candidate = candidates[c];
+            Beam beam = beams[candidate.beam];
+            auto [state, reward, done] = beam.env.step(candidate.action);
+            beam.state = std::move(state);
+            beam.reward += reward;
+            next.push_back(std::move(beam));
+        }
+        beams.swap(next);
+    }
+
+    size_t best = 0;
+    std::vector<int32_t> scores(beams.size());
+    for (size_t b = 0; b < beams.size(); b++)
+    {
+        scores[b] = beams[b].env.calc_sum_of_pairs();
+        if (scores[b] > scores[best])
+            best = b;
+    }
+    return { beams[best].state, std::move(beams[best].env), scores[best] };
+}
@@ -0,0 +1,26 @@
+//
+// Beam search over progressive-alignment orders, guided by the trained Q-network.
+//
+
+#ifndef EXP_BEAM_H
+#define EXP_BEAM_H
+
+#include <vector>
+#include "environment.h"
+#include "inference.h"
+
+struct BeamResult
+{
+    std::vector<state_type>     order;
+    Environment                 environment;
+    int32_t                     score;
+};
+
+// Keeps the `width` best partial orders by reward so far plus the Q-value of the next
+// action, from one forward pass per beam state and depth. Each full order
+// is then scored by its sum of pairs and the best one is returned. A width of 1 is
+// greedy decoding that never repeats a sequence. env must be freshly reset.
+// net is e.g. DQN::inference(), or loaded from exported NetWeights without libtorch.
+BeamResult beam_search(InferenceNet& net, const Environment& env, const uint32_t& width);
+
+#endif //EXP_BEAM_H
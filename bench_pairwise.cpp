@@ -0,0 +1,109 @@
+//
+// Times align_to_profile under the linear and affine scoring schemes, and align_banded.
+//
+// usage: bench_pairwise [repeats] [divergence]
+// The target differs from the profile at about one base in divergence / 3 (default 30).
+// Prints one tab-separated line per scheme and length: the alignment width, and the time and
+// cells per second of the forward pass plus the traceback, so the schemes can be compared
+// with each other and across changes.
+//
+
+#include "pairwise.h"
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Scheme
+    {
+        const char* name;
+        Scores      scores;
+        bool        banded;
+    };
+
+    std::vector<Scheme> schemes()
+    {
+        Scores runtime;
+        runtime.match = 3;
+        runtime.mismatch = -2;
+        runtime.gap = -3;
+
+        Scores matrix;
+        matrix.matrix = SubstitutionMatrix::iupac(MATCH_REWARD, MISMATCH_PENALTY);
+
+        Scores affine = runtime;
+        affine.gap_open = -5;
+        affine.gap = -1;
+
+        Scores affine_matrix = matrix;
+        affine_matrix.gap_open = -5;
+        affine_matrix.gap = -1;
+
+        return {
+            { "linear-fixed", Scores(), false },
+            { "linear-runtime", runtime, false },
+            { "linear-matrix", matrix, false },
+            { "affine-runtime", affine, false },
+            { "affine-matrix", affine_matrix, false },
+            { "linear-banded", Scores(), true },
+            { "affine-banded", affine, true }
+        };
+    }
+
+    // A profile and a target that differ by about 3 / divergence substitutions and indels.
+    std::pair<std::string, std::string> sequence_pair(std::mt19937& rng, const uint32_t& length,
+                                                      const uint32_t& divergence)
+    {
+        static const char bases[] = "ATCG";
+        std::string profile, target;
+        for (uint32_t i = 0; i < length; i++)
+            profile.push_back(bases[rng() % 4]);
+        for (const char& c : profile)
+        {
+            const auto r = rng() % divergence;
+            if (0 == r)
+                continue;
+            target.push_back(1 == r ? bases[rng() % 4] : c);
+            if (2 == r)
+                target.push_back(bases[rng() % 4]);
+        }
+        return { profile, target };
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int repeats = argc > 1 ? std::max(1, atoi(argv[1])) : 5;
+    const uint32_t divergence = argc > 2 ? std::max(3, atoi(argv[2])) : 30;
+    std::mt19937 rng(42);
+
+    printf("# linear kernel %s, affine kernel %s\n", pairwise_kernel_name(), affine_kernel_name());
+    printf("scheme\tlength\tcolumns\tms\tMcells/s\n");
+    for (const uint32_t length : { 256u, 1024u, 4096u })
+    {
+        const auto pair = sequence_pair(rng, length, divergence);
+        const double cells = (double)pair.first.size() * pair.second.size();
+        for (const auto& scheme : schemes())
+        {
+            size_t columns = 0;
+            const auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeats; r++)
+            {
+                const auto& scores = scheme.scores;
+                columns = (scheme.banded ? align_banded(pair.first, pair.second, scores)
+                                         : align_to_profile(pair.first, pair.second, scores)).size();
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            const double seconds = elapsed.count() / repeats;
+            printf("%s\t%u\t%zu\t%.3f\t%.1f\n", scheme.name, length, columns, seconds * 1e3, cells / seconds / 1e6);
+        }
+    }
+    return 0;
+}
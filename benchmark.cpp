@@ -0,0 +1,422 @@
+//
+// Benchmarks of the alignment hot paths and of whole episodes, written as JSON.
+//
+// usage: benchmark [--quick] [--filter TEXT] [--out FILE]
+// Every input is generated from fixed seeds, so runs are comparable across builds. Each case
+// repeats until it has run for a while and reports the mean time per iteration and its
+// throughput in `unit`s per second. --quick runs the small sizes only, --filter the cases
+// whose name contains TEXT. Cases that need the agent are only built with libtorch; the
+// rollout case doubles its actor threads up to the core count, to show how episodes/s scale.
+//
+
+#include "environment.h"
+#include "guide.h"
+#include "pairwise.h"
+#include "profile.h"
+#include "scoring.h"
+#include "encoder.h"
+#include "inference.h"
+#ifdef EXP_WITH_TORCH
+#include "dqn.h"
+#include "replay.h"
+#include "rollout.h"
+#include "beam.h"
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Stops the compiler from dropping the work whose result nobody reads.
+    volatile int64_t sink;
+
+    struct Result
+    {
+        std::string     name;
+        std::string     variant;
+        uint32_t        count;          // sequences, 1 for pairwise cases
+        uint32_t        length;         // bases per sequence
+        uint64_t        iterations;
+        double          seconds;        // per iteration
+        std::string     unit;
+        double          rate;           // units per second
+    };
+
+    class Suite
+    {
+    public:
+        Suite(const bool& quick, std::string filter) : _quick(quick), _filter(std::move(filter)) {}
+
+        [[nodiscard]] bool quick() const { return _quick; }
+
+        // Times body, which does `units` units of work per call, after one warm-up call.
+        void run(const std::string& name, const std::string& variant, const uint32_t& count,
+                 const uint32_t& length, const std::string& unit, const double& units,
+                 const std::function<void()>& body)
+        {
+            if (std::string::npos == name.find(_filter))
+                return;
+            const double budget = _quick ? 0.05 : 0.5;
+            body();
+
+            uint64_t iterations = 0;
+            const auto start = std::chrono::steady_clock::now();
+            double elapsed = 0;
+            do
+            {
+                body();
+                iterations++;
+                elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            while (elapsed < budget || iterations < 3);
+
+            const double seconds = elapsed / (double)iterations;
+            _results.push_back({ name, variant, count, length, iterations, seconds, unit, units / seconds });
+            std::cerr << name << " " << variant << " " << count << "x" << length << ": "
+                      << units / seconds << " " << unit << "/s" << std::endl;
+        }
+
+        void write(std::ostream& out) const
+        {
+            out << "{\n"
+                << "  \"kernels\": {\"pairwise\": \"" << pairwise_kernel_name()
+                << "\", \"affine\": \"" << affine_kernel_name()
+                << "\", \"scoring\": \"" << scoring_kernel_name()
+                << "\", \"kmer\": \"" << kmer_kernel_name()
+                << "\", \"inference\": \"" << inference_kernel_name() << "\"},\n"
+#ifdef EXP_WITH_TORCH
+                << "  \"torch\": true,\n"
+#else
+                << "  \"torch\": false,\n"
+#endif
+                << "  \"quick\": " << (_quick ? "true" : "false") << ",\n"
+                << "  \"results\": [";
+            for (size_t i = 0; i < _results.size(); i++)
+            {
+                const Result& r = _results[i];
+                out << (i ? ",\n" : "\n")
+                    << "    {\"name\": \"" << r.name << "\", \"variant\": \"" << r.variant
+                    << "\", \"count\": " << r.count << ", \"length\": " << r.length
+                    << ", \"iterations\": " << r.iterations << ", \"seconds\": " << r.seconds
+                    << ", \"unit\": \"" << r.unit << "\", \"rate\": " << r.rate << "}";
+            }
+            out << "\n  ]\n}\n";
+        }
+
+    private:
+        bool                    _quick;
+        std::string             _filter;
+        std::vector<Result>     _results;
+    };
+
+    // count relatives of one random root of the given length: each base is substituted,
+    // deleted or followed by an inserted one with probability divergence / 3 each.
+    std::vector<std::string> synthetic_family(const uint32_t& count, const uint32_t& length,
+                                              const double& divergence, const uint32_t& seed)
+    {
+        static const char bases[] = "ATCG";
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<double> coin(0., 1.);
+        std::string root;
+        for (uint32_t i = 0; i < length; i++)
+            root.push_back(bases[rng() % 4]);
+
+        std::vector<std::string> family;
+        for (uint32_t s = 0; s < count; s++)
+        {
+            std::string member;
+            for (const char& c : root)
+            {
+                const double x = coin(rng) * 3 / divergence;
+                if (x < 1)
+                    member.push_back(bases[rng() % 4]);
+                else if (x < 2)
+                    continue;
+                else
+                    member.push_back(c);
+                if (2 <= x && x < 3)
+                    member.push_back(bases[rng() % 4]);
+            }
+            if (member.empty())
+                member.push_back(bases[rng() % 4]);
+            family.push_back(member);
+        }
+        return family;
+    }
+
+    // Aligns family in guide-tree order; returns the number of steps.
+    uint32_t align_in_order(Environment& env, const std::vector<state_type>& order)
+    {
+        env.reset();
+        for (const auto& action : order)
+            env.step(action);
+        return (uint32_t)order.size();
+    }
+
+    void pairwise_cases(Suite& suite)
+    {
+        Scores affine;
+        affine.gap_open = -4;
+        affine.gap = -1;
+        const std::vector<uint32_t> lengths = suite.quick() ? std::vector<uint32_t>{ 100, 1000 }
+                                                            : std::vector<uint32_t>{ 100, 1000, 5000 };
+        for (const auto& length : lengths)
+        {
+            const auto family = synthetic_family(2, length, 0.05, 1);
+            const auto close = synthetic_family(2, length, 0.005, 2);
+            suite.run("pairwise_alignment", "linear", 1, length, "alignments", 1,
+                      [&]() { sink = (int64_t)align_to_profile(family[0], family[1]).size(); });
+            suite.run("pairwise_alignment", "affine", 1, length, "alignments", 1,
+                      [&]() { sink = (int64_t)align_to_profile(family[0], family[1], affine).size(); });
+            suite.run("pairwise_alignment", "banded", 1, length, "alignments", 1,
+                      [&]() { sink = (int64_t)align_banded(close[0], close[1]).size(); });
+        }
+    }
+
+    void family_cases(Suite& suite)
+    {
+        const std::vector<uint32_t> counts = suite.quick() ? std::vector<uint32_t>{ 8, 32 }
+                                                           : std::vector<uint32_t>{ 8, 32, 128 };
+        const std::vector<uint32_t> lengths = suite.quick() ? std::vector<uint32_t>{ 100 }
+                                                            : std::vector<uint32_t>{ 100, 1000 };
+        for (const auto& count : counts)
+        {
+            for (const auto& length : lengths)
+            {
+                const auto family = synthetic_family(count, length, 0.1, count * 7919 + length);
+                const auto order = guide_order(family, 1);
+                Environment env(family);
+                align_in_order(env, order);
+                const auto rows = env.alignment();
+                const auto width = (uint32_t)rows[0].size();
+
+                ColumnProfile profile;
+                for (const auto& row : rows)
+                    profile.append(row);
+                // One new gap column every 50, as a typical step opens.
+                std::vector<EditOp> ops;
+                for (uint32_t j = 0; j < width; j++)
+                {
+                    if (0 == j % 50)
+                        ops.push_back(EditOp::ProfileGap);
+                    ops.push_back(EditOp::Match);
+                }
+
+                suite.run("profile", "append", count, length, "rows", count, [&]()
+                {
+                    ColumnProfile p;
+                    for (const auto& row : rows)
+                        p.append(row);
+                    sink = (int64_t)p.size();
+                });
+                suite.run("profile", "insert_gap_columns", count, length, "columns", (double)ops.size(), [&]()
+                {
+                    ColumnProfile p = profile;
+                    p.insert_gap_columns(ops);
+                    sink = (int64_t)p.size();
+                });
+                suite.run("profile", "consensus", count, length, "columns", width,
+                          [&]() { sink = (int64_t)profile.consensus().size(); });
+
+                suite.run("calc_sum_of_pairs", "profile", count, length, "columns", width,
+                          [&]() { sink = sum_of_pairs(profile); });
+                suite.run("calc_sum_of_pairs", "rows", count, length, "columns", width,
+                          [&]() { sink = sum_of_pairs(rows); });
+
+                suite.run("end_to_end", "guide_order", count, length, "alignments", 1,
+                          [&]() { sink = align_in_order(env, order); });
+                std::mt19937 rng(count);
+                std::vector<state_type> shuffled = order;
+                suite.run("end_to_end", "random_order", count, length, "episodes", 1, [&]()
+                {
+                    std::shuffle(shuffled.begin(), shuffled.end(), rng);
+                    sink = align_in_order(env, shuffled);
+                });
+            }
+        }
+    }
+
+    // Random weights of Net's shape for an encoding with the given feature width.
+    NetWeights random_weights(const uint32_t& feature_width, const uint32_t& seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> uniform(-0.2f, 0.2f);
+        const auto fill = [&](std::vector<float>& v, const size_t& size)
+        {
+            v.resize(size);
+            for (auto& x : v)
+                x = uniform(rng);
+        };
+        NetWeights weights;
+        weights.feature_width = feature_width;
+        fill(weights.input_weight, (size_t)NET_HIDDEN * (feature_width + NET_STATE_COLUMNS));
+        fill(weights.input_bias, NET_HIDDEN);
+        fill(weights.l1_weight, (size_t)NET_HIDDEN * NET_HIDDEN);
+        fill(weights.l1_bias, NET_HIDDEN);
+        fill(weights.l2_weight, (size_t)NET_HIDDEN * 3 * NET_HIDDEN);
+        fill(weights.l2_bias, NET_HIDDEN);
+        fill(weights.output_weight, NET_HIDDEN);
+        weights.output_bias = uniform(rng);
+        return weights;
+    }
+
+    // Greedy action choice, as actors and decoding do it, halfway through an episode.
+    void inference_cases(Suite& suite)
+    {
+        const std::vector<uint32_t> counts = suite.quick() ? std::vector<uint32_t>{ 8, 32 }
+                                                           : std::vector<uint32_t>{ 8, 32, 128 };
+        const uint32_t length = 100;
+        for (const auto& count : counts)
+        {
+            const auto family = synthetic_family(count, length, 0.1, count);
+            Environment env(family);
+            const auto weights = random_weights(env.encoding().width, count);
+
+            std::vector<state_type> state(count, -1);
+            std::vector<uint8_t> mask(count, 1);
+            for (state_type k = 0; k < (state_type)count / 2; k++)
+            {
+                state[k] = k;
+                mask[k] = 0;
+            }
+            for (const bool quantized : { false, true })
+            {
+                InferenceNet net(count, env.encoding(), quantized);
+                net.load(weights);
+                suite.run("select", quantized ? "fused_int8" : "fused", count, length, "states", 1,
+                          [&]() { sink = net.best(state, mask.data()); });
+            }
+        }
+    }
+
+#ifdef EXP_WITH_TORCH
+    void agent_cases(Suite& suite)
+    {
+        const std::vector<uint32_t> counts = suite.quick() ? std::vector<uint32_t>{ 8 }
+                                                           : std::vector<uint32_t>{ 8, 32, 128 };
+        const uint32_t length = 100;
+        for (const auto& count : counts)
+        {
+            const auto family = synthetic_family(count, length, 0.1, count);
+            Config config;
+            Environment env(family, config);
+
+            // DQN::sample draws its batch with ReplayMemory::sample.
+            for (const bool prioritized : { false, true })
+            {
+                ReplayMemory memory(config.replay_memory_size, count, prioritized);
+                std::default_random_engine rand(count);
+                std::vector<state_type> state(count), next(count);
+                for (uint32_t i = 0; i < config.replay_memory_size; i++)
+                {
+                    // Step k of an episode taking the sequences in input order.
+                    const auto k = (state_type)(i % count);
+                    for (state_type j = 0; j < (state_type)count; j++)
+                        state[j] = j < k ? j : -1;
+                    next = state;
+                    next[k] = k;
+                    memory.push(state, k, next, 0.1f, k + 1 < (state_type)count);
+                }
+                auto batch = memory.make_batch(config.batch_size);
+                suite.run("dqn_sample", prioritized ? "prioritized" : "uniform", count, length, "batches", 1,
+                          [&]() { memory.sample(batch, rand); });
+            }
+
+            DQN agent(count, env.encoding(), config);
+            // Enough episodes to fill a batch, so update() trains.
+            for (uint32_t e = 0; e * count < 2 * config.batch_size; e++)
+                play_episode(env, agent);
+            suite.run("dqn_update", "", count, length, "updates", 1, [&]() { agent.update(); });
+            {
+                Config prefetch = config;
+                prefetch.prefetch = true;
+                DQN pipelined(count, env.encoding(), prefetch);
+                for (uint32_t e = 0; e * count < 2 * config.batch_size; e++)
+                    play_episode(env, pipelined);
+                suite.run("dqn_update", "prefetch", count, length, "updates", 1, [&]() { pipelined.update(); });
+            }
+
+            std::vector<state_type> state(count, -1);
+            for (state_type k = 0; k < (state_type)count / 2; k++)
+                state[k] = k;
+            suite.run("select", "torch", count, length, "states", 1, [&]() { sink = agent.predict(state); });
+
+            suite.run("end_to_end", "train", count, length, "episodes", 1, [&]() { play_episode(env, agent); });
+            suite.run("end_to_end", "decode", count, length, "alignments", 1, [&]()
+            {
+                env.reset();
+                auto net = agent.inference();
+                sink = beam_search(net, env, 1).score;
+            });
+
+            // Rollout episodes/s as actors are added, each batch of episodes on one Rollout.
+            // Rollout runs torch single-threaded; the later cases get the threads back.
+            const int threads = torch::get_num_threads();
+            const uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+            for (uint32_t workers = 1; workers <= (suite.quick() ? std::min(2u, cores) : cores); workers *= 2)
+            {
+                const uint64_t episodes = 4 * workers;
+                suite.run("rollout", std::to_string(workers) + "_workers", count, length, "episodes",
+                          (double)episodes, [&]()
+                {
+                    Rollout rollout(env, agent, workers, config.replay_ratio);
+                    rollout.start(episodes);
+                    rollout.join();
+                    sink = (int64_t)rollout.updates();
+                });
+            }
+            torch::set_num_threads(threads);
+        }
+    }
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = false;
+    std::string filter, out;
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "--quick"))
+            quick = true;
+        else if (0 == strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else if (0 == strcmp(argv[i], "--out") && i + 1 < argc)
+            out = argv[++i];
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--quick] [--filter TEXT] [--out FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    Suite suite(quick, filter);
+    pairwise_cases(suite);
+    family_cases(suite);
+    inference_cases(suite);
+#ifdef EXP_WITH_TORCH
+    agent_cases(suite);
+#endif
+
+    if (out.empty())
+    {
+        suite.write(std::cout);
+        return 0;
+    }
+    std::ofstream file(out);
+    if (!file.is_open())
+    {
+        std::cerr << "Can not open " << out << std::endl;
+        return 1;
+    }
+    suite.write(file);
+    return 0;
+}
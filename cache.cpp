@@ -0,0 +1,73 @@
+#include "cache.h"
+
+size_t TranspositionCache::PrefixHash::operator()(const std::vector<state_type>& prefix) const
+{
+    // FNV-1a over the chosen indices.
+    uint64_t hash = 14695981039346656037ull;
+    for (const auto& action : prefix)
+    {
+        hash ^= (uint32_t)action;
+        hash *= 1099511628211ull;
+    }
+    return (size_t)hash;
+}
+
+TranspositionCache::TranspositionCache(const size_t& capacity) :
+        _capacity(std::max<size_t>(1, capacity)),
+        _hits(0),
+        _misses(0)
+{
+
+}
+
+std::shared_ptr<const TranspositionCache::Entry> TranspositionCache::find(const std::vector<state_type>& prefix)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(prefix);
+    if (it == _index.end())
+    {
+        _misses++;
+        return nullptr;
+    }
+    _hits++;
+    _items.splice(_items.begin(), _items, it->second);
+    return it->second->second;
+}
+
+void TranspositionCache::insert(const std::vector<state_type>& prefix, std::shared_ptr<const Entry> entry)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(prefix);
+    if (it != _index.end())
+    {
+        it->second->second = std::move(entry);
+        _items.splice(_items.begin(), _items, it->second);
+        return;
+    }
+
+    if (_items.size() >= _capacity)
+    {
+        _index.erase(_items.back().first);
+        _items.pop_back();
+    }
+    _items.emplace_front(prefix, std::move(entry));
+    _index.emplace(prefix, _items.begin());
+}
+
+uint64_t TranspositionCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _hits;
+}
+
+uint64_t TranspositionCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _misses;
+}
+
+size_t TranspositionCache::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _items.size();
+}
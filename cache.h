@@ -0,0 +1,55 @@
+//
+// Bounded LRU cache of environment states keyed by the prefix of chosen sequences.
+//
+
+#ifndef EXP_CACHE_H
+#define EXP_CACHE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "utils.h"
+#include "alignment.h"
+#include "profile.h"
+
+// With a fixed dataset the chosen prefix fully determines the partial alignment, so a
+// step can be replayed from the cache instead of re-running the profile and the DP.
+// Shared by every Environment copy that was given it; all members are thread-safe.
+class TranspositionCache
+{
+public:
+    struct Entry
+    {
+        Alignment       alignment;
+        ColumnProfile   profile;
+        float           reward;
+    };
+
+    explicit TranspositionCache(const size_t& capacity);
+
+    // Marks the prefix as most recently used on a hit.
+    std::shared_ptr<const Entry> find(const std::vector<state_type>& prefix);
+    // Evicts the least recently used entry once capacity is reached.
+    void insert(const std::vector<state_type>& prefix, std::shared_ptr<const Entry> entry);
+
+    [[nodiscard]] uint64_t hits() const;
+    [[nodiscard]] uint64_t misses() const;
+    [[nodiscard]] size_t size() const;
+
+private:
+    struct PrefixHash
+    {
+        size_t operator()(const std::vector<state_type>& prefix) const;
+    };
+    using Item = std::pair<std::vector<state_type>, std::shared_ptr<const Entry>>;
+
+    size_t                      _capacity;
+    std::list<Item>             _items;     // most recently used first
+    std::unordered_map<std::vector<state_type>, std::list<Item>::iterator, PrefixHash> _index;
+    uint64_t                    _hits, _misses;
+    mutable std::mutex          _mutex;
+};
+
+#endif //EXP_CACHE_H
@@ -0,0 +1,260 @@
+#include "checkpoint.h"
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define EXP_CHECKPOINT_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    namespace fs = std::filesystem;
+
+    // A whole file, mapped read-only where possible.
+    class FileImage
+    {
+    public:
+        explicit FileImage(const fs::path& path)
+        {
+#ifdef EXP_CHECKPOINT_MMAP
+            const int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("Can not open " + path.string());
+            struct stat st{};
+            fstat(fd, &st);
+            _size = (size_t)st.st_size;
+            if (_size > 0)
+            {
+                void* map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (MAP_FAILED == map)
+                {
+                    close(fd);
+                    throw std::runtime_error("Can not map " + path.string());
+                }
+                madvise(map, _size, MADV_SEQUENTIAL);
+                _data = (const char*)map;
+                _mapped = true;
+            }
+            close(fd);
+#else
+            std::ifstream file(path, std::ios::binary);
+            if (!file.is_open())
+                throw std::runtime_error("Can not open " + path.string());
+            _buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            _data = _buffer.data();
+            _size = _buffer.size();
+#endif
+        }
+        FileImage(const FileImage&) = delete;
+        FileImage& operator=(const FileImage&) = delete;
+        ~FileImage()
+        {
+#ifdef EXP_CHECKPOINT_MMAP
+            if (_mapped)
+                munmap((void*)_data, _size);
+#endif
+        }
+
+        [[nodiscard]] const char* data() const { return _data; }
+        [[nodiscard]] size_t size() const { return _size; }
+
+    private:
+        const char*         _data = nullptr;
+        size_t              _size = 0;
+        bool                _mapped = false;
+        std::vector<char>   _buffer;
+    };
+
+    void write_file(const fs::path& path, const std::function<void(std::ostream&)>& body)
+    {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open())
+            throw std::runtime_error("Can not write " + path.string());
+        body(file);
+        file.flush();
+        if (!file)
+            throw std::runtime_error("Can not write " + path.string());
+    }
+
+    std::string trim(const std::string& text)
+    {
+        const auto begin = text.find_first_not_of(" \t\r\n");
+        if (std::string::npos == begin)
+            return {};
+        return text.substr(begin, text.find_last_not_of(" \t\r\n") - begin + 1);
+    }
+
+    template<typename T>
+    T state_value(const std::map<std::string, std::string>& state, const std::string& key)
+    {
+        const auto it = state.find(key);
+        T value{};
+        if (state.end() == it || !(std::istringstream(it->second) >> value))
+            throw std::runtime_error("Checkpoint state has no valid " + key);
+        return value;
+    }
+
+    // A crash between write_checkpoint's two renames leaves only the old one.
+    fs::path checkpoint_path(const std::string& directory)
+    {
+        if (!fs::exists(directory) && fs::exists(directory + ".old"))
+            return directory + ".old";
+        return directory;
+    }
+}
+
+void write_checkpoint(const Checkpoint& checkpoint, const std::string& directory)
+{
+    const fs::path target(directory), partial(directory + ".partial"), previous(directory + ".old");
+    try
+    {
+        fs::remove_all(partial);
+        fs::create_directories(partial);
+        write_file(partial / "state", [&](std::ostream& out)
+        {
+            out.precision(std::numeric_limits<double>::max_digits10);
+            out << "version = " << Checkpoint::VERSION << '\n'
+                << "seq_num = " << checkpoint.seq_num << '\n'
+                << "episodes = " << checkpoint.episodes << '\n'
+                << "steps = " << checkpoint.steps << '\n'
+                << "epsilon = " << checkpoint.epsilon << '\n'
+                << "rand = " << checkpoint.rand << '\n'
+                << "prefetch_rand = " << checkpoint.prefetch_rand << '\n';
+        });
+        write_file(partial / "agent.pt", [&](std::ostream& out) { out << checkpoint.nets; });
+        write_file(partial / "replay.bin", [&](std::ostream& out) { checkpoint.replay->save(out); });
+
+        fs::remove_all(previous);
+        if (fs::exists(target))
+            fs::rename(target, previous);
+        fs::rename(partial, target);
+        fs::remove_all(previous);
+    }
+    catch (const fs::filesystem_error& e)
+    {
+        throw std::runtime_error(std::string("Can not write the checkpoint: ") + e.what());
+    }
+}
+
+Checkpoint read_checkpoint(const std::string& directory)
+{
+    const fs::path path = checkpoint_path(directory);
+    std::ifstream file(path / "state");
+    if (!file.is_open())
+        throw std::runtime_error("Can not open the checkpoint " + directory);
+    std::map<std::string, std::string> state;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        const auto equals = line.find('=');
+        if (std::string::npos != equals)
+            state[trim(line.substr(0, equals))] = trim(line.substr(equals + 1));
+    }
+
+    const auto version = state_value<uint32_t>(state, "version");
+    if (Checkpoint::VERSION != version)
+        throw std::runtime_error("Unsupported checkpoint version " + std::to_string(version));
+    Checkpoint res;
+    res.seq_num = state_value<uint32_t>(state, "seq_num");
+    res.episodes = state_value<uint32_t>(state, "episodes");
+    res.steps = state_value<uint32_t>(state, "steps");
+    res.epsilon = state_value<double>(state, "epsilon");
+    res.rand = state["rand"];
+    res.prefetch_rand = state["prefetch_rand"];
+
+    const FileImage nets(path / "agent.pt");
+    res.nets.assign(nets.data(), nets.size());
+    return res;
+}
+
+void read_replay(const std::string& directory, ReplayMemory& replay)
+{
+    const FileImage image(checkpoint_path(directory) / "replay.bin");
+    replay.load(image.data(), image.size());
+}
+
+Checkpointer::Checkpointer(std::string directory) :
+        _directory(std::move(directory))
+{
+    _thread = std::thread(&Checkpointer::run, this);
+}
+
+Checkpointer::~Checkpointer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    _thread.join();
+    if (_error)
+    {
+        try
+        {
+            std::rethrow_exception(_error);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+}
+
+void Checkpointer::save(Checkpoint checkpoint)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending = std::make_unique<Checkpoint>(std::move(checkpoint));
+    }
+    _wake.notify_all();
+}
+
+void Checkpointer::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return !_pending && !_writing; });
+    if (_error)
+        std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+void Checkpointer::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _wake.wait(lock, [this]() { return _pending || _stopping; });
+        if (!_pending)
+            return;
+
+        const auto checkpoint = std::move(_pending);
+        _writing = true;
+        lock.unlock();
+        std::exception_ptr error;
+        try
+        {
+            write_checkpoint(*checkpoint, _directory);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        lock.lock();
+        _writing = false;
+        if (error && !_error)
+            _error = error;
+        _done.notify_all();
+    }
+}
@@ -0,0 +1,70 @@
+//
+// Training checkpoints: everything a DQN needs to resume, written from a background thread.
+//
+
+#ifndef EXP_CHECKPOINT_H
+#define EXP_CHECKPOINT_H
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "replay.h"
+
+// A checkpoint is a directory of three files:
+//   state       "key = value" lines: version, seq_num, episodes, steps, epsilon, rand and
+//               prefetch_rand
+//   agent.pt    torch archive of the eval net, the target net and the optimizer state
+//   replay.bin  ReplayMemory::save image, mapped back on resume
+struct Checkpoint
+{
+    static constexpr uint32_t VERSION = 1;
+
+    uint32_t                            seq_num = 0;
+    uint32_t                            episodes = 0, steps = 0;    // episodes and gradient steps
+    double                              epsilon = 0;
+    std::string                         rand, prefetch_rand;    // std::default_random_engine states
+    std::string                         nets;   // agent.pt contents
+    std::shared_ptr<const ReplaySnapshot> replay;
+};
+
+// Writes next to directory and renames the result over it, so a crash leaves either the
+// old checkpoint or the new one. Throws std::runtime_error on I/O errors.
+void write_checkpoint(const Checkpoint& checkpoint, const std::string& directory);
+// Reads the state and agent.pt into the result, leaving its replay empty. Throws
+// std::runtime_error if either is missing, malformed, or of another version.
+Checkpoint read_checkpoint(const std::string& directory);
+// Loads replay.bin straight into replay. Throws std::runtime_error as ReplayMemory::load
+// does, or if it is missing.
+void read_replay(const std::string& directory, ReplayMemory& replay);
+
+// Writes checkpoints on its own thread, so training only pays for taking them. A checkpoint
+// handed over while another is being written replaces any older one still waiting.
+class Checkpointer
+{
+public:
+    explicit Checkpointer(std::string directory);
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+    // Finishes the pending write; errors are reported on stderr.
+    ~Checkpointer();
+
+    void save(Checkpoint checkpoint);
+    // Waits until everything handed over is written; rethrows the first write error.
+    void flush();
+
+private:
+    void run();
+
+    std::string                 _directory;
+    std::unique_ptr<Checkpoint> _pending;
+    bool                        _writing = false, _stopping = false;
+    std::exception_ptr          _error;
+    std::mutex                  _mutex;
+    std::condition_variable     _wake, _done;
+    std::thread                 _thread;
+};
+
+#endif //EXP_CHECKPOINT_H
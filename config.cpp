@@ -0,0 +1,242 @@
+#include "config.h"
+
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+namespace
+{
+    struct Field
+    {
+        const char*                                                 name;
+        std::function<void(Config&, const std::string&)>           set;
+        std::function<std::string(const Config&)>                  get;
+    };
+
+    template<typename T>
+    T parse_value(const std::string& text)
+    {
+        T value{};
+        std::istringstream in(text);
+        in >> value;
+        if (in.fail() || !(in >> std::ws).eof())
+            throw std::invalid_argument(text);
+        // "-1" would otherwise wrap around silently.
+        if (std::is_unsigned<T>::value && text.find('-') != std::string::npos)
+            throw std::invalid_argument(text);
+        return value;
+    }
+
+    template<>
+    bool parse_value<bool>(const std::string& text)
+    {
+        if ("1" == text || "true" == text || "yes" == text || "on" == text)
+            return true;
+        if ("0" == text || "false" == text || "no" == text || "off" == text)
+            return false;
+        throw std::invalid_argument(text);
+    }
+
+    template<>
+    std::string parse_value<std::string>(const std::string& text)
+    {
+        return text;
+    }
+
+    template<typename T>
+    std::string format_value(const T& value)
+    {
+        std::ostringstream out;
+        out << std::boolalpha << value;
+        return out.str();
+    }
+
+    template<typename T>
+    Field field(const char* name, T Config::* member)
+    {
+        return {
+            name,
+            [member](Config& config, const std::string& value) { config.*member = parse_value<T>(value); },
+            [member](const Config& config) { return format_value(config.*member); }
+        };
+    }
+
+    template<typename T>
+    Field field(const char* name, T Scores::* member)
+    {
+        return {
+            name,
+            [member](Config& config, const std::string& value) { config.scores.*member = parse_value<T>(value); },
+            [member](const Config& config) { return format_value(config.scores.*member); }
+        };
+    }
+
+    const std::vector<Field>& fields()
+    {
+        static const std::vector<Field> table = {
+            field("init_epsilon", &Config::init_epsilon),
+            field("final_epsilon", &Config::final_epsilon),
+            field("epsilon_decrement", &Config::epsilon_decrement),
+            field("net_update_iteration", &Config::net_update_iteration),
+            field("gamma", &Config::gamma),
+            field("alpha", &Config::alpha),
+            field("replay_memory_size", &Config::replay_memory_size),
+            field("batch_size", &Config::batch_size),
+            field("episodes", &Config::episodes),
+            field("penalize_invalid_actions", &Config::penalize_invalid_actions),
+            field("prioritized_replay", &Config::prioritized_replay),
+            field("priority_alpha", &Config::priority_alpha),
+            field("priority_beta", &Config::priority_beta),
+            field("priority_epsilon", &Config::priority_epsilon),
+            field("kmer_features", &Config::kmer_features),
+            field("warm_start", &Config::warm_start),
+            field("demonstration_weight", &Config::demonstration_weight),
+            field("demonstration_margin", &Config::demonstration_margin),
+            field("updates_per_step", &Config::updates_per_step),
+            field("prefetch", &Config::prefetch),
+            field("match", &Scores::match),
+            field("mismatch", &Scores::mismatch),
+            field("gap", &Scores::gap),
+            field("gap_open", &Scores::gap_open),
+            field("matrix", &Config::matrix),
+            field("banded", &Config::banded),
+            field("input", &Config::input),
+            field("workers", &Config::workers),
+            field("replay_ratio", &Config::replay_ratio),
+            field("beam", &Config::beam),
+            field("int8_inference", &Config::int8_inference),
+            field("export_weights", &Config::export_weights),
+            field("cache", &Config::cache),
+            field("out", &Config::out),
+            field("threads", &Config::threads),
+            field("memory", &Config::memory),
+            field("model", &Config::model),
+            field("checkpoint", &Config::checkpoint),
+            field("checkpoint_every", &Config::checkpoint_every),
+            field("resume", &Config::resume),
+            field("telemetry", &Config::telemetry),
+            field("report_interval", &Config::report_interval)
+        };
+        return table;
+    }
+
+    std::string trim(const std::string& text)
+    {
+        const auto begin = text.find_first_not_of(" \t\r\n");
+        if (std::string::npos == begin)
+            return {};
+        return text.substr(begin, text.find_last_not_of(" \t\r\n") - begin + 1);
+    }
+}
+
+bool Scores::is_default() const
+{
+    return MATCH_REWARD == match && MISMATCH_PENALTY == mismatch && GAP_PENALTY == gap
+           && 0 == gap_open && !matrix;
+}
+
+bool Scores::affine() const
+{
+    return 0 != gap_open;
+}
+
+void Config::set(const std::string& key, const std::string& value)
+{
+    std::string name = key;
+    std::replace(name.begin(), name.end(), '-', '_');
+    for (const auto& f : fields())
+    {
+        if (name != f.name)
+            continue;
+        try
+        {
+            f.set(*this, value);
+        }
+        catch (const std::invalid_argument&)
+        {
+            throw std::runtime_error("Invalid value \"" + value + "\" for " + key);
+        }
+        return;
+    }
+    throw std::runtime_error("Unknown configuration key " + key);
+}
+
+void Config::load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+        throw std::runtime_error("Can not open the configuration file " + path);
+
+    std::string line;
+    for (uint32_t number = 1; std::getline(file, line); number++)
+    {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        const auto equals = line.find('=');
+        if (std::string::npos == equals)
+            throw std::runtime_error(path + ":" + std::to_string(number) + ": expected key = value");
+        set(trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+    }
+}
+
+std::vector<std::string> Config::parse(const int& argc, const char* const* argv)
+{
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg.size() < 3 || 0 != arg.compare(0, 2, "--"))
+        {
+            positional.push_back(arg);
+            continue;
+        }
+        if (i + 1 == argc)
+            throw std::runtime_error("Missing value for " + arg);
+        if ("--config" == arg)
+            load(argv[++i]);
+        else
+            set(arg.substr(2), argv[++i]);
+    }
+    resolve();
+    validate();
+    return positional;
+}
+
+void Config::resolve()
+{
+    if (matrix.empty())
+        scores.matrix.reset();
+    else if ("iupac" == matrix)
+        scores.matrix = SubstitutionMatrix::iupac(scores.match, scores.mismatch);
+    else
+        scores.matrix = SubstitutionMatrix::load(matrix);
+}
+
+void Config::validate() const
+{
+    auto require = [](const bool& ok, const std::string& what)
+    {
+        if (!ok)
+            throw std::runtime_error("Invalid configuration: " + what);
+    };
+    require(batch_size > 0, "batch_size must be positive");
+    require(replay_memory_size >= batch_size, "replay_memory_size must hold at least batch_size transitions");
+    require(epsilon_decrement > 0, "epsilon_decrement must be positive");
+    require(net_update_iteration > 0, "net_update_iteration must be positive");
+    require(updates_per_step > 0, "updates_per_step must be positive");
+    require(workers > 0 && beam > 0 && threads > 0, "workers, beam and threads must be positive");
+    require(replay_ratio > 0, "replay_ratio must be positive");
+    require(scores.match > scores.mismatch, "match must score above mismatch");
+    require(scores.gap_open <= 0, "gap_open must not be positive");
+    require(report_interval > 0, "report_interval must be positive");
+    require(checkpoint_every > 0, "checkpoint_every must be positive");
+}
+
+void Config::write(std::ostream& out) const
+{
+    for (const auto& f : fields())
+        out << f.name << " = " << f.get(*this) << '\n';
+}
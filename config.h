@@ -0,0 +1,108 @@
+//
+// Runtime configuration: the config namespace defaults, overridden from a file and flags.
+//
+
+#ifndef EXP_CONFIG_H
+#define EXP_CONFIG_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "utils.h"
+#include "substitution.h"
+
+// Column scores of the progressive alignment and of the sum of pairs. A run of k gaps in a
+// row costs gap_open + k * gap, so gap_open = 0 is the linear scheme.
+struct Scores
+{
+    int32_t     match = MATCH_REWARD;
+    int32_t     mismatch = MISMATCH_PENALTY;
+    int32_t     gap = GAP_PENALTY;
+    int32_t     gap_open = 0;
+    // Replaces match and mismatch when set.
+    std::shared_ptr<const SubstitutionMatrix> matrix;
+
+    // True for the compiled-in MATCH_REWARD / MISMATCH_PENALTY / GAP_PENALTY with linear gaps
+    // and no matrix, which the alignment kernels are specialized for.
+    [[nodiscard]] bool is_default() const;
+    [[nodiscard]] bool affine() const;
+    // Score of residues a and b in one column.
+    [[nodiscard]] int32_t substitution(const char& a, const char& b) const
+    {
+        if (matrix)
+            return (*matrix)(a, b);
+        return a == b ? match : mismatch;
+    }
+};
+
+// Every member starts at its compile-time default. Keys are the member names; '-' and '_'
+// are interchangeable, so --batch-size and batch_size name the same key.
+struct Config
+{
+    // Training, see the config namespace.
+    double      init_epsilon = config::init_epsilon;
+    double      final_epsilon = config::final_epsilon;
+    uint32_t    epsilon_decrement = config::epsilon_decrement;
+    uint32_t    net_update_iteration = config::net_update_iteration;
+    float       gamma = config::gamma;
+    float       alpha = config::alpha;
+    uint32_t    replay_memory_size = config::replay_memory_size;
+    uint32_t    batch_size = config::batch_size;
+    uint64_t    episodes = config::episodes;
+    bool        penalize_invalid_actions = config::penalize_invalid_actions;
+    bool        prioritized_replay = config::prioritized_replay;
+    float       priority_alpha = config::priority_alpha;
+    float       priority_beta = config::priority_beta;
+    float       priority_epsilon = config::priority_epsilon;
+    bool        kmer_features = config::kmer_features;
+    uint32_t    warm_start = config::warm_start;
+    float       demonstration_weight = config::demonstration_weight;
+    float       demonstration_margin = config::demonstration_margin;
+    uint32_t    updates_per_step = config::updates_per_step;
+    bool        prefetch = config::prefetch;
+
+    // Keys match, mismatch, gap and gap_open.
+    Scores      scores;
+    // "iupac" for SubstitutionMatrix::iupac of match and mismatch, or the path of a matrix
+    // file; parse() builds scores.matrix from it.
+    std::string matrix;
+    // Aligns each step with align_banded, for families of closely related sequences.
+    bool        banded = false;
+
+    // Running.
+    std::string input;              // FASTA file of the family to align, the built-in sample if empty
+    uint32_t    workers = 1;        // actor threads for a single dataset
+    double      replay_ratio = 1;   // learner updates per actor step at most, with workers > 1
+    uint32_t    beam = 1;           // beam width of the final decoding
+    bool        int8_inference = false; // actors and decoding run the net with int8 weights
+    std::string export_weights;     // file the trained net is written to for InferenceNet
+    uint32_t    cache = 0;          // transposition cache entries, 0 for none
+    std::string out;                // batch mode output directory
+    uint32_t    threads = 1;        // batch mode families aligned at once
+    uint64_t    memory = 0;         // batch mode memory limit in MB, 0 for none
+    std::string model;              // pretrained agent to load instead of training
+    std::string checkpoint;         // directory the training state is saved to, none if empty
+    uint32_t    checkpoint_every = 1000;    // episodes between checkpoints
+    std::string resume;             // checkpoint directory to continue training from
+    std::string telemetry;          // file the counters and timers are written to, none if empty
+    double      report_interval = 1; // seconds between progress lines and telemetry writes
+
+    // Sets key to value; throws std::runtime_error for unknown keys and bad values.
+    void set(const std::string& key, const std::string& value);
+    // "key = value" lines; blank lines and anything after '#' are ignored.
+    void load(const std::string& path);
+    // "--key value" flags, with "--config FILE" loading a file at that point, so later flags
+    // override it. Returns the positional arguments.
+    std::vector<std::string> parse(const int& argc, const char* const* argv);
+    // Builds scores.matrix from matrix, or clears it when matrix is empty.
+    void resolve();
+    // Every key in the load() format.
+    void write(std::ostream& out) const;
+    // Throws std::runtime_error for combinations the trainer can not run with, such as a
+    // batch larger than the replay memory. parse() calls it once every flag is applied.
+    void validate() const;
+};
+
+#endif //EXP_CONFIG_H
@@ -1,147 +1,373 @@
 #include "dqn.h"
+#include "telemetry.h"
 #include <iomanip>
+#include <sstream>
 
-Net::Net(const uint32_t& seq_num):  
-        _input(register_module("input", torch::nn::Linear(seq_num, 32))),
-        _l1(register_module("l1", torch::nn::Linear(32, 64))),
-        _l2(register_module("l2", torch::nn::Linear(64, 128))),
-        _l3(register_module("l3", torch::nn::Linear(128, 64))),
-        _l4(register_module("l4", torch::nn::Linear(64, 32))),
-        _output(register_module("output", torch::nn::Linear(32, seq_num)))
+namespace
+{
+    void copy_net_parameters(const Net& from, Net& to)
+    {
+        torch::autograd::GradMode::set_enabled(false);
+        auto eval_params = from.named_parameters();
+        auto target_params = to.named_parameters(true);
+        for (auto& val : eval_params)
+        {
+            auto name = val.key();
+            auto* t = target_params.find(name);
+            if (t != nullptr)
+                t->copy_(val.value());
+            else
+            {
+                std::cout << "Can not find the parameter while coping the net parameters." << std::endl;
+                exit(-1);
+            }
+        }
+        torch::autograd::GradMode::set_enabled(true);
+    }
+
+    torch::Tensor features_tensor(const uint32_t& seq_num, const SequenceEncoding& encoding)
+    {
+        if (encoding.features.empty())
+            return torch::zeros({ seq_num, encoding.width });
+        return torch::from_blob(const_cast<float*>(encoding.features.data()), { seq_num, encoding.width },
+                                torch::kFloat).clone();
+    }
+
+    torch::Tensor distances_tensor(const uint32_t& seq_num, const SequenceEncoding& encoding)
+    {
+        if (encoding.distances.empty())
+            return {};
+        return torch::from_blob(const_cast<float*>(encoding.distances.data()), { seq_num, seq_num },
+                                torch::kFloat).clone();
+    }
+}
+
+ActionSet::ActionSet(const uint32_t& size) :
+        _actions(size),
+        _position(size),
+        _mask(size),
+        _size(size)
+{
+    reset();
+}
+
+void ActionSet::reset()
+{
+    for (size_t i = 0; i < _actions.size(); i++)
+    {
+        _actions[i] = (int32_t)i;
+        _position[i] = (int32_t)i;
+    }
+    std::fill(_mask.begin(), _mask.end(), 1);
+    _size = (uint32_t)_actions.size();
+}
+
+void ActionSet::remove(const int64_t& action)
+{
+    // Swap the action behind the last available one.
+    const int32_t last = _actions[--_size];
+    const int32_t pos = _position[action];
+    _actions[pos] = last;
+    _position[last] = pos;
+    _actions[_size] = (int32_t)action;
+    _position[action] = (int32_t)_size;
+    _mask[action] = 0;
+}
+
+int64_t ActionSet::random(std::default_random_engine& rand) const
+{
+    return _actions[rand() % _size];
+}
+
+bool ActionSet::contains(const int64_t& action) const
+{
+    return 0 != _mask[action];
+}
+
+uint32_t ActionSet::size() const
+{
+    return _size;
+}
+
+const std::vector<uint8_t>& ActionSet::mask() const
+{
+    return _mask;
+}
+
+Net::Net(const torch::Tensor& features, const torch::Tensor& distances):
+        _features(features),
+        _distances(distances),
+        _input(register_module("input", torch::nn::Linear(features.size(1) + NET_STATE_COLUMNS, NET_HIDDEN))),
+        _l1(register_module("l1", torch::nn::Linear(NET_HIDDEN, NET_HIDDEN))),
+        _l2(register_module("l2", torch::nn::Linear(3 * NET_HIDDEN, NET_HIDDEN))),
+        _output(register_module("output", torch::nn::Linear(NET_HIDDEN, 1)))
 {
 
 }
 
 torch::Tensor Net::forward(const torch::Tensor& input)
 {
-    auto res = torch::relu(_input(input));
+    const int64_t batch = input.size(0), seq_num = input.size(1);
+
+    // Slot k of a state holds the k-th chosen sequence or -1; turn that into, per sequence,
+    // whether it is chosen, its rank in the order and whether it was chosen last.
+    torch::Tensor filled = input.ge(0).to(torch::kFloat);
+    torch::Tensor index = input.clamp(0, seq_num - 1).to(torch::kLong);
+    torch::Tensor depth = filled.sum(1, true);
+    torch::Tensor slot = torch::arange(seq_num, torch::kFloat).unsqueeze(0);
+    torch::Tensor chosen = torch::zeros({ batch, seq_num }).scatter_add(1, index, filled);
+    torch::Tensor rank = torch::zeros({ batch, seq_num }).scatter_add(1, index, filled * (slot + 1) / (double)seq_num);
+    torch::Tensor last = torch::zeros({ batch, seq_num }).scatter_add(1, index, filled * (slot == depth - 1).to(torch::kFloat));
+
+    // Mean distance to the aligned sequences and distance to the last one.
+    torch::Tensor to_aligned = torch::zeros({ batch, seq_num }), to_last = torch::zeros({ batch, seq_num });
+    if (_distances.defined())
+    {
+        to_aligned = chosen.matmul(_distances) / depth.clamp_min(1);
+        to_last = last.matmul(_distances);
+    }
+
+    torch::Tensor tokens = torch::cat({ _features.unsqueeze(0).expand({ batch, seq_num, _features.size(1) }),
+                                        torch::stack({ chosen, rank, last, (depth / (double)seq_num).expand({ batch, seq_num }),
+                                                       to_aligned, to_last }, 2) }, 2);
+    auto res = torch::relu(_input(tokens));
     res = torch::relu(_l1(res));
-    // res = torch::relu(_l2(res));
-    // res = torch::relu(_l3(res));
-    res = torch::relu(_l4(res));
-    res = torch::tanh(_output(res));
 
+    torch::Tensor everything = res.mean(1, true).expand_as(res);
+    torch::Tensor aligned = ((res * chosen.unsqueeze(2)).sum(1, true) / depth.clamp_min(1).unsqueeze(2)).expand_as(res);
+    res = torch::relu(_l2(torch::cat({ res, everything, aligned }, 2)));
+    res = torch::tanh(_output(res)).squeeze(2);
+
+    return res;
+}
+
+const torch::Tensor& Net::features() const
+{
+    return _features;
+}
+
+const torch::Tensor& Net::distances() const
+{
+    return _distances;
+}
+
+NetWeights Net::weights() const
+{
+    auto values = [](const torch::Tensor& tensor)
+    {
+        torch::Tensor t = tensor.detach().to(torch::kFloat).contiguous();
+        const float* data = t.data_ptr<float>();
+        return std::vector<float>(data, data + t.numel());
+    };
+    NetWeights res;
+    res.feature_width = (uint32_t)_features.size(1);
+    res.input_weight = values(_input->weight);
+    res.input_bias = values(_input->bias);
+    res.l1_weight = values(_l1->weight);
+    res.l1_bias = values(_l1->bias);
+    res.l2_weight = values(_l2->weight);
+    res.l2_bias = values(_l2->bias);
+    res.output_weight = values(_output->weight);
+    res.output_bias = values(_output->bias)[0];
     return res;
 }
 
-DQN::DQN(const uint32_t & seq_num) :
-        _eval_net(seq_num),
-        _target_net(seq_num),
-        _optimizer(_eval_net.parameters(), config::alpha),
+DQN::DQN(const uint32_t & seq_num, const SequenceEncoding& encoding, const Config& config) :
+        _config(config),
+        _encoding(encoding),
+        _eval_net(features_tensor(seq_num, encoding), distances_tensor(seq_num, encoding)),
+        _target_net(_eval_net.features(), _eval_net.distances()),
+        _optimizer(_eval_net.parameters(), config.alpha),
         _loss(),
-        _cur_epsilon(config::init_epsilon),
-        _delta((config::init_epsilon - config::final_epsilon) / ((config::episodes) / config::epsilon_decrement)),
+        _cur_epsilon(config.init_epsilon),
+        _delta((config.init_epsilon - config.final_epsilon) / std::max<uint64_t>(1, config.episodes / config.epsilon_decrement)),
         _seq_num(seq_num),
         _rand((uint32_t)time(nullptr)),
         _step_counter(0),
         _episode_counter(0),
-        _replay_memorty_size(0),
-        _rest_actions(seq_num),
-        _actions(seq_num)
+        _replay_memory(config.replay_memory_size, seq_num, config.prioritized_replay, config.priority_alpha,
+                       config.priority_epsilon),
+        _prefetch_rand((uint32_t)time(nullptr) + 1),
+        _available(seq_num),
+        _inference(seq_num, encoding, config.int8_inference),
+        _inference_stale(true),
+        _batches(_mutex, { _replay_memory.make_batch(config.batch_size), _replay_memory.make_batch(config.batch_size) },
+                 [this](ReplayMemory::Batch& batch) { return sample(batch); }, config.prefetch)
 {
-    for (int i = 0; i < seq_num; i++)
-        _actions[i] = i;
-    _rest_actions = _actions;
+
 }
 
 int64_t DQN::select(const std::vector<state_type>& state)
 {
+    // Reloading costs more than the forward pass it serves, so as with the rollout actors'
+    // snapshots this happens on the first pick of an episode only: an episode acts on the
+    // eval net as it began, at most (seq_num - 1) * updates_per_step gradient steps old.
+    if (_inference_stale && _available.size() == _seq_num)
+    {
+        snapshot(_inference);
+        _inference_stale = false;
+    }
+    return select(_inference, state, _available, _rand, _cur_epsilon);
+}
+
+int64_t DQN::select(InferenceNet& net, const std::vector<state_type>& state, ActionSet& available,
+                    std::default_random_engine& rand, const double& epsilon)
+{
+    telemetry::Scope timer(telemetry::SELECT);
     int64_t action;
 
-    if ((double)(_rand() % 100001) / 100000 < _cur_epsilon)
+    if ((double)(rand() % 100001) / 100000 < epsilon)
+    {
+        action = available.random(rand);
+    }
+    else if (!_config.penalize_invalid_actions)
     {
-        uint32_t idx = _rand() % _rest_actions.size();
-        action = _rest_actions[idx];
-        _rest_actions.erase(idx + _rest_actions.begin());
+        action = net.best(state, available.mask().data());
     }
     else
     {
-        torch::Tensor action_values = _eval_net.forward(
-                torch::from_blob((void*)state.data(),
-                                 { 1, _seq_num }, torch::kInt32).clone().to(torch::kFloat));
-        while (true)
-        {
-            action = torch::argmax(action_values, 1).item<int64_t>();
-            auto iterator = find(_rest_actions.begin(), _rest_actions.end(), action);
-            if (iterator != _rest_actions.end())
-            {
-                _rest_actions.erase(iterator);
-                break;
-            }
-            else
-            {
-                auto next_state = state;
-                next_state[_seq_num - _rest_actions.size()] = (state_type)action;
-                push({state, action, next_state, -1, 1 });
-                action_values[0][action] = -2;
-            }
-        }
+        std::vector<float> q(_seq_num);
+        net.q_values(state, q.data());
+        action = greedy(q.data(), state, available);
     }
+    available.remove(action);
 
     return action;
 }
 
-void DQN::update()
+int64_t DQN::greedy(const float* q, const std::vector<state_type>& state, const ActionSet& available)
 {
-    _step_counter++;
-    if (_replay_memory.size() < config::batch_size)
-        return;
+    const auto& mask = available.mask();
+    int64_t action = -1;
+    for (uint32_t a = 0; a < _seq_num; a++)
+    {
+        if (mask[a] && (action < 0 || q[a] > q[action]))
+            action = a;
+    }
+
+    for (uint32_t a = 0; a < _seq_num; a++)
+    {
+        if (mask[a] || q[a] < q[action])
+            continue;
+        auto next_state = state;
+        next_state[_seq_num - available.size()] = (state_type)a;
+        push({ state, a, next_state, -1, 1 });
+    }
+    return action;
+}
 
-    if (0 == _step_counter % config::net_update_iteration)
-        copy_parameters();
+void DQN::update()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_replay_memory.size() < _config.batch_size)
+            return;
+    }
 
-    std::vector<state_type> b_states, b_next_states;
-    std::vector<int64_t> b_actions;
-    std::vector<float> b_rewards;
-    std::vector<int32_t> b_dones;
-    sample(b_states, b_actions, b_next_states, b_rewards, b_dones);
+    std::lock_guard<std::mutex> net_lock(_net_mutex);
+    for (uint32_t i = 0; i < _config.updates_per_step; i++)
+    {
+        auto* batch = _batches.next();
+        if (nullptr == batch)
+            break;
+        train(*batch);
+        // net_update_iteration counts gradient steps, however many an update() takes.
+        if (0 == ++_step_counter % _config.net_update_iteration)
+            copy_parameters();
+    }
+    _inference_stale = true;
+}
 
-    torch::Tensor rewards = torch::from_blob(b_rewards.data(), { config::batch_size }, torch::kFloat32).unsqueeze_(1).clone();
-    torch::Tensor dones = torch::from_blob(b_dones.data(), { config::batch_size }, torch::kInt32).unsqueeze_(1).clone();
-    torch::Tensor actions = torch::from_blob(b_actions.data(), {config::batch_size, 1}, torch::kInt64).clone();
-    torch::Tensor states = torch::from_blob(b_states.data(), { config::batch_size, _seq_num }, torch::kInt32).clone().to(torch::kFloat).permute({0, 1});
-    torch::Tensor next_states = torch::from_blob(b_next_states.data(), { config::batch_size, _seq_num }, torch::kInt32).to(torch::kFloat).clone().permute({ 0, 1 });
+void DQN::train(ReplayMemory::Batch& batch)
+{
+    telemetry::count(telemetry::UPDATES);
 
-    torch::Tensor q_eval = _eval_net.forward(states).gather(1, actions);
+    torch::Tensor q_eval, q_target;
+    {
+        telemetry::Scope timer(telemetry::FORWARD);
+        torch::Tensor q_values = _eval_net.forward(batch.states);
+        q_eval = q_values.gather(1, batch.actions);
 
-    torch::autograd::GradMode::set_enabled(false);
-    torch::Tensor q_target = rewards + dones * config::gamma * std::get<0>(_target_net.forward(next_states).max(1)).unsqueeze_(1);
-    torch::autograd::GradMode::set_enabled(true);
+        torch::autograd::GradMode::set_enabled(false);
+        // Actions already taken in next_state are masked to -2, below any tanh output.
+        torch::Tensor next_q = _target_net.forward(batch.next_states).masked_fill_(batch.next_taken, -2);
+        q_target = batch.rewards + batch.dones * _config.gamma * std::get<0>(next_q.max(1)).unsqueeze_(1);
+        torch::autograd::GradMode::set_enabled(true);
 
-    _loss = torch::mse_loss(q_eval, q_target);
-    _eval_net.zero_grad();
-    _loss.backward();
-    _optimizer.step();
+        if (_replay_memory.prioritized())
+            _loss = (batch.weights * (q_eval - q_target).pow(2)).mean();
+        else
+            _loss = torch::mse_loss(q_eval, q_target);
+        if (_config.demonstration_weight > 0)
+            _loss = _loss + _config.demonstration_weight * demonstration_loss(q_values, q_eval, batch);
+    }
+    {
+        telemetry::Scope timer(telemetry::BACKWARD);
+        _eval_net.zero_grad();
+        _loss.backward();
+        _optimizer.step();
+    }
 
+    if (_replay_memory.prioritized())
+    {
+        // q_eval holds the values from before the step.
+        torch::Tensor td_errors = (q_target - q_eval).detach().contiguous();
+        const float* errors = td_errors.data_ptr<float>();
+        std::unique_lock<std::mutex> lock(_mutex);
+        _batches.settle(lock);
+        _replay_memory.update_priorities(batch.slots, std::vector<float>(errors, errors + _config.batch_size));
+    }
 }
 
 int64_t DQN::predict(const std::vector<state_type>& state)
 {
+    torch::NoGradGuard no_grad;
     torch::Tensor res = _eval_net.forward(torch::from_blob(const_cast<std::vector<state_type>&>(state).data(),
-                                                           { 1, _seq_num }, torch::kInt32).clone().to(torch::kFloat));
+                                                           { 1, _seq_num }, torch::kInt32).to(torch::kFloat));
     return torch::argmax(res).item<int64_t>();
 }
 
 float DQN::predict_q_value(const std::vector<state_type>& state)
 {
+    torch::NoGradGuard no_grad;
     torch::Tensor res = _eval_net.forward(torch::from_blob(const_cast<std::vector<state_type>&>(state).data(),
-        { 1, _seq_num }, torch::kInt32).clone().to(torch::kFloat));
+        { 1, _seq_num }, torch::kInt32).to(torch::kFloat));
     return torch::max(res).item<float>();
 }
 
-void DQN::push(Transition transition)
+torch::Tensor DQN::q_values(const std::vector<std::vector<state_type>>& states)
 {
-    if (_replay_memorty_size < config::replay_memory_size)
-    {
-        _replay_memorty_size++;
-        _replay_memory.emplace_back(std::move(transition));
-    }
-    else
-        _replay_memory[_replay_memorty_size++ % config::replay_memory_size] = std::move(transition);
+    torch::NoGradGuard no_grad;
+    return _eval_net.forward(to_tensor(states));
+}
+
+std::vector<int64_t> DQN::predict(const std::vector<std::vector<state_type>>& states)
+{
+    torch::Tensor res = std::get<1>(q_values(states).max(1)).contiguous();
+    const auto* actions = res.data_ptr<int64_t>();
+    return { actions, actions + states.size() };
+}
+
+std::vector<float> DQN::predict_q_value(const std::vector<std::vector<state_type>>& states)
+{
+    torch::Tensor res = std::get<0>(q_values(states).max(1)).contiguous();
+    const auto* values = res.data_ptr<float>();
+    return { values, values + states.size() };
+}
+
+void DQN::push(Transition transition, const bool& demonstration)
+{
+    telemetry::Scope timer(telemetry::PUSH);
+    telemetry::count(telemetry::TRANSITIONS);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _batches.settle(lock);
+    _replay_memory.push(std::get<0>(transition), std::get<1>(transition), std::get<2>(transition),
+                        std::get<3>(transition), std::get<4>(transition), demonstration);
 }
 
 void DQN::save(const std::string& path)
 {
+    std::lock_guard<std::mutex> lock(_net_mutex);
     torch::serialize::OutputArchive outputArchive;
     _eval_net.save(outputArchive);
     outputArchive.save_to(path);
@@ -149,62 +375,198 @@ void DQN::save(const std::string& path)
 
 void DQN::load(const std::string& path)
 {
+    std::lock_guard<std::mutex> lock(_net_mutex);
     torch::serialize::InputArchive inputArchive;
     inputArchive.load_from(path);
 
     _eval_net.load(inputArchive);
+    _inference_stale = true;
     copy_parameters();
 }
 
+Checkpoint DQN::checkpoint()
+{
+    Checkpoint res;
+    res.seq_num = _seq_num;
+    std::lock_guard<std::mutex> net_lock(_net_mutex);
+    {
+        torch::serialize::OutputArchive archive, eval, target, optimizer;
+        _eval_net.save(eval);
+        _target_net.save(target);
+        _optimizer.save(optimizer);
+        archive.write("eval", eval);
+        archive.write("target", target);
+        archive.write("optimizer", optimizer);
+        std::ostringstream out;
+        archive.save_to(out);
+        res.nets = out.str();
+        res.steps = _step_counter;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    // Resuming can not draw a batch the prefetch thread has drawn already, so this run draws
+    // it again as well, and both go on alike.
+    _batches.settle(lock);
+    _batches.discard();
+    res.episodes = _episode_counter;
+    res.epsilon = _cur_epsilon;
+    std::ostringstream rand, prefetch_rand;
+    rand << _rand;
+    prefetch_rand << _prefetch_rand;
+    res.rand = rand.str();
+    res.prefetch_rand = prefetch_rand.str();
+    res.replay = std::make_shared<const ReplaySnapshot>(_replay_memory.snapshot());
+    return res;
+}
+
+void DQN::restore(const std::string& directory)
+{
+    // Everything is read into temporaries and checked before any of it is swapped in, so a
+    // checkpoint that does not load leaves the agent as it was.
+    const Checkpoint checkpoint = read_checkpoint(directory);
+    if (checkpoint.seq_num != _seq_num)
+        throw std::runtime_error("The checkpoint " + directory + " is for " + std::to_string(checkpoint.seq_num)
+                                 + " sequences, not " + std::to_string(_seq_num));
+    std::default_random_engine rand, prefetch_rand;
+    if (!(std::istringstream(checkpoint.rand) >> rand) || !(std::istringstream(checkpoint.prefetch_rand) >> prefetch_rand))
+        throw std::runtime_error("The checkpoint " + directory + " has no valid random engine state");
+
+    Net eval(_eval_net.features(), _eval_net.distances()), target(_eval_net.features(), _eval_net.distances());
+    torch::serialize::InputArchive optimizer;
+    try
+    {
+        std::istringstream in(checkpoint.nets);
+        torch::serialize::InputArchive archive, eval_archive, target_archive;
+        archive.load_from(in);
+        archive.read("eval", eval_archive);
+        archive.read("target", target_archive);
+        archive.read("optimizer", optimizer);
+        eval.load(eval_archive);
+        target.load(target_archive);
+        // Loaded once to check it fits, since _optimizer can only take it once swapped in.
+        torch::optim::Adam check(eval.parameters(), _config.alpha);
+        check.load(optimizer);
+    }
+    catch (const c10::Error& e)
+    {
+        throw std::runtime_error("The checkpoint " + directory + " has no valid agent.pt: " + e.what_without_backtrace());
+    }
+
+    ReplayMemory replay(_config.replay_memory_size, _seq_num, _config.prioritized_replay, _config.priority_alpha,
+                        _config.priority_epsilon);
+    read_replay(directory, replay);
+
+    std::lock_guard<std::mutex> net_lock(_net_mutex);
+    std::unique_lock<std::mutex> lock(_mutex);
+    // A batch drawn from the replaced memory may name slots it no longer has.
+    _batches.settle(lock);
+    _batches.discard();
+    _replay_memory = std::move(replay);
+    copy_net_parameters(eval, _eval_net);
+    copy_net_parameters(target, _target_net);
+    _optimizer.load(optimizer);
+    _inference_stale = true;
+
+    _step_counter = checkpoint.steps;
+    _episode_counter = checkpoint.episodes;
+    _cur_epsilon = checkpoint.epsilon;
+    _rand = rand;
+    _prefetch_rand = prefetch_rand;
+    _available.reset();
+}
+
+uint32_t DQN::episodes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _episode_counter;
+}
+
 void DQN::reset()
 {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _batches.settle(lock);
     _episode_counter++;
 
-    if (0 == _episode_counter % config::epsilon_decrement)
+    if (0 == _episode_counter % _config.epsilon_decrement)
         _cur_epsilon -= _delta;
-    _rest_actions = _actions;
+    _available.reset();
 }
 
-void DQN::sample(std::vector<state_type>& state, std::vector<int64_t>& action,
-                  std::vector<state_type>& next_state, std::vector<float>& reward, std::vector<int32_t>& done)
+bool DQN::sample(ReplayMemory::Batch& batch)
 {
-    std::vector<Transition> samples;
-    std::sample(_replay_memory.begin(), _replay_memory.end(), std::back_inserter(samples),
-        config::batch_size, std::mt19937{ _rand() });
+    if (_replay_memory.size() < _config.batch_size)
+        return false;
+    telemetry::Scope timer(telemetry::SAMPLE);
+    // Importance-sampling correction grows to full strength by the last episode.
+    const double progress = std::min(1., (double)_episode_counter / _config.episodes);
+    _replay_memory.sample(batch, _config.prefetch ? _prefetch_rand : _rand,
+                          _config.priority_beta + (1. - _config.priority_beta) * progress);
+    return true;
+}
 
-    state.resize(config::batch_size * _seq_num);
-    next_state.resize(config::batch_size * _seq_num);
-    action.resize(config::batch_size);
-    reward.resize(config::batch_size);
-    done.resize(config::batch_size);
-    for (int i = 0; i < config::batch_size; i++)
-    {
-        const Transition& t = samples[i];
-        memcpy(&state[i * _seq_num], std::get<0>(t).data(), sizeof(state_type) * _seq_num);
-        action[i] = std::get<1>(t);
-        memcpy(&next_state[i * _seq_num], std::get<2>(t).data(), sizeof(state_type) * _seq_num);
-        reward[i] = std::get<3>(t);
-        done[i] = std::get<4>(t);
-    }
+InferenceNet DQN::inference()
+{
+    InferenceNet net(_seq_num, _encoding, _config.int8_inference);
+    snapshot(net);
+    return net;
+}
+
+void DQN::snapshot(InferenceNet& net)
+{
+    net.load(weights());
+}
+
+NetWeights DQN::weights()
+{
+    std::lock_guard<std::mutex> lock(_net_mutex);
+    return _eval_net.weights();
+}
+
+const torch::Tensor& DQN::features() const
+{
+    return _eval_net.features();
+}
+
+const torch::Tensor& DQN::distances() const
+{
+    return _eval_net.distances();
+}
+
+double DQN::epsilon() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _cur_epsilon;
+}
+
+uint32_t DQN::seq_num() const
+{
+    return _seq_num;
+}
+
+torch::Tensor DQN::to_tensor(const std::vector<std::vector<state_type>>& states) const
+{
+    torch::Tensor res = torch::empty({ (int64_t)states.size(), _seq_num }, torch::kFloat32);
+    auto* dst = res.data_ptr<float>();
+    for (const auto& state : states)
+        dst = std::copy(state.begin(), state.end(), dst);
+    return res;
+}
+
+torch::Tensor DQN::demonstration_loss(const torch::Tensor& q_values, const torch::Tensor& q_eval,
+                                      const ReplayMemory::Batch& batch) const
+{
+    // max over the actions available in state of Q(s, a) + margin * [a is not the
+    // demonstrated one], minus Q(s, demonstrated), averaged over the demonstrations.
+    // Available in state means not taken in next_state, except the action itself.
+    torch::Tensor taken = batch.next_taken.scatter(1, batch.actions, false);
+    torch::Tensor margins = torch::full({ _config.batch_size, _seq_num }, _config.demonstration_margin)
+            .scatter(1, batch.actions, 0.f);
+    torch::Tensor best = std::get<0>((q_values + margins).masked_fill(taken, -2).max(1, true));
+    return (batch.demonstrations * (best - q_eval)).sum() / batch.demonstrations.sum().clamp_min(1);
 }
 
 void DQN::copy_parameters()
 {
-    torch::autograd::GradMode::set_enabled(false);
-    auto eval_params = _eval_net.named_parameters();
-    auto target_params = _target_net.named_parameters(true);
-    auto buffers = _target_net.named_buffers(true);
-    for (auto& val : eval_params)
-    {
-        auto name = val.key();
-        auto* t = target_params.find(name);
-        if (t != nullptr)
-            t->copy_(val.value());
-        else
-        {
-            std::cout << "Can not find the parameter while coping the net parameters." << std::endl;
-            exit(-1);
-        }
-    }
-    torch::autograd::GradMode::set_enabled(true);
-}
\ No newline at end of file
+    telemetry::Scope timer(telemetry::TARGET_COPY);
+    copy_net_parameters(_eval_net, _target_net);
+}
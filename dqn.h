@@ -4,55 +4,167 @@
 #include <random>
 #include <iterator>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 #include "torch/torch.h"
 #include "utils.h"
+#include "replay.h"
+#include "encoder.h"
+#include "config.h"
+#include "checkpoint.h"
+#include "inference.h"
+#include "prefetch.h"
 
 using Transition = std::tuple<std::vector<state_type>, int64_t, std::vector<state_type>, float, int32_t>;
 
+// Actions not yet taken in the current episode, with O(1) removal and uniform draws and a
+// per-action availability mask for masking Q-values.
+class ActionSet
+{
+public:
+    explicit ActionSet(const uint32_t& size);
+
+    void reset();
+    void remove(const int64_t& action);
+    [[nodiscard]] int64_t random(std::default_random_engine& rand) const;
+    [[nodiscard]] bool contains(const int64_t& action) const;
+    [[nodiscard]] uint32_t size() const;
+    // mask()[a] is 1 while action a is available.
+    [[nodiscard]] const std::vector<uint8_t>& mask() const;
+
+private:
+    std::vector<int32_t>    _actions, _position;    // available ones first, _size of them
+    std::vector<uint8_t>    _mask;
+    uint32_t                _size;
+};
+
+// Scores every sequence with the same weights, from its features, its place in the state
+// and its distance to the aligned ones, plus pooled embeddings of all sequences and of
+// those already aligned. Nothing is
+// sized by the number of sequences, so a trained net can be loaded for any family.
 class Net : public torch::nn::Module
 {
 public:
-    explicit Net(const uint32_t& seq_num);
+    // features is {seq_num, width} and distances, if defined, {seq_num, seq_num}, as in
+    // SequenceEncoding. Both are per dataset and not saved with the net.
+    explicit Net(const torch::Tensor& features, const torch::Tensor& distances = {});
 
+    // input is {batch, seq_num} states, the result {batch, seq_num} Q-values.
     torch::Tensor forward(const torch::Tensor& input);
 
+    [[nodiscard]] const torch::Tensor& features() const;
+    [[nodiscard]] const torch::Tensor& distances() const;
+    // The parameters, for InferenceNet::load.
+    [[nodiscard]] NetWeights weights() const;
+
 private:
-    torch::nn::Linear _input, _l1, _l2, _l3, _l4, _output;
+    torch::Tensor _features, _distances;
+    torch::nn::Linear _input, _l1, _l2, _output;
 };
 
 class DQN
 {
 public:
-    explicit DQN(const uint32_t& seq_num);
+    // encoding as returned by Environment::encoding(); all-zero features when empty.
+    explicit DQN(const uint32_t& seq_num, const SequenceEncoding& encoding = {}, const Config& config = Config());
+    DQN(const DQN&) = delete;
+    DQN& operator=(const DQN&) = delete;
 
+    // Picks on an InferenceNet of the eval net, refreshed at the start of an episode if
+    // update() has changed the eval net since.
     int64_t select(const std::vector<state_type>& state);
+    // Epsilon-greedy choice among the available actions with the given net, for actors
+    // that keep their own episode state and eval net snapshot. Thread-safe. The greedy pick
+    // is an argmax over the available actions only; with Config::penalize_invalid_actions,
+    // every taken action the net ranks above it is also pushed as a -1 reward transition.
+    int64_t select(InferenceNet& net, const std::vector<state_type>& state, ActionSet& available,
+                   std::default_random_engine& rand, const double& epsilon);
+    // Config::updates_per_step gradient steps, once the replay memory holds a batch. With
+    // Config::prefetch, each step trains on a batch sampled while the previous one trained:
+    // it misses what was pushed since and, with prioritized replay, the previous step's
+    // priority updates, so its draw and importance weights are one step stale. Pushes,
+    // priority updates and reset() wait for such a draw to finish, so it is exactly one
+    // step stale and the same from run to run.
     void update();
     int64_t predict(const std::vector<state_type>& state);
     float predict_q_value(const std::vector<state_type>& state);
 
-    void push(Transition transition);
-
+    // Batched counterparts: one forward pass without autograd over all states, e.g. from
+    // many environments or beam candidates. q_values returns {states.size(), seq_num}.
+    torch::Tensor q_values(const std::vector<std::vector<state_type>>& states);
+    std::vector<int64_t> predict(const std::vector<std::vector<state_type>>& states);
+    std::vector<float> predict_q_value(const std::vector<std::vector<state_type>>& states);
+
+    // Demonstrations also train the large-margin loss, see Config::demonstration_weight.
+    void push(Transition transition, const bool& demonstration = false);
+
+    // An InferenceNet of the eval net as it is now, int8 with Config::int8_inference.
+    [[nodiscard]] InferenceNet inference();
+    // Loads the eval net parameters into net, made by inference().
+    void snapshot(InferenceNet& net);
+    [[nodiscard]] NetWeights weights();
+    [[nodiscard]] const torch::Tensor& features() const;
+    [[nodiscard]] const torch::Tensor& distances() const;
+    [[nodiscard]] double epsilon() const;
+    [[nodiscard]] uint32_t seq_num() const;
+
+    // save and load cover the eval net only, for decoding.
     void save(const std::string& path);
     void load(const std::string& path);
 
+    // The full training state: both nets, the optimizer, the replay memory, epsilon, the
+    // counters and both random engines. Serializes the nets and snapshots the replay memory,
+    // which pushes then copy on write; the file I/O is left to write_checkpoint or a
+    // Checkpointer. Drops a prefetched batch, which is drawn again. Taken between serial
+    // episodes, resuming from it replays the trajectory this run goes on with.
+    [[nodiscard]] Checkpoint checkpoint();
+    // Resumes from a checkpoint directory written for the same sequences and Config.
+    // Throws std::runtime_error, leaving the agent as it was, if it does not load or match.
+    void restore(const std::string& directory);
+    // Episodes finished so far, counting those before a restore.
+    [[nodiscard]] uint32_t episodes() const;
+
     void reset();
 private:
     void copy_parameters();
-    void sample(std::vector<state_type>& state, std::vector<int64_t>& action, std::vector<state_type>& next_state, std::vector<float>& reward, std::vector<int32_t> &done);
+    torch::Tensor to_tensor(const std::vector<std::vector<state_type>>& states) const;
+    torch::Tensor demonstration_loss(const torch::Tensor& q_values, const torch::Tensor& q_eval,
+                                     const ReplayMemory::Batch& batch) const;
+    // Fills batch from the replay memory, false if it holds less than a batch. The caller
+    // holds _mutex.
+    bool sample(ReplayMemory::Batch& batch);
+    void train(ReplayMemory::Batch& batch);
+    // Argmax of q over the available actions, pushing the penalty transitions.
+    int64_t greedy(const float* q, const std::vector<state_type>& state, const ActionSet& available);
+
+    const Config _config;
+    const SequenceEncoding _encoding;
 
     Net _eval_net, _target_net;
     torch::optim::Adam _optimizer;
     torch::Tensor _loss;
 
     double _cur_epsilon, _delta;
-    uint32_t _seq_num, _step_counter, _episode_counter;
+    uint32_t _seq_num, _step_counter, _episode_counter;   // _step_counter counts gradient steps
 
     std::default_random_engine _rand;
 
-    std::vector<Transition> _replay_memory;
-    uint32_t _replay_memorty_size;
+    ReplayMemory _replay_memory;
+    // With Config::prefetch, batches are drawn with this one, off the thread using _rand.
+    std::default_random_engine _prefetch_rand;
+
+    ActionSet _available;
+    // select(state)'s net, stale once update(), load() or restore() changes the eval net.
+    InferenceNet _inference;
+    std::atomic<bool> _inference_stale;
+
+    // _mutex guards the replay memory and the episode counters, _net_mutex the eval net
+    // parameters, so actor threads can push and snapshot while update() trains.
+    mutable std::mutex _mutex;
+    std::mutex _net_mutex;
 
-    std::vector<int32_t> _rest_actions, _actions;
+    // update()'s batches, filled by sample() under _mutex; stopped before the rest goes.
+    Prefetcher<ReplayMemory::Batch> _batches;
 };
 
 #endif //EXP_DQN_H
\ No newline at end of file
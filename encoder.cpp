@@ -0,0 +1,228 @@
+#include "encoder.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(EXP_ENCODER_NO_SIMD)
+#define EXP_ENCODER_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    constexpr uint32_t KMER_MASK = (1u << (2 * KMER_LENGTH)) - 1;
+    constexpr uint32_t HASH_MULTIPLIER = 0x9E3779B1u;
+    constexpr uint32_t HASH_SHIFT = 32 - 7;
+    static_assert(1u << (32 - HASH_SHIFT) == SKETCH_SIZE, "HASH_SHIFT must match SKETCH_SIZE");
+
+    // Replaces the n k-mer codes in codes by their bucket.
+    using HashKmers = void (*)(uint32_t* codes, size_t n);
+
+    struct KmerKernel
+    {
+        const char* name;
+        HashKmers hash;
+    };
+
+    void hash_kmers_scalar(uint32_t* codes, size_t n)
+    {
+        for (size_t i = 0; i < n; i++)
+            codes[i] = (codes[i] * HASH_MULTIPLIER) >> HASH_SHIFT;
+    }
+
+#ifdef EXP_ENCODER_X86
+    __attribute__((target("avx2")))
+    void hash_kmers_avx2(uint32_t* codes, size_t n)
+    {
+        const __m256i multiplier = _mm256_set1_epi32((int32_t)HASH_MULTIPLIER);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(codes + i));
+            v = _mm256_srli_epi32(_mm256_mullo_epi32(v, multiplier), HASH_SHIFT);
+            _mm256_storeu_si256((__m256i*)(codes + i), v);
+        }
+        hash_kmers_scalar(codes + i, n - i);
+    }
+#endif
+
+    const KmerKernel& kmer_kernel()
+    {
+        static const KmerKernel kernel = []() -> KmerKernel
+        {
+#ifdef EXP_ENCODER_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return { "avx2", hash_kmers_avx2 };
+#endif
+            return { "scalar", hash_kmers_scalar };
+        }();
+        return kernel;
+    }
+
+    // Runs work(i) for i in [0, count), with `threads` threads taking every threads-th i.
+    template<typename Work>
+    void parallel_rows(const uint32_t& count, const uint32_t& threads, const Work& work)
+    {
+        const uint32_t workers = std::max<uint32_t>(1, std::min(threads, count));
+        if (1 == workers)
+        {
+            for (uint32_t i = 0; i < count; i++)
+                work(i);
+            return;
+        }
+        std::vector<std::thread> pool;
+        for (uint32_t t = 0; t < workers; t++)
+        {
+            pool.emplace_back([&, t]()
+            {
+                for (uint32_t i = t; i < count; i += workers)
+                    work(i);
+            });
+        }
+        for (auto& thread : pool)
+            thread.join();
+    }
+}
+
+std::vector<float> sequence_features(const std::vector<std::string>& sequences)
+{
+    std::vector<float> res(sequences.size() * SEQUENCE_FEATURES, 0.f);
+    if (sequences.empty())
+        return res;
+
+    double mean = 0;
+    for (const auto& sequence : sequences)
+        mean += (double)sequence.size();
+    mean = std::max(1., mean / (double)sequences.size());
+
+    for (size_t i = 0; i < sequences.size(); i++)
+    {
+        float* row = &res[i * SEQUENCE_FEATURES];
+        const auto& sequence = sequences[i];
+        for (const auto& c : sequence)
+        {
+            // Gaps in the input count as other symbols, like N.
+            const auto symbol = ColumnProfile::symbol(c);
+            row[symbol < ColumnProfile::GAP ? symbol : ColumnProfile::GAP]++;
+        }
+        const float size = std::max<float>(1.f, (float)sequence.size());
+        for (uint32_t k = 0; k <= ColumnProfile::GAP; k++)
+            row[k] /= size;
+        row[5] = (float)std::log(size / mean);
+    }
+    return res;
+}
+
+std::vector<float> kmer_sketch(const std::string& sequence)
+{
+    // Rolling 2-bit codes of every window of KMER_LENGTH nucleotides, hashed in one pass.
+    std::vector<uint32_t> codes;
+    codes.reserve(sequence.size());
+    uint32_t code = 0, valid = 0;
+    for (const auto& c : sequence)
+    {
+        const auto symbol = ColumnProfile::symbol(c);
+        if (symbol >= ColumnProfile::GAP)
+        {
+            valid = 0;
+            continue;
+        }
+        code = ((code << 2) | symbol) & KMER_MASK;
+        if (++valid >= KMER_LENGTH)
+            codes.push_back(code);
+    }
+    kmer_kernel().hash(codes.data(), codes.size());
+
+    std::vector<float> res(SKETCH_SIZE, 0.f);
+    for (const auto& bucket : codes)
+        res[bucket]++;
+    double norm = 0;
+    for (const auto& count : res)
+        norm += (double)count * count;
+    if (norm > 0)
+    {
+        const auto scale = (float)(1. / std::sqrt(norm));
+        for (auto& count : res)
+            count *= scale;
+    }
+    return res;
+}
+
+std::vector<float> kmer_sketches(const std::vector<std::string>& sequences, const uint32_t& threads)
+{
+    std::vector<float> res(sequences.size() * SKETCH_SIZE);
+    parallel_rows((uint32_t)sequences.size(), threads, [&](const uint32_t& i)
+    {
+        const auto sketch = kmer_sketch(sequences[i]);
+        std::copy(sketch.begin(), sketch.end(), res.begin() + (size_t)i * SKETCH_SIZE);
+    });
+    return res;
+}
+
+std::vector<float> sketch_distances(const std::vector<float>& sketches, const uint32_t& count,
+                                    const uint32_t& threads)
+{
+    // Row i fills its upper triangle and mirrors it; interleaving rows evens out the work.
+    std::vector<float> res((size_t)count * count, 0.f);
+    parallel_rows(count, threads, [&](const uint32_t& i)
+    {
+        const float* a = &sketches[(size_t)i * SKETCH_SIZE];
+        for (uint32_t j = i + 1; j < count; j++)
+        {
+            const float* b = &sketches[(size_t)j * SKETCH_SIZE];
+            float dot = 0;
+            for (uint32_t k = 0; k < SKETCH_SIZE; k++)
+                dot += a[k] * b[k];
+            res[(size_t)i * count + j] = res[(size_t)j * count + i] = std::max(0.f, 1.f - dot);
+        }
+    });
+    return res;
+}
+
+const char* kmer_kernel_name()
+{
+    return kmer_kernel().name;
+}
+
+SequenceEncoding encode_sequences(const std::vector<std::string>& sequences, const bool& kmers)
+{
+    SequenceEncoding res;
+    res.features = sequence_features(sequences);
+    if (!kmers)
+        return res;
+
+    const auto count = (uint32_t)sequences.size();
+    const auto sketches = kmer_sketches(sequences);
+    res.distances = sketch_distances(sketches, count);
+
+    res.width = encoding_width(kmers);
+    std::vector<float> features((size_t)count * res.width);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        float* row = &features[(size_t)i * res.width];
+        std::copy_n(&res.features[(size_t)i * SEQUENCE_FEATURES], SEQUENCE_FEATURES, row);
+        std::copy_n(&sketches[(size_t)i * SKETCH_SIZE], SKETCH_SIZE, row + SEQUENCE_FEATURES);
+
+        const float* distances = &res.distances[(size_t)i * count];
+        float sum = 0, nearest = count > 1 ? 1.f : 0.f;
+        for (uint32_t j = 0; j < count; j++)
+        {
+            if (j == i)
+                continue;
+            sum += distances[j];
+            nearest = std::min(nearest, distances[j]);
+        }
+        row[SEQUENCE_FEATURES + SKETCH_SIZE] = count > 1 ? sum / (float)(count - 1) : 0.f;
+        row[SEQUENCE_FEATURES + SKETCH_SIZE + 1] = nearest;
+    }
+    res.features.swap(features);
+    return res;
+}
+
+uint32_t encoding_width(const bool& kmers)
+{
+    return kmers ? SEQUENCE_FEATURES + SKETCH_SIZE + 2 : SEQUENCE_FEATURES;
+}
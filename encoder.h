@@ -0,0 +1,52 @@
+//
+// Per-sequence descriptors the Q-network embeds, independent of the number of sequences.
+//
+
+#ifndef EXP_ENCODER_H
+#define EXP_ENCODER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// A, T, C, G and other-symbol fractions, then log(length / mean length).
+constexpr uint32_t SEQUENCE_FEATURES = 6;
+
+// k-mers of KMER_LENGTH nucleotides are hashed into SKETCH_SIZE buckets.
+constexpr uint32_t KMER_LENGTH = 6;
+constexpr uint32_t SKETCH_SIZE = 128;
+
+// Row-major sequences.size() x SEQUENCE_FEATURES.
+std::vector<float> sequence_features(const std::vector<std::string>& sequences);
+
+// L2-normalized bucket counts of the k-mers of sequence; k-mers spanning anything but
+// A, T, C or G are skipped. All zeros when there is none.
+std::vector<float> kmer_sketch(const std::string& sequence);
+
+// Row-major sequences.size() x SKETCH_SIZE sketches of all sequences, on `threads` threads.
+std::vector<float> kmer_sketches(const std::vector<std::string>& sequences, const uint32_t& threads = 1);
+
+// Row-major count x count matrix of 1 - cosine similarity between the count sketches,
+// on `threads` threads.
+std::vector<float> sketch_distances(const std::vector<float>& sketches, const uint32_t& count,
+                                    const uint32_t& threads = 1);
+
+// Name of the k-mer hashing kernel picked for this CPU.
+const char* kmer_kernel_name();
+
+// What the Q-network knows about a dataset besides the state. features is row-major
+// sequences x width; distances, when not empty, the sketch_distances of the sequences.
+struct SequenceEncoding
+{
+    uint32_t                width = SEQUENCE_FEATURES;
+    std::vector<float>      features;
+    std::vector<float>      distances;
+};
+
+// sequence_features, extended with kmers by each sequence's sketch and its mean and
+// smallest distance to the others, plus the distance matrix.
+SequenceEncoding encode_sequences(const std::vector<std::string>& sequences, const bool& kmers);
+// The width encode_sequences gives, without encoding anything.
+uint32_t encoding_width(const bool& kmers);
+
+#endif //EXP_ENCODER_H
@@ -1,41 +1,78 @@
 #include "environment.h"
 #include "utils.h"
+#include "pairwise.h"
+#include "scoring.h"
+#include "telemetry.h"
 
 #include <algorithm>
 #include <array>
 
-Environment::Environment(const std::vector<std::string> &sequences) :
-        _sequences(sequences),
+Environment::Environment(const std::vector<std::string> &sequences, const Config &config) :
+        _sequences(std::make_shared<const std::vector<PackedSequence>>(pack_sequences(sequences))),
+        _encoding(std::make_shared<const SequenceEncoding>(encode_sequences(sequences, config.kmer_features))),
         _current(sequences.size(), -1),
-        _alignment(sequences.size()),
+        _scores(config.scores),
+        _banded(config.banded),
         _max_len(std::max_element(sequences.begin(), sequences.end(),
                                   [](const auto &lhs, const auto &rhs) { return lhs.size() < rhs.size(); })->size()),
         _index(0),
-        _max_reward(MATCH_REWARD * sequences.size() * (sequences.size() - 1) * _max_len / 32)
+        _max_reward(std::max(1, _scores.match) * sequences.size() * (sequences.size() - 1) * _max_len / 32)
 {
 
 }
 
 std::tuple<std::vector<state_type>, float, int32_t> Environment::step(int64_t action)
 {
+    telemetry::Scope timer(telemetry::STEP);
+    telemetry::count(telemetry::STEPS);
     float reward;
 
     if (0 == _index)
     {
         _current[_index] = action;
-        _alignment[_index] = _sequences[action];
+        _alignment.append(action, (*_sequences)[action].size());
+        telemetry::Scope profile_timer(telemetry::PROFILE);
+        _profile.append((*_sequences)[action].unpack());
         reward = 0;
     }
     else
     {
-        auto pfl = profile();
-        auto align = pairwise_alignment(pfl, _sequences[action]);
-        _alignment[_index] = move(align);
         _current[_index] = action;
-        reward = calc_reward();
+        const std::vector<state_type> prefix(_current.begin(), _current.begin() + _index + 1);
+        auto hit = _cache ? _cache->find(prefix) : nullptr;
+        if (hit)
+        {
+            telemetry::count(telemetry::CACHE_HITS);
+            _alignment = hit->alignment;
+            _profile = hit->profile;
+            reward = hit->reward;
+        }
+        else
+        {
+            std::string pfl, row;
+            {
+                telemetry::Scope profile_timer(telemetry::PROFILE);
+                pfl = profile();
+            }
+            {
+                telemetry::Scope pairwise_timer(telemetry::PAIRWISE);
+                row = pairwise_alignment(pfl, action);
+            }
+            {
+                telemetry::Scope reward_timer(telemetry::REWARD);
+                reward = calc_reward(row);
+            }
+            {
+                telemetry::Scope profile_timer(telemetry::PROFILE);
+                _profile.append(row);
+            }
+            if (_cache)
+                _cache->insert(prefix, std::make_shared<const TranspositionCache::Entry>(
+                        TranspositionCache::Entry{ _alignment, _profile, reward }));
+        }
     }
 
-    if (++_index == _sequences.size())
+    if (++_index == _sequences->size())
     {
         return { _current, reward, 0};
     }
@@ -45,172 +82,65 @@ std::tuple<std::vector<state_type>, float, int32_t> Environment::step(int64_t ac
     }
 }
 
-std::string Environment::pairwise_alignment(const std::string &profile, const std::string &target)
+std::string Environment::pairwise_alignment(const std::string &profile, const int64_t &action)
 {
-    static auto match_func = [](const char &a, const char &b)
-    {
-        if (a == '-' || b == '-') { return GAP_PENALTY; }
-        else if (a == b) { return MATCH_REWARD; }
-        return MISMATCH_PENALTY;
-    };
-    auto n = profile.size();
-    auto m = target.size();
-
-    std::vector<std::vector<int>> score(m+ 1, std::vector<int>(n + 1));
-
-    for (int i = 0; i < m + 1; i++)
-    {
-        score[i][0] = GAP_PENALTY * i;
-    }
-    for (int i = 0; i < n + 1; i++)
-    {
-        score[0][i] = GAP_PENALTY * i;
-    }
-
-    for (auto i = 1; i < m + 1; i++)
-    {
-        for (auto j = 1; j < n + 1; j++)
-        {
-            auto match = score[i - 1][j - 1] + match_func(profile[j - 1], target[i - 1]);
-            auto del = score[i - 1][j] + GAP_PENALTY;
-            auto insert = score[i][j - 1] + GAP_PENALTY;
-            score[i][j] = std::max(match, std::max(del, insert));
-        }
-    }
+    const std::string target = (*_sequences)[action].unpack();
+    auto ops = _banded ? align_banded(profile, target, _scores) : align_to_profile(profile, target, _scores);
 
     std::string res;
-
-    auto i = m, j = n;
-    while (i > 0 && j > 0)
+    res.reserve(ops.size());
+    bool profile_gap = false;
+    auto t = target.begin();
+    for (const auto& op : ops)
     {
-        auto cur = score[i][j];
-        auto diagonal = score[i - 1][j - 1];
-        auto up = score[i][j - 1];
-        auto left = score[i - 1][j];
-
-        if (cur == diagonal + match_func(profile[j - 1], target[i - 1]))
-        {
-            res.push_back(target[i - 1]);
-            i--;
-            j--;
-        }
-        else if (cur == up + GAP_PENALTY)
+        if (EditOp::TargetGap == op)
         {
             res.push_back('-');
-            j--;
         }
-        else if (cur == left + GAP_PENALTY)
+        else
         {
-            for_each(_alignment.begin(), _alignment.begin() + _index, [&](std::string& seq)
-                {
-                    seq.insert(j, 1, '-');
-                });
-            res.push_back(target[--i]);
+            res.push_back(*t++);
+            profile_gap |= EditOp::ProfileGap == op;
         }
     }
 
-    while (j > 0)
-    {
-        res.push_back('-');
-        j--;
-    }
-    while (i > 0)
-    {
-        res.push_back(target[--i]);
-        for_each(_alignment.begin(), _alignment.begin() + _index, [&](std::string& seq)
-            {
-                seq.insert(j, 1, '-');
-            });
-    }
+    // The earlier rows only learn about the new gap columns when the alignment is materialized.
+    if (profile_gap)
+        _profile.insert_gap_columns(ops);
+    _alignment.append(action, target.size(), ops);
 
-    return {res.rbegin(), res.rend()};
+    return res;
 }
 
-std::string Environment::profile()
+std::string Environment::profile() const
 {
-    static std::array<char, 4> nucleotide = {'A', 'T', 'C', 'G'};
-    int n_count[4]{0};
-    std::vector<std::array<int32_t, 4>> table(_alignment[0].size(), {0});
-
-    for (int i = 0; i < _alignment[0].size(); i++)
-    {
-        for (int j = 0; j < _index; j++)
-        {
-            if (_alignment[j][i] == 'A')
-            {
-                n_count[0]++;
-                table[i][0]++;
-            }
-            else if (_alignment[j][i] == 'T')
-            {
-                n_count[1]++;
-                table[i][1]++;
-            }
-            else if (_alignment[j][i] == 'C')
-            {
-                n_count[2]++;
-                table[i][2]++;
-            }
-            else if (_alignment[j][i] == 'G')
-            {
-                n_count[3]++;
-                table[i][3]++;
-            }
-        }
-    }
-
-    std::string res;
-    for (int i = 0; i < _alignment[0].size(); i++)
-    {
-        for (int j = 0; j < 4; j++)
-        {
-            table[i][j] = table[i][j] * table[i][j] * n_count[j];
-        }
-        res.push_back(nucleotide[argmax(table[i].begin(), table[i].end())]);
-    }
-
-    return res;
+    return _profile.consensus();
 }
 
 int Environment::calc_sum_of_pairs()
 {
-    int score = 0;
-    for (int i = 0; i < _alignment[0].size(); i++)
-    {
-        for (int j = 0; j < _alignment.size() - 1; j++)
-        {
-            for (int k = j + 1; k < _alignment.size(); k++)
-            {
-                if (_alignment[j][i] == '-' || _alignment[k][i] == '-')
-                {
-                    score += GAP_PENALTY;
-                }
-                else if (_alignment[j][i] == _alignment[k][i])
-                {
-                    score += MATCH_REWARD;
-                }
-                else
-                {
-                    score += MISMATCH_PENALTY;
-                }
-            }
-        }
-    }
+    return sum_of_pairs(_profile, _scores);
+}
 
-    return score;
+void Environment::set_cache(std::shared_ptr<TranspositionCache> cache)
+{
+    _cache = std::move(cache);
 }
 
 std::vector<state_type> Environment::reset()
 {
-    _current.swap(std::vector<state_type>(_sequences.size(), -1));
-    _alignment.swap(std::vector<std::string>(_sequences.size()));
+    _current.assign(_sequences->size(), -1);
+    _alignment.clear();
+    _profile.clear();
     _index = 0;
     return _current;
 }
 
 std::vector<std::string> Environment::alignment()
 {
-    return _alignment;
+    auto res = _alignment.materialize(*_sequences);
+    res.resize(_sequences->size());
+    return res;
 }
 
 uint32_t Environment::max_reward()
@@ -218,27 +148,51 @@ uint32_t Environment::max_reward()
     return _max_reward;
 }
 
-float Environment::calc_reward()
+const SequenceEncoding& Environment::encoding() const
+{
+    return *_encoding;
+}
+
+float Environment::calc_reward(const std::string& row)
 {
+    // The new row is scored against the counts of the _index rows before it, so each
+    // column costs O(1).
     int reward = 0;
-    for (int i = 0; i < _alignment[0].size(); i++)
+    for (size_t i = 0; i < row.size(); i++)
     {
-        for (int j = 0; j < _index; j++)
+        const auto& column = _profile[i];
+        const auto symbol = ColumnProfile::symbol(row[i]);
+        if (ColumnProfile::GAP == symbol)
         {
-            if (_alignment[_index][i] == '-' || _alignment[j][i] == '-')
-            {
-                reward += GAP_PENALTY;
-            }
-            else if (_alignment[_index][i] == _alignment[j][i])
-            {
-                reward += MATCH_REWARD;
-            }
-            else
-            {
-                reward += MISMATCH_PENALTY;
-            }
+            reward += _scores.gap * (int)_index;
+            continue;
+        }
+
+        reward += _scores.gap * column[ColumnProfile::GAP];
+        if (_scores.matrix)
+        {
+            const auto& matrix = *_scores.matrix;
+            for (uint32_t s = 0; s < ColumnProfile::GAP; s++)
+                reward += column[s] * matrix(row[i], "ATCG"[s]);
+            for (const char& other : _profile.others(i))
+                reward += matrix(row[i], other);
+            continue;
         }
+        const int matches = _profile.count(i, row[i]);
+        const int residues = (int)_index - column[ColumnProfile::GAP];
+        reward += _scores.match * matches
+                + _scores.mismatch * (residues - matches);
+    }
+
+    if (_scores.affine())
+    {
+        // Each run of the new row opens against every earlier row, and each run of those
+        // against the new row; the profile already holds the gap columns this row opened.
+        int runs = 0;
+        for (size_t i = 0; i < row.size(); i++)
+            runs += '-' == row[i] && (0 == i || '-' != row[i - 1]);
+        reward += _scores.gap_open * ((int)_index * runs + (int)_profile.gap_runs());
     }
 
     return (float)reward / (float)_max_reward;
-}
\ No newline at end of file
+}
@@ -8,17 +8,21 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <memory>
 #include "utils.h"
-
-#define MATCH_REWARD        2
-#define MISMATCH_PENALTY    -1
-#define GAP_PENALTY         -2
+#include "profile.h"
+#include "alignment.h"
+#include "cache.h"
+#include "packed.h"
+#include "encoder.h"
+#include "config.h"
 
 class Environment
 {
 public:
     Environment() = delete;
-    explicit Environment(const std::vector<std::string> &sequences);
+    // Uses config.scores, config.banded and config.kmer_features.
+    explicit Environment(const std::vector<std::string> &sequences, const Config &config = Config());
     ~Environment() = default;
 
     std::tuple<std::vector<state_type>, float, int32_t> step(int64_t action);
@@ -31,14 +35,28 @@ public:
 
     uint32_t max_reward();
 
+    // encode_sequences of the input with Config::kmer_features, computed once and
+    // shared by copies.
+    [[nodiscard]] const SequenceEncoding& encoding() const;
+
+    // Replays steps whose chosen prefix is in cache instead of aligning again. The cache is
+    // shared with copies of this environment and must only ever see the same sequences.
+    void set_cache(std::shared_ptr<TranspositionCache> cache);
+
 private:
-    std::string profile();
-    std::string pairwise_alignment(const std::string &profile, const std::string &target);
-    float calc_reward();
+    std::string profile() const;
+    std::string pairwise_alignment(const std::string &profile, const int64_t &action);
+    float calc_reward(const std::string &row);
 
-    std::vector<std::string>    _sequences;
+    // Shared between copies, so cloning a partial episode only copies its alignment state.
+    std::shared_ptr<const std::vector<PackedSequence>> _sequences;
+    std::shared_ptr<const SequenceEncoding> _encoding;
     std::vector<state_type>     _current;
-    std::vector<std::string>    _alignment;
+    Alignment                   _alignment;
+    ColumnProfile               _profile;
+    std::shared_ptr<TranspositionCache> _cache;
+    Scores                      _scores;
+    bool                        _banded;
     uint32_t                    _max_len, _index, _max_reward;
 };
 
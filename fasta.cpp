@@ -0,0 +1,256 @@
+#include "fasta.h"
+
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define EXP_FASTA_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    inline bool is_space(const char& c)
+    {
+        return 0 != std::isspace((unsigned char)c);
+    }
+
+    // End of the line starting at offset, the '\n' or size.
+    inline size_t line_end(const char* data, const size_t& size, const size_t& offset)
+    {
+        const auto* nl = (const char*)memchr(data + offset, '\n', size - offset);
+        return nl ? (size_t)(nl - data) : size;
+    }
+
+    // First word of a header line starting at '>'.
+    inline std::string_view header_name(const char* data, const size_t& begin, const size_t& end)
+    {
+        size_t stop = begin + 1;
+        while (stop < end && !is_space(data[stop]))
+            stop++;
+        return { data + begin + 1, stop - begin - 1 };
+    }
+}
+
+FastaFile::FastaFile(const std::string& path, const bool& use_index) :
+        _path(path),
+        _data(nullptr),
+        _size(0),
+        _mapped(false),
+        _indexed(false)
+{
+#ifdef EXP_FASTA_MMAP
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Can not open the sequence file " + path);
+    struct stat st{};
+    fstat(fd, &st);
+    _size = (size_t)st.st_size;
+    if (_size > 0)
+    {
+        void* map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == map)
+        {
+            close(fd);
+            throw std::runtime_error("Can not map the sequence file " + path);
+        }
+        madvise(map, _size, MADV_SEQUENTIAL);
+        _data = (const char*)map;
+        _mapped = true;
+    }
+    close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Can not open the sequence file " + path);
+    _buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    _data = _buffer.data();
+    _size = _buffer.size();
+#endif
+
+    if (use_index)
+    {
+        std::error_code error;
+        const std::string fai = path + ".fai";
+        if (std::filesystem::exists(fai, error)
+            && std::filesystem::last_write_time(fai, error) >= std::filesystem::last_write_time(path, error))
+            _indexed = read_index(fai);
+    }
+}
+
+FastaFile::~FastaFile()
+{
+#ifdef EXP_FASTA_MMAP
+    if (_mapped)
+        munmap((void*)_data, _size);
+#endif
+}
+
+size_t FastaFile::size() const
+{
+    build_index();
+    return _records.size();
+}
+
+const FastaRecord& FastaFile::operator[](const size_t& record) const
+{
+    build_index();
+    return _records[record];
+}
+
+std::string FastaFile::sequence(const size_t& record) const
+{
+    return normalize((*this)[record].data);
+}
+
+void FastaFile::for_each(const std::function<void(const FastaRecord&)>& visit) const
+{
+    if (_indexed)
+    {
+        for (const auto& record : _records)
+            visit(record);
+        return;
+    }
+
+    // Anything before the first header is not part of a record.
+    size_t offset = 0;
+    while (offset < _size && '>' != _data[offset])
+        offset = line_end(_data, _size, offset) + 1;
+
+    FastaRecord record{};
+    while (offset < _size)
+    {
+        offset = parse(offset, record);
+        visit(record);
+    }
+}
+
+void FastaFile::write_index() const
+{
+    write_index(_path + ".fai");
+}
+
+void FastaFile::write_index(const std::string& path) const
+{
+    build_index();
+    for (const auto& record : _records)
+    {
+        if (!record.regular)
+            throw std::runtime_error("Can not index " + _path + ": " + std::string(record.name) + " has uneven lines");
+    }
+
+    std::ofstream file(path);
+    if (!file.is_open())
+        throw std::runtime_error("Can not write the sequence index " + path);
+    for (const auto& record : _records)
+    {
+        file << record.name << '\t' << record.length << '\t' << (record.data.data() - _data) << '\t'
+             << record.line_bases << '\t' << record.line_width << '\n';
+    }
+}
+
+std::string FastaFile::normalize(const std::string_view& data)
+{
+    std::string res;
+    res.reserve(data.size());
+    for (const auto& c : data)
+    {
+        if (!is_space(c))
+            res.push_back((char)std::toupper((unsigned char)c));
+    }
+    return res;
+}
+
+void FastaFile::build_index() const
+{
+    if (_indexed)
+        return;
+    _records.clear();
+    for_each([this](const FastaRecord& record) { _records.push_back(record); });
+    _indexed = true;
+}
+
+bool FastaFile::read_index(const std::string& path) const
+{
+    std::ifstream file(path);
+    std::string line, name;
+    std::vector<FastaRecord> records;
+    while (std::getline(file, line))
+    {
+        if (line.empty())
+            continue;
+        std::istringstream fields(line);
+        uint64_t length, offset;
+        uint32_t line_bases, line_width;
+        if (!(std::getline(fields, name, '\t') >> length >> offset >> line_bases >> line_width))
+            return false;
+        if (offset > _size || 0 == offset || '\n' != _data[offset - 1] || line_width < line_bases)
+            return false;
+
+        // The header is the line ending right before the data; it must carry the same name.
+        size_t header = offset - 1;
+        while (header > 0 && '\n' != _data[header - 1])
+            header--;
+        const auto view = header_name(_data, header, offset - 1);
+        if ('>' != _data[header] || view != name)
+            return false;
+
+        const uint64_t full = line_bases ? length / line_bases : 0;
+        const uint64_t end = std::min<uint64_t>(_size, offset + full * line_width + (length - full * line_bases));
+        records.push_back({ view, { _data + offset, (size_t)(end - offset) }, length, line_bases, line_width, true });
+    }
+
+    _records.swap(records);
+    return true;
+}
+
+size_t FastaFile::parse(const size_t& offset, FastaRecord& record) const
+{
+    const size_t header_end = line_end(_data, _size, offset);
+    record.name = header_name(_data, offset, header_end);
+
+    const size_t begin = std::min(header_end + 1, _size);
+    size_t pos = begin;
+    record.length = 0;
+    record.line_bases = 0;
+    record.line_width = 0;
+    record.regular = true;
+    bool short_line = false;    // once a line is short, only blank lines may follow
+    while (pos < _size && '>' != _data[pos])
+    {
+        const size_t start = pos, end = line_end(_data, _size, start);
+        const auto width = (uint32_t)(std::min(end + 1, _size) - start);
+        uint32_t bases = 0;
+        for (size_t i = start; i < end; i++)
+            bases += !is_space(_data[i]);
+        pos = end + 1;
+        if (0 == bases)
+        {
+            short_line = true;
+            continue;
+        }
+
+        // Inner whitespace would also shift the offsets an index computes.
+        const bool cr = '\r' == _data[end - 1];
+        record.regular &= !short_line && bases == end - start - cr;
+        if (0 == record.line_width)
+        {
+            record.line_bases = bases;
+            record.line_width = width;
+        }
+        record.regular &= bases <= record.line_bases;
+        short_line |= bases < record.line_bases || width != record.line_width;
+        record.length += bases;
+    }
+    pos = std::min(pos, _size);
+
+    record.data = { _data + begin, pos - begin };
+    return pos;
+}
@@ -0,0 +1,69 @@
+//
+// Memory-mapped FASTA / multi-FASTA reader with an optional .fai index.
+//
+
+#ifndef EXP_FASTA_H
+#define EXP_FASTA_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// A record as it sits in the mapped file. data still holds the line breaks, so use
+// FastaFile::normalize to get the bare sequence.
+struct FastaRecord
+{
+    std::string_view    name;       // first word of the header, without '>'
+    std::string_view    data;
+    uint64_t            length;     // residues, not counting whitespace
+    uint32_t            line_bases, line_width;
+    // Every line but the last holds line_bases residues in line_width bytes, as .fai needs.
+    bool                regular;
+};
+
+class FastaFile
+{
+public:
+    // Maps path read-only. With use_index, path + ".fai" is read if present and not older
+    // than the file; otherwise the records are found by one scan over the mapping.
+    explicit FastaFile(const std::string& path, const bool& use_index = true);
+    FastaFile(const FastaFile&) = delete;
+    FastaFile& operator=(const FastaFile&) = delete;
+    ~FastaFile();
+
+    // Both build the record index on first use.
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] const FastaRecord& operator[](const size_t& record) const;
+
+    [[nodiscard]] std::string sequence(const size_t& record) const;
+
+    // Visits the records in file order without building the index.
+    void for_each(const std::function<void(const FastaRecord&)>& visit) const;
+
+    // Writes a samtools-compatible index, by default next to the file. Throws if a record
+    // has uneven lines, which such an index can not describe.
+    void write_index() const;
+    void write_index(const std::string& path) const;
+
+    // Upper-cases and drops whitespace.
+    static std::string normalize(const std::string_view& data);
+
+private:
+    void build_index() const;
+    bool read_index(const std::string& path) const;
+    // Parses the record starting at offset, a '>', and returns the offset after it.
+    size_t parse(const size_t& offset, FastaRecord& record) const;
+
+    std::string                         _path;
+    const char*                         _data;
+    size_t                              _size;
+    bool                                _mapped;
+    std::vector<char>                   _buffer;    // used where mmap is unavailable
+
+    mutable std::vector<FastaRecord>    _records;
+    mutable bool                        _indexed;
+};
+
+#endif //EXP_FASTA_H
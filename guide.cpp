@@ -0,0 +1,109 @@
+#include "guide.h"
+#include "encoder.h"
+
+#include <limits>
+
+namespace
+{
+    struct Node
+    {
+        int32_t     left, right;    // children, -1 for leaves
+        float       tightest;       // lowest merge height in the subtree
+    };
+}
+
+std::vector<state_type> guide_order(const std::vector<float>& distances, const uint32_t& count)
+{
+    constexpr float INF = std::numeric_limits<float>::infinity();
+    if (count < 2)
+        return std::vector<state_type>(count, 0);
+
+    // Nodes 0..count-1 are the leaves; every merge appends one. Active clusters live in
+    // the distance matrix under the index of one of their leaves, with their node in root.
+    std::vector<Node> nodes(count, { -1, -1, INF });
+    std::vector<float> dist(distances.begin(), distances.begin() + (size_t)count * count);
+    std::vector<int32_t> root(count), size(count, 1), nearest(count);
+    std::vector<uint8_t> active(count, 1);
+    for (uint32_t i = 0; i < count; i++)
+        root[i] = (int32_t)i;
+
+    // nearest[i] is the closest active cluster to i, kept current after every merge so a
+    // merge costs O(count) instead of a full scan of the matrix.
+    auto find_nearest = [&](const uint32_t& i)
+    {
+        nearest[i] = -1;
+        for (uint32_t j = 0; j < count; j++)
+        {
+            if (j != i && active[j] && (nearest[i] < 0 || dist[(size_t)i * count + j] < dist[(size_t)i * count + nearest[i]]))
+                nearest[i] = (int32_t)j;
+        }
+    };
+    for (uint32_t i = 0; i < count; i++)
+        find_nearest(i);
+
+    for (uint32_t merges = 1; merges < count; merges++)
+    {
+        uint32_t a = count;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (active[i] && (count == a || dist[(size_t)i * count + nearest[i]] < dist[(size_t)a * count + nearest[a]]))
+                a = i;
+        }
+        const auto b = (uint32_t)nearest[a];
+        const float height = dist[(size_t)a * count + b] / 2;
+
+        const Node& left = nodes[root[a]];
+        const Node& right = nodes[root[b]];
+        nodes.push_back({ root[a], root[b], std::min({ height, left.tightest, right.tightest }) });
+        root[a] = (int32_t)nodes.size() - 1;
+
+        // UPGMA: the merged cluster is at the size-weighted mean distance of its halves.
+        active[b] = 0;
+        for (uint32_t k = 0; k < count; k++)
+        {
+            if (!active[k] || k == a)
+                continue;
+            const float d = (size[a] * dist[(size_t)a * count + k] + size[b] * dist[(size_t)b * count + k])
+                            / (float)(size[a] + size[b]);
+            dist[(size_t)a * count + k] = dist[(size_t)k * count + a] = d;
+        }
+        size[a] += size[b];
+
+        for (uint32_t k = 0; k < count; k++)
+        {
+            if (!active[k])
+                continue;
+            if (k == a || nearest[k] == (int32_t)a || nearest[k] == (int32_t)b)
+                find_nearest(k);
+            else if (dist[(size_t)k * count + a] < dist[(size_t)k * count + nearest[k]])
+                nearest[k] = (int32_t)a;
+        }
+    }
+
+    // Depth-first over the tree, tighter child first, without recursion: a chain-shaped
+    // tree is count deep.
+    std::vector<state_type> order;
+    order.reserve(count);
+    std::vector<int32_t> stack{ (int32_t)nodes.size() - 1 };
+    while (!stack.empty())
+    {
+        const Node& node = nodes[stack.back()];
+        const int32_t id = stack.back();
+        stack.pop_back();
+        if (node.left < 0)
+        {
+            order.push_back((state_type)id);
+            continue;
+        }
+        const bool left_first = nodes[node.left].tightest <= nodes[node.right].tightest;
+        stack.push_back(left_first ? node.right : node.left);
+        stack.push_back(left_first ? node.left : node.right);
+    }
+    return order;
+}
+
+std::vector<state_type> guide_order(const std::vector<std::string>& sequences, const uint32_t& threads)
+{
+    const auto count = (uint32_t)sequences.size();
+    return guide_order(sketch_distances(kmer_sketches(sequences, threads), count, threads), count);
+}
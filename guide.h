@@ -0,0 +1,20 @@
+//
+// Distance-based progressive order used to warm-start training.
+//
+
+#ifndef EXP_GUIDE_H
+#define EXP_GUIDE_H
+
+#include <string>
+#include <vector>
+#include "utils.h"
+
+// Builds the UPGMA tree of the row-major count x count distances and returns the order in
+// which a single growing profile would take the sequences: starting from the closest pair,
+// each subtree is completed before its sibling, the one holding the tighter merge first.
+std::vector<state_type> guide_order(const std::vector<float>& distances, const uint32_t& count);
+
+// guide_order of the k-mer sketch distances of sequences, computed on `threads` threads.
+std::vector<state_type> guide_order(const std::vector<std::string>& sequences, const uint32_t& threads);
+
+#endif //EXP_GUIDE_H
@@ -0,0 +1,496 @@
+#include "inference.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(EXP_INFERENCE_NO_SIMD)
+#define EXP_INFERENCE_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // The widest layer input: the pooled half of the last hidden layer.
+    constexpr uint32_t MAX_WIDTH = 2 * NET_HIDDEN;
+
+    constexpr char WEIGHTS_MAGIC[8] = { 'E', 'X', 'P', 'N', 'E', 'T', 'W', '1' };
+
+    // out = init + weight^T in over the `width` inputs, through a relu if asked. weight is
+    // {width, NET_HIDDEN}; the int8 form scales each output's sum by scale[o] first.
+    using Layer = void (*)(const float* in, uint32_t width, const float* weight, const float* init,
+                           bool relu, float* out);
+    using LayerQ8 = void (*)(const float* in, uint32_t width, const int8_t* weight, const float* scale,
+                             const float* init, bool relu, float* out);
+    // Sum of a[i] * b[i] over NET_HIDDEN floats.
+    using Dot = float (*)(const float* a, const float* b);
+
+    struct LayerKernel
+    {
+        const char* name;
+        Layer       layer;
+        LayerQ8     layer_q8;
+        Dot         dot;
+    };
+
+    // Half the inputs of a hidden layer are zero after the relu; listing the others first,
+    // without a branch per input, skips their whole weight rows. The AVX2 kernels find
+    // them with a compare mask per 8 inputs instead.
+    inline uint32_t nonzero_inputs(const float* in, const uint32_t& width, uint32_t* index)
+    {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < width; i++)
+        {
+            index[count] = i;
+            count += 0.f != in[i];
+        }
+        return count;
+    }
+
+    void layer_scalar(const float* in, uint32_t width, const float* weight, const float* init,
+                      bool relu, float* out)
+    {
+        uint32_t index[MAX_WIDTH];
+        const uint32_t count = nonzero_inputs(in, width, index);
+        float acc[NET_HIDDEN];
+        std::copy_n(init, NET_HIDDEN, acc);
+        for (uint32_t n = 0; n < count; n++)
+        {
+            const float x = in[index[n]];
+            const float* w = weight + (size_t)index[n] * NET_HIDDEN;
+            for (uint32_t o = 0; o < NET_HIDDEN; o++)
+                acc[o] += w[o] * x;
+        }
+        for (uint32_t o = 0; o < NET_HIDDEN; o++)
+            out[o] = relu ? std::max(acc[o], 0.f) : acc[o];
+    }
+
+    void layer_q8_scalar(const float* in, uint32_t width, const int8_t* weight, const float* scale,
+                         const float* init, bool relu, float* out)
+    {
+        uint32_t index[MAX_WIDTH];
+        const uint32_t count = nonzero_inputs(in, width, index);
+        float acc[NET_HIDDEN] = {};
+        for (uint32_t n = 0; n < count; n++)
+        {
+            const float x = in[index[n]];
+            const int8_t* w = weight + (size_t)index[n] * NET_HIDDEN;
+            for (uint32_t o = 0; o < NET_HIDDEN; o++)
+                acc[o] += (float)w[o] * x;
+        }
+        for (uint32_t o = 0; o < NET_HIDDEN; o++)
+        {
+            const float v = init[o] + scale[o] * acc[o];
+            out[o] = relu ? std::max(v, 0.f) : v;
+        }
+    }
+
+    float dot_scalar(const float* a, const float* b)
+    {
+        float sum = 0.f;
+        for (uint32_t i = 0; i < NET_HIDDEN; i++)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+#ifdef EXP_INFERENCE_X86
+    // NET_HIDDEN outputs are 8 ymm accumulators that stay in registers over all inputs;
+    // the lane loops are unrolled, or the accumulators go through memory.
+    constexpr uint32_t LANES = NET_HIDDEN / 8;
+
+    // Bit i of masks[i / 64] is set when in[i] is not zero.
+    __attribute__((target("avx2")))
+    void nonzero_mask_avx2(const float* in, const uint32_t& width, uint64_t* masks)
+    {
+        std::fill_n(masks, (width + 63) / 64, 0);
+        uint32_t i = 0;
+        for (; i + 8 <= width; i += 8)
+        {
+            const __m256 nonzero = _mm256_cmp_ps(_mm256_loadu_ps(in + i), _mm256_setzero_ps(), _CMP_NEQ_UQ);
+            masks[i / 64] |= (uint64_t)_mm256_movemask_ps(nonzero) << (i % 64);
+        }
+        for (; i < width; i++)
+            masks[i / 64] |= (uint64_t)(0.f != in[i]) << (i % 64);
+    }
+
+    __attribute__((target("avx2,fma")))
+    void layer_avx2(const float* in, uint32_t width, const float* weight, const float* init,
+                    bool relu, float* out)
+    {
+        uint64_t masks[MAX_WIDTH / 64];
+        nonzero_mask_avx2(in, width, masks);
+        __m256 acc[LANES];
+        for (uint32_t k = 0; k < LANES; k++)
+            acc[k] = _mm256_loadu_ps(init + 8 * k);
+        for (uint32_t block = 0; block * 64 < width; block++)
+        {
+            for (uint64_t m = masks[block]; m; m &= m - 1)
+            {
+                const uint32_t i = block * 64 + __builtin_ctzll(m);
+                const __m256 x = _mm256_broadcast_ss(in + i);
+                const float* w = weight + (size_t)i * NET_HIDDEN;
+#pragma GCC unroll 8
+                for (uint32_t k = 0; k < LANES; k++)
+                    acc[k] = _mm256_fmadd_ps(_mm256_load_ps(w + 8 * k), x, acc[k]);
+            }
+        }
+        for (uint32_t k = 0; k < LANES; k++)
+            _mm256_storeu_ps(out + 8 * k, relu ? _mm256_max_ps(acc[k], _mm256_setzero_ps()) : acc[k]);
+    }
+
+    __attribute__((target("avx2,fma")))
+    void layer_q8_avx2(const float* in, uint32_t width, const int8_t* weight, const float* scale,
+                       const float* init, bool relu, float* out)
+    {
+        uint64_t masks[MAX_WIDTH / 64];
+        nonzero_mask_avx2(in, width, masks);
+        __m256 acc[LANES];
+        for (uint32_t k = 0; k < LANES; k++)
+            acc[k] = _mm256_setzero_ps();
+        for (uint32_t block = 0; block * 64 < width; block++)
+        {
+            for (uint64_t m = masks[block]; m; m &= m - 1)
+            {
+                const uint32_t i = block * 64 + __builtin_ctzll(m);
+                const __m256 x = _mm256_broadcast_ss(in + i);
+                const int8_t* w = weight + (size_t)i * NET_HIDDEN;
+#pragma GCC unroll 8
+                for (uint32_t k = 0; k < LANES; k++)
+                {
+                    const __m256i w32 = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(w + 8 * k)));
+                    acc[k] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(w32), x, acc[k]);
+                }
+            }
+        }
+        for (uint32_t k = 0; k < LANES; k++)
+        {
+            const __m256 v = _mm256_fmadd_ps(acc[k], _mm256_loadu_ps(scale + 8 * k), _mm256_loadu_ps(init + 8 * k));
+            _mm256_storeu_ps(out + 8 * k, relu ? _mm256_max_ps(v, _mm256_setzero_ps()) : v);
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    float dot_avx2(const float* a, const float* b)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        for (uint32_t k = 0; k < LANES; k++)
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(a + 8 * k), _mm256_loadu_ps(b + 8 * k), sum);
+        const __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        const __m128 pair = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        return _mm_cvtss_f32(_mm_add_ss(pair, _mm_shuffle_ps(pair, pair, 1)));
+    }
+#endif
+
+    const LayerKernel& layer_kernel()
+    {
+        static const LayerKernel kernel = []() -> LayerKernel
+        {
+#ifdef EXP_INFERENCE_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                return { "avx2", layer_avx2, layer_q8_avx2, dot_avx2 };
+#endif
+            return { "scalar", layer_scalar, layer_q8_scalar, dot_scalar };
+        }();
+        return kernel;
+    }
+
+    // {rows, cols} row-major into {cols, rows}, starting at column `first` of count columns.
+    void transpose(const std::vector<float>& matrix, const uint32_t& rows, const uint32_t& cols,
+                   const uint32_t& first, const uint32_t& count, float* into)
+    {
+        for (uint32_t r = 0; r < rows; r++)
+        {
+            for (uint32_t c = 0; c < count; c++)
+                into[(size_t)c * rows + r] = matrix[(size_t)r * cols + first + c];
+        }
+    }
+
+    // Symmetric int8 per output: weight[o][i] ~ q[i][o] * scale[o].
+    void quantize(const std::vector<float>& matrix, const uint32_t& cols, int8_t* q, float* scale)
+    {
+        for (uint32_t o = 0; o < NET_HIDDEN; o++)
+        {
+            const float* row = matrix.data() + (size_t)o * cols;
+            float largest = 0.f;
+            for (uint32_t i = 0; i < cols; i++)
+                largest = std::max(largest, std::abs(row[i]));
+            scale[o] = largest > 0.f ? largest / 127.f : 1.f;
+            for (uint32_t i = 0; i < cols; i++)
+                q[(size_t)i * NET_HIDDEN + o] = (int8_t)std::lround(row[i] / scale[o]);
+        }
+    }
+
+    void write_floats(std::ostream& out, const std::vector<float>& values)
+    {
+        const auto count = (uint32_t)values.size();
+        out.write((const char*)&count, sizeof(count));
+        out.write((const char*)values.data(), (std::streamsize)(values.size() * sizeof(float)));
+    }
+
+    std::vector<float> read_floats(std::istream& in, const size_t& expected)
+    {
+        uint32_t count = 0;
+        in.read((char*)&count, sizeof(count));
+        if (!in || count != expected)
+            throw std::runtime_error("Malformed network weights");
+        std::vector<float> values(count);
+        in.read((char*)values.data(), (std::streamsize)(count * sizeof(float)));
+        if (!in)
+            throw std::runtime_error("Truncated network weights");
+        return values;
+    }
+}
+
+void NetWeights::save(const std::string& path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Can not write the network weights " + path);
+    file.write(WEIGHTS_MAGIC, sizeof(WEIGHTS_MAGIC));
+    file.write((const char*)&feature_width, sizeof(feature_width));
+    for (const auto* values : { &input_weight, &input_bias, &l1_weight, &l1_bias, &l2_weight, &l2_bias,
+                                &output_weight })
+        write_floats(file, *values);
+    file.write((const char*)&output_bias, sizeof(output_bias));
+    if (!file)
+        throw std::runtime_error("Can not write the network weights " + path);
+}
+
+NetWeights NetWeights::load(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("Can not open the network weights " + path);
+    char magic[sizeof(WEIGHTS_MAGIC)] = {};
+    file.read(magic, sizeof(magic));
+    if (!file || 0 != memcmp(magic, WEIGHTS_MAGIC, sizeof(magic)))
+        throw std::runtime_error(path + " is not a network weights file");
+
+    NetWeights res;
+    file.read((char*)&res.feature_width, sizeof(res.feature_width));
+    const size_t input = res.feature_width + NET_STATE_COLUMNS;
+    res.input_weight = read_floats(file, NET_HIDDEN * input);
+    res.input_bias = read_floats(file, NET_HIDDEN);
+    res.l1_weight = read_floats(file, NET_HIDDEN * NET_HIDDEN);
+    res.l1_bias = read_floats(file, NET_HIDDEN);
+    res.l2_weight = read_floats(file, NET_HIDDEN * 3 * NET_HIDDEN);
+    res.l2_bias = read_floats(file, NET_HIDDEN);
+    res.output_weight = read_floats(file, NET_HIDDEN);
+    file.read((char*)&res.output_bias, sizeof(res.output_bias));
+    if (!file)
+        throw std::runtime_error("Truncated network weights " + path);
+    return res;
+}
+
+void InferenceNet::Aligned::operator()(void* p) const
+{
+    std::free(p);
+}
+
+template<typename T>
+InferenceNet::Buffer<T> InferenceNet::allocate(const size_t& count)
+{
+    // aligned_alloc wants a multiple of the alignment.
+    const size_t bytes = (std::max<size_t>(1, count) * sizeof(T) + 31) / 32 * 32;
+    void* p = std::aligned_alloc(32, bytes);
+    if (nullptr == p)
+        throw std::bad_alloc();
+    memset(p, 0, bytes);
+    return Buffer<T>((T*)p);
+}
+
+InferenceNet::InferenceNet(const uint32_t& seq_num, const SequenceEncoding& encoding, const bool& quantized) :
+        _seq_num(seq_num),
+        _feature_width(encoding.width),
+        _quantized(quantized),
+        _features(encoding.features.empty() ? std::vector<float>((size_t)seq_num * encoding.width, 0.f)
+                                            : encoding.features),
+        _distances(encoding.distances),
+        _state_weight(allocate<float>(NET_STATE_COLUMNS * NET_HIDDEN)),
+        _l1_weight(allocate<float>(quantized ? 0 : NET_HIDDEN * NET_HIDDEN)),
+        _l2_weight(allocate<float>(quantized ? 0 : 3 * NET_HIDDEN * NET_HIDDEN)),
+        _l1_q8(allocate<int8_t>(quantized ? NET_HIDDEN * NET_HIDDEN : 0)),
+        _l2_q8(allocate<int8_t>(quantized ? 3 * NET_HIDDEN * NET_HIDDEN : 0)),
+        _l1_scale(allocate<float>(NET_HIDDEN)),
+        _l2_scale(allocate<float>(NET_HIDDEN)),
+        _l1_bias(allocate<float>(NET_HIDDEN)),
+        _l2_bias(allocate<float>(NET_HIDDEN)),
+        _output_weight(allocate<float>(NET_HIDDEN)),
+        _output_bias(0.f),
+        _base(allocate<float>((size_t)seq_num * NET_HIDDEN)),
+        _h0(allocate<float>(NET_HIDDEN)),
+        _h1(allocate<float>((size_t)seq_num * NET_HIDDEN)),
+        _h2(allocate<float>(NET_HIDDEN)),
+        _columns(allocate<float>((size_t)seq_num * NET_STATE_COLUMNS)),
+        _pooled(allocate<float>(2 * NET_HIDDEN)),
+        _shared(allocate<float>(NET_HIDDEN)),
+        _out(allocate<float>(seq_num))
+{
+
+}
+
+void InferenceNet::load(const NetWeights& weights)
+{
+    const uint32_t input = _feature_width + NET_STATE_COLUMNS;
+    if (weights.feature_width != _feature_width || weights.input_weight.size() != (size_t)NET_HIDDEN * input
+        || weights.l1_weight.size() != (size_t)NET_HIDDEN * NET_HIDDEN
+        || weights.l2_weight.size() != (size_t)3 * NET_HIDDEN * NET_HIDDEN
+        || weights.output_weight.size() != NET_HIDDEN || weights.input_bias.size() != NET_HIDDEN
+        || weights.l1_bias.size() != NET_HIDDEN || weights.l2_bias.size() != NET_HIDDEN)
+        throw std::invalid_argument("The network weights do not fit the sequence encoding");
+
+    const LayerKernel& kernel = layer_kernel();
+    // The input layer over each sequence's features, in blocks of MAX_WIDTH features.
+    auto feature_weight = allocate<float>((size_t)_feature_width * NET_HIDDEN);
+    transpose(weights.input_weight, NET_HIDDEN, input, 0, _feature_width, feature_weight.get());
+    for (uint32_t s = 0; s < _seq_num; s++)
+    {
+        float* base = _base.get() + (size_t)s * NET_HIDDEN;
+        std::copy(weights.input_bias.begin(), weights.input_bias.end(), base);
+        for (uint32_t f = 0; f < _feature_width; f += MAX_WIDTH)
+        {
+            kernel.layer(_features.data() + (size_t)s * _feature_width + f, std::min(MAX_WIDTH, _feature_width - f),
+                         feature_weight.get() + (size_t)f * NET_HIDDEN, base, false, base);
+        }
+    }
+    transpose(weights.input_weight, NET_HIDDEN, input, _feature_width, NET_STATE_COLUMNS, _state_weight.get());
+
+    if (_quantized)
+    {
+        quantize(weights.l1_weight, NET_HIDDEN, _l1_q8.get(), _l1_scale.get());
+        quantize(weights.l2_weight, 3 * NET_HIDDEN, _l2_q8.get(), _l2_scale.get());
+    }
+    else
+    {
+        transpose(weights.l1_weight, NET_HIDDEN, NET_HIDDEN, 0, NET_HIDDEN, _l1_weight.get());
+        transpose(weights.l2_weight, NET_HIDDEN, 3 * NET_HIDDEN, 0, 3 * NET_HIDDEN, _l2_weight.get());
+    }
+    std::copy(weights.l1_bias.begin(), weights.l1_bias.end(), _l1_bias.get());
+    std::copy(weights.l2_bias.begin(), weights.l2_bias.end(), _l2_bias.get());
+    std::copy(weights.output_weight.begin(), weights.output_weight.end(), _output_weight.get());
+    _output_bias = weights.output_bias;
+}
+
+void InferenceNet::forward(const std::vector<state_type>& state)
+{
+    const LayerKernel& kernel = layer_kernel();
+    const uint32_t n = _seq_num;
+
+    // The state columns of Net::forward.
+    float* columns = _columns.get();
+    std::fill_n(columns, (size_t)n * NET_STATE_COLUMNS, 0.f);
+    uint32_t depth = 0;
+    for (uint32_t k = 0; k < n; k++)
+        depth += state[k] >= 0;
+    for (uint32_t k = 0; k < n; k++)
+    {
+        if (state[k] < 0)
+            continue;
+        float* c = columns + (size_t)state[k] * NET_STATE_COLUMNS;
+        c[0] += 1.f;
+        c[1] += (float)(k + 1) / (float)n;
+        c[2] += k + 1 == depth ? 1.f : 0.f;
+    }
+    const float aligned_scale = 1.f / (float)std::max(1u, depth);
+    for (uint32_t s = 0; s < n; s++)
+    {
+        float* c = columns + (size_t)s * NET_STATE_COLUMNS;
+        c[3] = (float)depth / (float)n;
+        if (_distances.empty())
+            continue;
+        for (uint32_t k = 0; k < n; k++)
+        {
+            if (state[k] < 0)
+                continue;
+            const float d = _distances[(size_t)state[k] * n + s];
+            c[4] += d;
+            if (k + 1 == depth)
+                c[5] += d;
+        }
+        c[4] *= aligned_scale;
+    }
+
+    // Input and first hidden layer per sequence, pooled over all and over the aligned ones.
+    float* pooled = _pooled.get();
+    std::fill_n(pooled, 2 * NET_HIDDEN, 0.f);
+    for (uint32_t s = 0; s < n; s++)
+    {
+        float* h1 = _h1.get() + (size_t)s * NET_HIDDEN;
+        kernel.layer(columns + (size_t)s * NET_STATE_COLUMNS, NET_STATE_COLUMNS, _state_weight.get(),
+                     _base.get() + (size_t)s * NET_HIDDEN, true, _h0.get());
+        if (_quantized)
+            kernel.layer_q8(_h0.get(), NET_HIDDEN, _l1_q8.get(), _l1_scale.get(), _l1_bias.get(), true, h1);
+        else
+            kernel.layer(_h0.get(), NET_HIDDEN, _l1_weight.get(), _l1_bias.get(), true, h1);
+        const float chosen = columns[(size_t)s * NET_STATE_COLUMNS];
+        for (uint32_t o = 0; o < NET_HIDDEN; o++)
+        {
+            pooled[o] += h1[o];
+            pooled[NET_HIDDEN + o] += chosen * h1[o];
+        }
+    }
+    for (uint32_t o = 0; o < NET_HIDDEN; o++)
+    {
+        pooled[o] /= (float)n;
+        pooled[NET_HIDDEN + o] *= aligned_scale;
+    }
+
+    // The pooled inputs of the last hidden layer are the same for every sequence.
+    if (_quantized)
+    {
+        kernel.layer_q8(pooled, 2 * NET_HIDDEN, _l2_q8.get() + NET_HIDDEN * NET_HIDDEN, _l2_scale.get(),
+                        _l2_bias.get(), false, _shared.get());
+    }
+    else
+    {
+        kernel.layer(pooled, 2 * NET_HIDDEN, _l2_weight.get() + NET_HIDDEN * NET_HIDDEN, _l2_bias.get(),
+                     false, _shared.get());
+    }
+    for (uint32_t s = 0; s < n; s++)
+    {
+        const float* h1 = _h1.get() + (size_t)s * NET_HIDDEN;
+        if (_quantized)
+            kernel.layer_q8(h1, NET_HIDDEN, _l2_q8.get(), _l2_scale.get(), _shared.get(), true, _h2.get());
+        else
+            kernel.layer(h1, NET_HIDDEN, _l2_weight.get(), _shared.get(), true, _h2.get());
+        _out[s] = kernel.dot(_output_weight.get(), _h2.get()) + _output_bias;
+    }
+}
+
+void InferenceNet::q_values(const std::vector<state_type>& state, float* q)
+{
+    forward(state);
+    for (uint32_t a = 0; a < _seq_num; a++)
+        q[a] = std::tanh(_out[a]);
+}
+
+int64_t InferenceNet::best(const std::vector<state_type>& state, const uint8_t* mask)
+{
+    forward(state);
+    int64_t action = -1;
+    for (uint32_t a = 0; a < _seq_num; a++)
+    {
+        if (mask[a] && (action < 0 || _out[a] > _out[action]))
+            action = a;
+    }
+    return action;
+}
+
+uint32_t InferenceNet::seq_num() const
+{
+    return _seq_num;
+}
+
+bool InferenceNet::quantized() const
+{
+    return _quantized;
+}
+
+const char* inference_kernel_name()
+{
+    return layer_kernel().name;
+}
@@ -0,0 +1,95 @@
+//
+// Q-network inference without libtorch, for choosing actions and decoding.
+//
+
+#ifndef EXP_INFERENCE_H
+#define EXP_INFERENCE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "encoder.h"
+
+// Net's layer width, and the per-sequence state columns it appends to the features:
+// chosen, rank, last, depth, mean distance to the aligned ones and distance to the last.
+constexpr uint32_t NET_HIDDEN = 64;
+constexpr uint32_t NET_STATE_COLUMNS = 6;
+
+// Net's parameters as plain row-major {out, in} matrices, the layout of torch::nn::Linear.
+struct NetWeights
+{
+    uint32_t            feature_width = SEQUENCE_FEATURES;
+    std::vector<float>  input_weight, input_bias;       // {NET_HIDDEN, feature_width + NET_STATE_COLUMNS}
+    std::vector<float>  l1_weight, l1_bias;             // {NET_HIDDEN, NET_HIDDEN}
+    std::vector<float>  l2_weight, l2_bias;             // {NET_HIDDEN, 3 * NET_HIDDEN}
+    std::vector<float>  output_weight;                  // {1, NET_HIDDEN}
+    float               output_bias = 0;
+
+    // A small versioned binary file; throws std::runtime_error on I/O errors and, for load,
+    // on a malformed or truncated file.
+    void save(const std::string& path) const;
+    static NetWeights load(const std::string& path);
+};
+
+// Net::forward for one state at a time, on weights copied into contiguous 32-byte aligned
+// buffers. Everything that does not depend on the state, the input layer over the sequence
+// features, is computed once by load(), and the pooled inputs of the last hidden layer once
+// per state rather than per sequence. Layers run as AVX2/FMA or scalar kernels picked for
+// the CPU, optionally with int8 weights and a float scale per output. Not thread-safe: give
+// each thread its own copy.
+class InferenceNet
+{
+public:
+    // encoding as for DQN; with quantized the two hidden layers keep int8 weights.
+    InferenceNet(const uint32_t& seq_num, const SequenceEncoding& encoding, const bool& quantized = false);
+
+    // Throws std::invalid_argument if weights do not fit the encoding.
+    void load(const NetWeights& weights);
+
+    // q[a] for every action a, as Net::forward would give for state.
+    void q_values(const std::vector<state_type>& state, float* q);
+    // The available (mask[a] != 0) action with the highest Q-value, -1 if there is none.
+    // Skips the final tanh, which does not change the order.
+    int64_t best(const std::vector<state_type>& state, const uint8_t* mask);
+
+    [[nodiscard]] uint32_t seq_num() const;
+    [[nodiscard]] bool quantized() const;
+
+private:
+    struct Aligned
+    {
+        void operator()(void* p) const;
+    };
+    template<typename T>
+    using Buffer = std::unique_ptr<T[], Aligned>;
+    template<typename T>
+    static Buffer<T> allocate(const size_t& count);
+
+    // Leaves the pre-tanh output of every sequence in _out.
+    void forward(const std::vector<state_type>& state);
+
+    uint32_t                _seq_num, _feature_width;
+    bool                    _quantized;
+    std::vector<float>      _features, _distances;
+
+    // Transposed {in, NET_HIDDEN} weights, so a layer is NET_HIDDEN-wide multiply-adds
+    // over its inputs with no horizontal sums.
+    Buffer<float>           _state_weight;          // input layer, state columns only
+    Buffer<float>           _l1_weight, _l2_weight; // float weights, unless quantized
+    Buffer<int8_t>          _l1_q8, _l2_q8;         // int8 weights, if quantized
+    Buffer<float>           _l1_scale, _l2_scale;
+    Buffer<float>           _l1_bias, _l2_bias, _output_weight;
+    float                   _output_bias;
+
+    // Per sequence: the input layer over its features, then scratch for one forward pass.
+    Buffer<float>           _base;
+    Buffer<float>           _h0, _h1, _h2;
+    Buffer<float>           _columns, _pooled, _shared, _out;
+};
+
+// Name of the layer kernel picked for this CPU.
+const char* inference_kernel_name();
+
+#endif //EXP_INFERENCE_H
@@ -1,54 +1,207 @@
 #include <iostream>
+#include <cstring>
 #include "dqn.h"
 #include "environment.h"
+#include "rollout.h"
+#include "beam.h"
+#include "batch.h"
+#include "guide.h"
+#include "telemetry.h"
+#include "checkpoint.h"
 
-const std::vector<std::string> data = {
+// Aligned when no --input is given.
+const std::vector<std::string> sample = {
     "GTGCTGCCTGGTACAT",
     "GTGCTGCCTGGTACAT",
     "GTGCTGCCTGGTACAT"
 };
 
-int main()
+int main(int argc, char** argv)
 {
-    const auto &dataset = data;
-    Environment env(dataset);
-    DQN agent(dataset.size());
+    // Every Config key is a flag (--episodes 1000, --batch-size 64, --config sweep.txt, ...).
+    // --input FILE: the FASTA family to align, read through the memory-mapped FastaFile.
+    // --workers N: play episodes on N actor threads next to a learner thread, which updates
+    // as fast as it can up to --replay-ratio times per actor step.
+    // --beam W: decode the final order with a beam of width W (1 is greedy).
+    // --export-weights FILE: write the trained net as NetWeights, which InferenceNet runs
+    // without libtorch; --int8-inference true: act and decode with int8 hidden layers.
+    // --updates-per-step N: gradient steps per environment step; --prefetch true: sample
+    // the next batch on another thread while the current one trains.
+    // --cache N: keep up to N partial alignments keyed by the chosen prefix.
+    // --warm-start N: push the guide-tree episode N times as demonstrations before training.
+    // --checkpoint DIR: save the whole training state there every --checkpoint-every
+    // episodes and at the end; --resume DIR continues from such a directory.
+    // --telemetry FILE: write the counters and timers there every --report-interval seconds,
+    // as JSON if FILE ends in .json and Prometheus text otherwise.
+    // Batch mode, given FASTA files (or @list files of paths) and --out DIR: align every
+    // family on its own agent, --threads at a time within --memory MB, training each for
+    // --episodes episodes or loading --model instead.
+    Config config;
+    std::vector<std::string> inputs;
+    try
+    {
+        inputs = config.parse(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
 
-    std::vector<float> scores;
-    for (ProgressBar progress; progress < config::episodes; ++progress)
+    if (!inputs.empty() || !config.out.empty())
     {
-        auto state = env.reset();
-        while (true)
+        if (inputs.empty() || config.out.empty())
+        {
+            std::cerr << "batch mode needs FASTA files and --out DIR" << std::endl;
+            return 1;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto reports = run_batch(config, inputs);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        uint32_t failed = 0;
+        for (const auto& report : reports)
         {
-            auto action = agent.select(state);
-            auto [next_state, reward, done] = env.step(action);
-            agent.push({ state, action, next_state, reward, done });
-            agent.update();
-            if (!done)
+            std::cout << report.name << "\t" << report.sequences << " sequences\t" << report.seconds << " s\t";
+            if (report.error.empty())
+                std::cout << "SP " << report.score << std::endl;
+            else
             {
-                break;
+                std::cout << "failed: " << report.error << std::endl;
+                failed++;
             }
-            state = std::move(next_state);
         }
-        float q_eval = agent.predict_q_value(state);
-        scores.emplace_back(q_eval * env.max_reward());
-        agent.reset();
+        std::cout << reports.size() << " families (" << failed << " failed) in " << seconds << " s, "
+                  << (seconds > 0 ? reports.size() / seconds : 0.) << " families/s" << std::endl;
+        return failed ? 1 : 0;
+    }
+
+    std::vector<std::string> dataset = sample;
+    if (!config.input.empty())
+    {
+        try
+        {
+            dataset = load_sequence(config.input);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        if (dataset.empty())
+        {
+            std::cerr << "No sequences in " << config.input << std::endl;
+            return 1;
+        }
+    }
+    Environment env(dataset, config);
+    DQN agent(dataset.size(), env.encoding(), config);
+
+    std::shared_ptr<TranspositionCache> cache;
+    if (config.cache > 0)
+    {
+        cache = std::make_shared<TranspositionCache>(config.cache);
+        env.set_cache(cache);
+    }
+
+    // A loaded model is only decoded; a resumed run plays the episodes it had left.
+    uint64_t episodes = config.episodes, done = 0;
+    if (!config.model.empty())
+    {
+        agent.load(config.model);
+        episodes = 0;
+    }
+    else if (!config.resume.empty())
+    {
+        try
+        {
+            agent.restore(config.resume);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        done = std::min<uint64_t>(agent.episodes(), episodes);
+        std::cout << "resumed after " << done << " episodes" << std::endl;
+    }
+    else if (config.warm_start > 0)
+    {
+        const auto order = guide_order(dataset, std::max(1u, std::thread::hardware_concurrency()));
+        std::cout << "guide tree: " << warm_start(env, agent, order, config.warm_start) << std::endl;
     }
 
-    auto state = env.reset();
+    std::unique_ptr<Checkpointer> checkpointer;
+    if (!config.checkpoint.empty() && episodes > done)
+        checkpointer = std::make_unique<Checkpointer>(config.checkpoint);
+    {
+        telemetry::Reporter reporter(episodes - done, config.report_interval, config.telemetry);
+        if (config.workers > 1)
+        {
+            Rollout rollout(env, agent, config.workers, config.replay_ratio);
+            rollout.start(episodes - done);
+            // Taken while the actors play, so these resume the agent but not the exact run.
+            for (uint64_t saved = 0; checkpointer && rollout.finished() < episodes - done;)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (rollout.finished() - saved >= config.checkpoint_every)
+                {
+                    saved = rollout.finished();
+                    checkpointer->save(agent.checkpoint());
+                }
+            }
+            rollout.join();
+        }
+        else
+        {
+            for (uint64_t episode = done; episode < episodes; episode++)
+            {
+                play_episode(env, agent);
+                if (checkpointer && 0 == (episode + 1) % config.checkpoint_every)
+                    checkpointer->save(agent.checkpoint());
+            }
+        }
+    }
+    if (checkpointer)
+    {
+        checkpointer->save(agent.checkpoint());
+        try
+        {
+            checkpointer->flush();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
 
-    for (int i = 0; i < dataset.size(); i++)
+    if (!config.export_weights.empty())
     {
-        auto action = agent.predict(state);
-        env.step(action);
-        state[i] = action;
+        try
+        {
+            agent.weights().save(config.export_weights);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
     }
-    for (const auto& val : state) std::cout << val << " ";
+
+    env.reset();
+    auto net = agent.inference();
+    auto result = beam_search(net, env, config.beam);
+
+    for (const auto& val : result.order) std::cout << val << " ";
     std::cout << std::endl;
 
-    print_sequences(env.alignment());
+    print_sequences(result.environment.alignment());
+
+    std::cout << result.score << std::endl;
 
-    std::cout << env.calc_sum_of_pairs() << std::endl;
+    if (cache)
+        std::cout << "cache: " << cache->hits() << " hits, " << cache->misses() << " misses" << std::endl;
 
     return 0;
 }
@@ -0,0 +1,105 @@
+#include "packed.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace
+{
+    constexpr std::array<char, 4> nucleotide = {'A', 'T', 'C', 'G'};
+    constexpr uint8_t NOT_PACKED = 0xFF;
+
+    const std::array<uint8_t, 256>& code_table()
+    {
+        static const std::array<uint8_t, 256> table = []()
+        {
+            std::array<uint8_t, 256> t{};
+            t.fill(NOT_PACKED);
+            for (uint8_t code = 0; code < 4; code++)
+                t[(uint8_t)nucleotide[code]] = code;
+            return t;
+        }();
+        return table;
+    }
+
+    // Four decoded characters for every byte of packed codes, lowest code first.
+    const std::array<std::array<char, 4>, 256>& decode_table()
+    {
+        static const std::array<std::array<char, 4>, 256> table = []()
+        {
+            std::array<std::array<char, 4>, 256> t{};
+            for (uint32_t byte = 0; byte < 256; byte++)
+            {
+                for (uint32_t k = 0; k < 4; k++)
+                    t[byte][k] = nucleotide[(byte >> (2 * k)) & 3];
+            }
+            return t;
+        }();
+        return table;
+    }
+}
+
+PackedSequence::PackedSequence(const std::string& sequence) :
+        _words((sequence.size() + 31) / 32, 0),
+        _size((uint32_t)sequence.size())
+{
+    const auto& table = code_table();
+    for (uint32_t i = 0; i < _size; i++)
+    {
+        const uint8_t code = table[(uint8_t)sequence[i]];
+        if (NOT_PACKED == code)
+            _exceptions.push_back({ i, sequence[i] });
+        else
+            _words[i / 32] |= (uint64_t)code << (2 * (i % 32));
+    }
+}
+
+size_t PackedSequence::size() const
+{
+    return _size;
+}
+
+char PackedSequence::operator[](const size_t& i) const
+{
+    if (!_exceptions.empty())
+    {
+        auto it = std::lower_bound(_exceptions.begin(), _exceptions.end(), i,
+                                   [](const Exception& e, const size_t& pos) { return e.position < pos; });
+        if (it != _exceptions.end() && it->position == i)
+            return it->symbol;
+    }
+    return nucleotide[(_words[i / 32] >> (2 * (i % 32))) & 3];
+}
+
+void PackedSequence::decode(char* out) const
+{
+    const auto& table = decode_table();
+    size_t i = 0;
+    for (const auto& word : _words)
+    {
+        for (uint32_t byte = 0; byte < 8 && i < _size; byte++, i += 4)
+        {
+            const auto& chars = table[(word >> (8 * byte)) & 0xFF];
+            memcpy(out + i, chars.data(), std::min<size_t>(4, _size - i));
+        }
+    }
+    for (const auto& e : _exceptions)
+        out[e.position] = e.symbol;
+}
+
+std::string PackedSequence::unpack() const
+{
+    std::string res(_size, '\0');
+    decode(res.data());
+    return res;
+}
+
+size_t PackedSequence::footprint() const
+{
+    return sizeof(*this) + _words.capacity() * sizeof(uint64_t) + _exceptions.capacity() * sizeof(Exception);
+}
+
+std::vector<PackedSequence> pack_sequences(const std::vector<std::string>& sequences)
+{
+    return { sequences.begin(), sequences.end() };
+}
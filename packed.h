@@ -0,0 +1,45 @@
+//
+// Nucleotide sequence packed 2 bits per base, with anything else kept on the side.
+//
+
+#ifndef EXP_PACKED_H
+#define EXP_PACKED_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// A, T, C and G are stored as codes 0..3 (the ColumnProfile::Symbol order), 32 per word.
+// Every other character, including N, gaps and lower case, is listed in a sorted side
+// channel of (position, character) and decodes back exactly.
+class PackedSequence
+{
+public:
+    PackedSequence() = default;
+    explicit PackedSequence(const std::string& sequence);
+
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] char operator[](const size_t& i) const;
+
+    // Writes the size() characters to out with a 4-bases-per-byte table lookup.
+    void decode(char* out) const;
+    [[nodiscard]] std::string unpack() const;
+
+    // Bytes held, for memory accounting.
+    [[nodiscard]] size_t footprint() const;
+
+private:
+    struct Exception
+    {
+        uint32_t    position;
+        char        symbol;
+    };
+
+    std::vector<uint64_t>   _words;
+    std::vector<Exception>  _exceptions;
+    uint32_t                _size = 0;
+};
+
+std::vector<PackedSequence> pack_sequences(const std::vector<std::string>& sequences);
+
+#endif //EXP_PACKED_H
@@ -0,0 +1,995 @@
+#include "pairwise.h"
+#include "utils.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(EXP_PAIRWISE_NO_SIMD)
+#define EXP_PAIRWISE_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    constexpr int32_t NEG_INF = INT32_MIN / 2;
+
+    // Traceback move out of a cell, named as in the original full-matrix traceback.
+    enum Direction : uint8_t
+    {
+        DIAGONAL = 0,
+        UP = 1,         // score[i][j - 1], gap in the target
+        LEFT = 2        // score[i - 1][j], gap in the profile
+    };
+
+    // Fills cur[0..n] = score[i][0..n] from prev = score[i - 1][0..n] for target character t,
+    // leaving diag[j] = score[i - 1][j - 1] + match(profile[j - 1], t) for the traceback.
+    // subst is the QueryProfile row of t, only read by the MatrixScores kernels.
+    using FillRow = void (*)(const Scores& scores, const int32_t* subst, const int32_t* prev, int32_t* cur,
+                             int32_t* diag, const char* profile, uint32_t n, char t, int32_t i);
+    // Writes the preferred traceback direction of every cell of a filled row.
+    using MarkRow = void (*)(const Scores& scores, const int32_t* cur, const int32_t* diag, uint32_t n, uint8_t* dirs);
+
+    // Affine rows also keep f, the best score ending in a gap in the profile, and c, the
+    // running max the horizontal gaps are taken from: the best score of row i ending in a
+    // gap in the target at column j is c[j - 1] + gap.
+    using FillAffine = void (*)(const Scores& scores, const int32_t* subst, const int32_t* h_prev,
+                                const int32_t* f_prev, int32_t* h, int32_t* f, int32_t* c, int32_t* diag,
+                                const char* profile, uint32_t n, char t, int32_t i);
+    // Writes an AffineMove per cell of a filled row.
+    using MarkAffine = void (*)(const Scores& scores, const int32_t* h_prev, const int32_t* h, const int32_t* f,
+                                const int32_t* c, const int32_t* diag, uint32_t n, uint8_t* moves);
+
+    // Affine traceback byte: the low bits say where h comes from, the flags whether the gap
+    // ending in the cell was opened there or extends one from the previous cell.
+    enum AffineMove : uint8_t
+    {
+        FROM_DIAGONAL = 0,
+        FROM_TARGET_GAP = 1,
+        FROM_PROFILE_GAP = 2,
+        SOURCE = 3,
+        TARGET_GAP_OPENS = 4,
+        PROFILE_GAP_OPENS = 8
+    };
+
+    // Where the kernels get their scores from. FixedScores folds the compiled-in ones into
+    // the instructions and ignores scores; RuntimeScores copies them out of it; MatrixScores
+    // reads substitution scores from the QueryProfile row of the target character.
+    struct FixedScores
+    {
+        explicit FixedScores(const Scores&) {}
+
+        static constexpr bool matrix = false;
+        static constexpr int32_t match = MATCH_REWARD;
+        static constexpr int32_t mismatch = MISMATCH_PENALTY;
+        static constexpr int32_t gap = GAP_PENALTY;
+        static constexpr int32_t gap_open = 0;
+    };
+
+    struct RuntimeScores
+    {
+        explicit RuntimeScores(const Scores& scores) :
+                match(scores.match), mismatch(scores.mismatch), gap(scores.gap), gap_open(scores.gap_open) {}
+
+        static constexpr bool matrix = false;
+        const int32_t match, mismatch, gap, gap_open;
+    };
+
+    struct MatrixScores
+    {
+        explicit MatrixScores(const Scores& scores) :
+                match(0), mismatch(0), gap(scores.gap), gap_open(scores.gap_open) {}
+
+        static constexpr bool matrix = true;
+        const int32_t match, mismatch, gap, gap_open;
+    };
+
+    // Substitution scores of every profile column against each target character, built the
+    // first time the character shows up, so the matrix kernels load them like a score row.
+    class QueryProfile
+    {
+    public:
+        QueryProfile(const Scores& scores, const std::string& profile) : _scores(scores), _profile(profile) {}
+
+        const int32_t* row(const char& t)
+        {
+            if (!_scores.matrix)
+                return nullptr;
+            auto& r = _rows[(uint8_t)t];
+            if (r.size() != _profile.size())
+            {
+                r.resize(_profile.size());
+                for (size_t j = 0; j < _profile.size(); j++)
+                    r[j] = ('-' == t || '-' == _profile[j]) ? _scores.gap : (*_scores.matrix)(_profile[j], t);
+            }
+            return r.data();
+        }
+
+    private:
+        const Scores&                           _scores;
+        const std::string&                      _profile;
+        std::array<std::vector<int32_t>, 256>   _rows;
+    };
+
+    struct RowKernel
+    {
+        const char* name;
+        FillRow fill;
+        MarkRow mark;
+    };
+
+    struct AffineKernel
+    {
+        const char* name;
+        FillAffine fill;
+        MarkAffine mark;
+    };
+
+    template<typename Policy>
+    inline int32_t match_score(const Policy& p, const char& a, const char& b)
+    {
+        if (a == '-' || b == '-') { return p.gap; }
+        else if (a == b) { return p.match; }
+        return p.mismatch;
+    }
+
+    template<typename Policy>
+    inline int32_t substitution(const Policy& p, const int32_t* subst, const char* profile,
+                                const uint32_t& j, const char& t)
+    {
+        if constexpr (Policy::matrix)
+            return subst[j - 1];
+        else
+            return match_score(p, profile[j - 1], t);
+    }
+
+    template<typename Policy>
+    void fill_row_scalar(const Scores& scores, const int32_t* subst, const int32_t* prev, int32_t* cur,
+                         int32_t* diag, const char* profile, uint32_t n, char t, int32_t i)
+    {
+        const Policy p(scores);
+        cur[0] = p.gap * i;
+        for (uint32_t j = 1; j <= n; j++)
+        {
+            diag[j] = prev[j - 1] + substitution(p, subst, profile, j, t);
+            cur[j] = std::max(diag[j], prev[j] + p.gap);
+        }
+        for (uint32_t j = 1; j <= n; j++)
+            cur[j] = std::max(cur[j], cur[j - 1] + p.gap);
+    }
+
+    template<typename Policy>
+    void mark_row_scalar(const Scores& scores, const int32_t* cur, const int32_t* diag, uint32_t n, uint8_t* dirs)
+    {
+        const Policy p(scores);
+        for (uint32_t j = 1; j <= n; j++)
+        {
+            if (cur[j] == diag[j])
+                dirs[j] = DIAGONAL;
+            else if (cur[j] == cur[j - 1] + p.gap)
+                dirs[j] = UP;
+            else
+                dirs[j] = LEFT;
+        }
+    }
+
+    // Gotoh: h is the best score of a cell, f of those ending in a profile gap, and the target
+    // gaps come out of the running max c, which with gap_open <= 0 only needs the diagonal and
+    // f part of h, so the affine row is the linear row with one more vector pass.
+    template<typename Policy>
+    void fill_affine_scalar(const Scores& scores, const int32_t* subst, const int32_t* h_prev,
+                            const int32_t* f_prev, int32_t* h, int32_t* f, int32_t* c, int32_t* diag,
+                            const char* profile, uint32_t n, char t, int32_t i)
+    {
+        const Policy p(scores);
+        const int32_t open = p.gap_open + p.gap;
+        h[0] = f[0] = p.gap_open + p.gap * i;
+        c[0] = h[0] + p.gap_open;
+        for (uint32_t j = 1; j <= n; j++)
+        {
+            diag[j] = h_prev[j - 1] + substitution(p, subst, profile, j, t);
+            f[j] = std::max(f_prev[j] + p.gap, h_prev[j] + open);
+            h[j] = std::max(diag[j], f[j]);
+            c[j] = h[j] + p.gap_open;
+        }
+        for (uint32_t j = 1; j <= n; j++)
+            c[j] = std::max(c[j], c[j - 1] + p.gap);
+        for (uint32_t j = 1; j <= n; j++)
+            h[j] = std::max(h[j], c[j - 1] + p.gap);
+    }
+
+    template<typename Policy>
+    void mark_affine_scalar(const Scores& scores, const int32_t* h_prev, const int32_t* h, const int32_t* f,
+                            const int32_t* c, const int32_t* diag, uint32_t n, uint8_t* moves)
+    {
+        const Policy p(scores);
+        const int32_t open = p.gap_open + p.gap;
+        for (uint32_t j = 1; j <= n; j++)
+        {
+            uint8_t move;
+            if (h[j] == diag[j])
+                move = FROM_DIAGONAL;
+            else if (h[j] == c[j - 1] + p.gap)
+                move = FROM_TARGET_GAP;
+            else
+                move = FROM_PROFILE_GAP;
+            if (c[j - 1] == h[j - 1] + p.gap_open)
+                move |= TARGET_GAP_OPENS;
+            if (f[j] == h_prev[j] + open)
+                move |= PROFILE_GAP_OPENS;
+            moves[j] = move;
+        }
+    }
+
+#ifdef EXP_PAIRWISE_X86
+    // The vertical/diagonal part of a row is independent per column and is done in vector
+    // lanes; the horizontal gap term is a running max, done as an in-register prefix scan.
+
+    template<typename Policy>
+    __attribute__((target("sse4.1")))
+    void fill_row_sse41(const Scores& scores, const int32_t* subst, const int32_t* prev, int32_t* cur,
+                        int32_t* diag, const char* profile, uint32_t n, char t, int32_t i)
+    {
+        const Policy p(scores);
+        const __m128i gap = _mm_set1_epi32(p.gap);
+        const __m128i mismatch = _mm_set1_epi32(p.mismatch);
+        const __m128i bonus = _mm_set1_epi32(p.match - p.mismatch);
+        const __m128i target = _mm_set1_epi8(t);
+        const __m128i dash = _mm_set1_epi8('-');
+        const __m128i target_gap = _mm_set1_epi32(t == '-' ? -1 : 0);
+
+        cur[0] = p.gap * i;
+        uint32_t j = 1;
+        for (; j + 3 <= n; j += 4)
+        {
+            __m128i s;
+            if constexpr (Policy::matrix)
+                s = _mm_loadu_si128((const __m128i*)(subst + j - 1));
+            else
+            {
+                int32_t chars;
+                memcpy(&chars, profile + j - 1, sizeof(chars));
+                const __m128i c = _mm_cvtsi32_si128(chars);
+                const __m128i eq = _mm_cvtepi8_epi32(_mm_cmpeq_epi8(c, target));
+                const __m128i gp = _mm_or_si128(_mm_cvtepi8_epi32(_mm_cmpeq_epi8(c, dash)), target_gap);
+                s = _mm_blendv_epi8(_mm_add_epi32(mismatch, _mm_and_si128(eq, bonus)), gap, gp);
+            }
+
+            const __m128i d = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(prev + j - 1)), s);
+            const __m128i u = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(prev + j)), gap);
+            _mm_storeu_si128((__m128i*)(diag + j), d);
+            _mm_storeu_si128((__m128i*)(cur + j), _mm_max_epi32(d, u));
+        }
+        for (; j <= n; j++)
+        {
+            diag[j] = prev[j - 1] + substitution(p, subst, profile, j, t);
+            cur[j] = std::max(diag[j], prev[j] + p.gap);
+        }
+
+        const __m128i ninf = _mm_set1_epi32(NEG_INF);
+        const __m128i gap2 = _mm_set1_epi32(2 * p.gap);
+        const __m128i ramp = _mm_setr_epi32(p.gap, 2 * p.gap, 3 * p.gap, 4 * p.gap);
+        __m128i carry = _mm_set1_epi32(cur[0]);
+        for (j = 1; j + 3 <= n; j += 4)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)(cur + j));
+            x = _mm_max_epi32(x, _mm_add_epi32(_mm_alignr_epi8(x, ninf, 12), gap));
+            x = _mm_max_epi32(x, _mm_add_epi32(_mm_alignr_epi8(x, ninf, 8), gap2));
+            x = _mm_max_epi32(x, _mm_add_epi32(carry, ramp));
+            _mm_storeu_si128((__m128i*)(cur + j), x);
+            carry = _mm_shuffle_epi32(x, 0xFF);
+        }
+        for (; j <= n; j++)
+            cur[j] = std::max(cur[j], cur[j - 1] + p.gap);
+    }
+
+    template<typename Policy>
+    __attribute__((target("sse4.1")))
+    void mark_row_sse41(const Scores& scores, const int32_t* cur, const int32_t* diag, uint32_t n, uint8_t* dirs)
+    {
+        const Policy p(scores);
+        const __m128i gap = _mm_set1_epi32(p.gap);
+        const __m128i up = _mm_set1_epi32(UP);
+        const __m128i left = _mm_set1_epi32(LEFT);
+
+        uint32_t j = 1;
+        for (; j + 3 <= n; j += 4)
+        {
+            const __m128i h = _mm_loadu_si128((const __m128i*)(cur + j));
+            const __m128i d = _mm_loadu_si128((const __m128i*)(diag + j));
+            const __m128i h_up = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(cur + j - 1)), gap);
+            __m128i v = _mm_blendv_epi8(left, up, _mm_cmpeq_epi32(h, h_up));
+            v = _mm_andnot_si128(_mm_cmpeq_epi32(h, d), v);
+            v = _mm_packs_epi32(v, v);
+            const int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+            memcpy(dirs + j, &packed, sizeof(packed));
+        }
+        mark_row_scalar<Policy>(scores, cur + j - 1, diag + j - 1, n - j + 1, dirs + j - 1);
+    }
+
+    template<int Mask>
+    __attribute__((target("avx2")))
+    inline __m256i shift_lanes(const __m256i& x, const __m256i& idx, const __m256i& ninf)
+    {
+        return _mm256_blend_epi32(_mm256_permutevar8x32_epi32(x, idx), ninf, Mask);
+    }
+
+    // Substitution scores of profile columns j..j + 7 against the target character.
+    template<typename Policy>
+    __attribute__((target("avx2")))
+    inline __m256i substitution_avx2(const Policy& p, const int32_t* subst, const char* profile,
+                                     const uint32_t& j, const char& t)
+    {
+        if constexpr (Policy::matrix)
+            return _mm256_loadu_si256((const __m256i*)(subst + j - 1));
+        else
+        {
+            const __m128i c = _mm_loadl_epi64((const __m128i*)(profile + j - 1));
+            const __m256i eq = _mm256_cvtepi8_epi32(_mm_cmpeq_epi8(c, _mm_set1_epi8(t)));
+            const __m256i gp = _mm256_or_si256(_mm256_cvtepi8_epi32(_mm_cmpeq_epi8(c, _mm_set1_epi8('-'))),
+                                               _mm256_set1_epi32(t == '-' ? -1 : 0));
+            const __m256i s = _mm256_add_epi32(_mm256_set1_epi32(p.mismatch),
+                                               _mm256_and_si256(eq, _mm256_set1_epi32(p.match - p.mismatch)));
+            return _mm256_blendv_epi8(s, _mm256_set1_epi32(p.gap), gp);
+        }
+    }
+
+    // x[j] = max(x[j], x[j - 1] + gap) for j in 1..n, starting from x[0].
+    template<typename Policy>
+    __attribute__((target("avx2")))
+    inline void scan_row_avx2(const Policy& p, int32_t* x, const uint32_t& n)
+    {
+        const __m256i gap = _mm256_set1_epi32(p.gap);
+        const __m256i ninf = _mm256_set1_epi32(NEG_INF);
+        const __m256i gap2 = _mm256_set1_epi32(2 * p.gap);
+        const __m256i gap4 = _mm256_set1_epi32(4 * p.gap);
+        const __m256i shift1 = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+        const __m256i shift2 = _mm256_setr_epi32(0, 0, 0, 1, 2, 3, 4, 5);
+        const __m256i shift4 = _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 3);
+        const __m256i last = _mm256_set1_epi32(7);
+        const __m256i ramp = _mm256_setr_epi32(p.gap, 2 * p.gap, 3 * p.gap, 4 * p.gap,
+                                               5 * p.gap, 6 * p.gap, 7 * p.gap, 8 * p.gap);
+        __m256i carry = _mm256_set1_epi32(x[0]);
+        uint32_t j = 1;
+        for (; j + 7 <= n; j += 8)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(x + j));
+            v = _mm256_max_epi32(v, _mm256_add_epi32(shift_lanes<0x01>(v, shift1, ninf), gap));
+            v = _mm256_max_epi32(v, _mm256_add_epi32(shift_lanes<0x03>(v, shift2, ninf), gap2));
+            v = _mm256_max_epi32(v, _mm256_add_epi32(shift_lanes<0x0F>(v, shift4, ninf), gap4));
+            v = _mm256_max_epi32(v, _mm256_add_epi32(carry, ramp));
+            _mm256_storeu_si256((__m256i*)(x + j), v);
+            carry = _mm256_permutevar8x32_epi32(v, last);
+        }
+        for (; j <= n; j++)
+            x[j] = std::max(x[j], x[j - 1] + p.gap);
+    }
+
+    template<typename Policy>
+    __attribute__((target("avx2")))
+    void fill_row_avx2(const Scores& scores, const int32_t* subst, const int32_t* prev, int32_t* cur,
+                       int32_t* diag, const char* profile, uint32_t n, char t, int32_t i)
+    {
+        const Policy p(scores);
+        const __m256i gap = _mm256_set1_epi32(p.gap);
+
+        cur[0] = p.gap * i;
+        uint32_t j = 1;
+        for (; j + 7 <= n; j += 8)
+        {
+            const __m256i s = substitution_avx2(p, subst, profile, j, t);
+            const __m256i d = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(prev + j - 1)), s);
+            const __m256i u = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(prev + j)), gap);
+            _mm256_storeu_si256((__m256i*)(diag + j), d);
+            _mm256_storeu_si256((__m256i*)(cur + j), _mm256_max_epi32(d, u));
+        }
+        for (; j <= n; j++)
+        {
+            diag[j] = prev[j - 1] + substitution(p, subst, profile, j, t);
+            cur[j] = std::max(diag[j], prev[j] + p.gap);
+        }
+
+        scan_row_avx2(p, cur, n);
+    }
+
+    template<typename Policy>
+    __attribute__((target("avx2")))
+    void mark_row_avx2(const Scores& scores, const int32_t* cur, const int32_t* diag, uint32_t n, uint8_t* dirs)
+    {
+        const Policy p(scores);
+        const __m256i gap = _mm256_set1_epi32(p.gap);
+        const __m256i up = _mm256_set1_epi32(UP);
+        const __m256i left = _mm256_set1_epi32(LEFT);
+
+        uint32_t j = 1;
+        for (; j + 7 <= n; j += 8)
+        {
+            const __m256i h = _mm256_loadu_si256((const __m256i*)(cur + j));
+            const __m256i d = _mm256_loadu_si256((const __m256i*)(diag + j));
+            const __m256i h_up = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(cur + j - 1)), gap);
+            __m256i v = _mm256_blendv_epi8(left, up, _mm256_cmpeq_epi32(h, h_up));
+            v = _mm256_andnot_si256(_mm256_cmpeq_epi32(h, d), v);
+            const __m128i v16 = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            _mm_storel_epi64((__m128i*)(dirs + j), _mm_packus_epi16(v16, v16));
+        }
+        mark_row_scalar<Policy>(scores, cur + j - 1, diag + j - 1, n - j + 1, dirs + j - 1);
+    }
+
+    template<typename Policy>
+    __attribute__((target("avx2")))
+    void fill_affine_avx2(const Scores& scores, const int32_t* subst, const int32_t* h_prev,
+                          const int32_t* f_prev, int32_t* h, int32_t* f, int32_t* c, int32_t* diag,
+                          const char* profile, uint32_t n, char t, int32_t i)
+    {
+        const Policy p(scores);
+        const __m256i gap = _mm256_set1_epi32(p.gap);
+        const __m256i gap_open = _mm256_set1_epi32(p.gap_open);
+        const __m256i open = _mm256_set1_epi32(p.gap_open + p.gap);
+
+        h[0] = f[0] = p.gap_open + p.gap * i;
+        c[0] = h[0] + p.gap_open;
+        uint32_t j = 1;
+        for (; j + 7 <= n; j += 8)
+        {
+            const __m256i s = substitution_avx2(p, subst, profile, j, t);
+            const __m256i d = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(h_prev + j - 1)), s);
+            const __m256i extend = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(f_prev + j)), gap);
+            const __m256i opened = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(h_prev + j)), open);
+            const __m256i fv = _mm256_max_epi32(extend, opened);
+            const __m256i hv = _mm256_max_epi32(d, fv);
+            _mm256_storeu_si256((__m256i*)(diag + j), d);
+            _mm256_storeu_si256((__m256i*)(f + j), fv);
+            _mm256_storeu_si256((__m256i*)(h + j), hv);
+            _mm256_storeu_si256((__m256i*)(c + j), _mm256_add_epi32(hv, gap_open));
+        }
+        for (; j <= n; j++)
+        {
+            diag[j] = h_prev[j - 1] + substitution(p, subst, profile, j, t);
+            f[j] = std::max(f_prev[j] + p.gap, h_prev[j] + p.gap_open + p.gap);
+            h[j] = std::max(diag[j], f[j]);
+            c[j] = h[j] + p.gap_open;
+        }
+
+        scan_row_avx2(p, c, n);
+
+        for (j = 1; j + 7 <= n; j += 8)
+        {
+            const __m256i e = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(c + j - 1)), gap);
+            _mm256_storeu_si256((__m256i*)(h + j), _mm256_max_epi32(_mm256_loadu_si256((const __m256i*)(h + j)), e));
+        }
+        for (; j <= n; j++)
+            h[j] = std::max(h[j], c[j - 1] + p.gap);
+    }
+
+    template<typename Policy>
+    __attribute__((target("avx2")))
+    void mark_affine_avx2(const Scores& scores, const int32_t* h_prev, const int32_t* h, const int32_t* f,
+                          const int32_t* c, const int32_t* diag, uint32_t n, uint8_t* moves)
+    {
+        const Policy p(scores);
+        const __m256i gap = _mm256_set1_epi32(p.gap);
+        const __m256i gap_open = _mm256_set1_epi32(p.gap_open);
+        const __m256i open = _mm256_set1_epi32(p.gap_open + p.gap);
+        const __m256i from_target_gap = _mm256_set1_epi32(FROM_TARGET_GAP);
+        const __m256i from_profile_gap = _mm256_set1_epi32(FROM_PROFILE_GAP);
+        const __m256i target_gap_opens = _mm256_set1_epi32(TARGET_GAP_OPENS);
+        const __m256i profile_gap_opens = _mm256_set1_epi32(PROFILE_GAP_OPENS);
+
+        uint32_t j = 1;
+        for (; j + 7 <= n; j += 8)
+        {
+            const __m256i hv = _mm256_loadu_si256((const __m256i*)(h + j));
+            const __m256i d = _mm256_loadu_si256((const __m256i*)(diag + j));
+            const __m256i cl = _mm256_loadu_si256((const __m256i*)(c + j - 1));
+            const __m256i hl = _mm256_loadu_si256((const __m256i*)(h + j - 1));
+            const __m256i fv = _mm256_loadu_si256((const __m256i*)(f + j));
+            const __m256i hu = _mm256_loadu_si256((const __m256i*)(h_prev + j));
+
+            __m256i v = _mm256_blendv_epi8(from_profile_gap, from_target_gap,
+                                           _mm256_cmpeq_epi32(hv, _mm256_add_epi32(cl, gap)));
+            v = _mm256_andnot_si256(_mm256_cmpeq_epi32(hv, d), v);
+            v = _mm256_or_si256(v, _mm256_and_si256(_mm256_cmpeq_epi32(cl, _mm256_add_epi32(hl, gap_open)),
+                                                    target_gap_opens));
+            v = _mm256_or_si256(v, _mm256_and_si256(_mm256_cmpeq_epi32(fv, _mm256_add_epi32(hu, open)),
+                                                    profile_gap_opens));
+            const __m128i v16 = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            _mm_storel_epi64((__m128i*)(moves + j), _mm_packus_epi16(v16, v16));
+        }
+        mark_affine_scalar<Policy>(scores, h_prev + j - 1, h + j - 1, f + j - 1, c + j - 1, diag + j - 1,
+                                   n - j + 1, moves + j - 1);
+    }
+#endif
+
+    // Instruction sets in the order the kernels need them.
+    enum KernelLevel { SCALAR_KERNELS, SSE41_KERNELS, AVX2_KERNELS };
+
+    KernelLevel supported_level()
+    {
+        static const KernelLevel level = []()
+        {
+#ifdef EXP_PAIRWISE_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return AVX2_KERNELS;
+            if (__builtin_cpu_supports("sse4.1"))
+                return SSE41_KERNELS;
+#endif
+            return SCALAR_KERNELS;
+        }();
+        return level;
+    }
+
+    // Set by limit_pairwise_kernels; every alignment reads it once.
+    std::atomic<int> kernel_limit(AVX2_KERNELS);
+
+    KernelLevel current_level()
+    {
+        return (KernelLevel)std::min((int)supported_level(), kernel_limit.load(std::memory_order_relaxed));
+    }
+
+    template<typename Policy>
+    RowKernel make_row_kernel(const KernelLevel& level)
+    {
+#ifdef EXP_PAIRWISE_X86
+        if (AVX2_KERNELS <= level)
+            return { "avx2", fill_row_avx2<Policy>, mark_row_avx2<Policy> };
+        if (SSE41_KERNELS <= level)
+            return { "sse4.1", fill_row_sse41<Policy>, mark_row_sse41<Policy> };
+#endif
+        return { "scalar", fill_row_scalar<Policy>, mark_row_scalar<Policy> };
+    }
+
+    template<typename Policy>
+    AffineKernel make_affine_kernel(const KernelLevel& level)
+    {
+#ifdef EXP_PAIRWISE_X86
+        if (AVX2_KERNELS <= level)
+            return { "avx2", fill_affine_avx2<Policy>, mark_affine_avx2<Policy> };
+#endif
+        return { "scalar", fill_affine_scalar<Policy>, mark_affine_scalar<Policy> };
+    }
+
+    // The kernels of every level, only the ones up to supported_level() ever picked.
+    template<typename Policy>
+    const RowKernel& row_kernel_at(const KernelLevel& level)
+    {
+        static const std::array<RowKernel, 3> kernels = {
+            make_row_kernel<Policy>(SCALAR_KERNELS), make_row_kernel<Policy>(SSE41_KERNELS),
+            make_row_kernel<Policy>(AVX2_KERNELS) };
+        return kernels[level];
+    }
+
+    template<typename Policy>
+    const AffineKernel& affine_kernel_at(const KernelLevel& level)
+    {
+        static const std::array<AffineKernel, 3> kernels = {
+            make_affine_kernel<Policy>(SCALAR_KERNELS), make_affine_kernel<Policy>(SSE41_KERNELS),
+            make_affine_kernel<Policy>(AVX2_KERNELS) };
+        return kernels[level];
+    }
+
+    const RowKernel& row_kernel(const Scores& scores)
+    {
+        const KernelLevel level = current_level();
+        if (scores.is_default())
+            return row_kernel_at<FixedScores>(level);
+        return scores.matrix ? row_kernel_at<MatrixScores>(level) : row_kernel_at<RuntimeScores>(level);
+    }
+
+    const AffineKernel& affine_kernel(const Scores& scores)
+    {
+        const KernelLevel level = current_level();
+        return scores.matrix ? affine_kernel_at<MatrixScores>(level) : affine_kernel_at<RuntimeScores>(level);
+    }
+
+    // Adds the border moves left once the traceback reaches row or column 0 and puts ops in
+    // left-to-right order.
+    void finish_path(std::vector<EditOp>& ops, uint32_t i, uint32_t j)
+    {
+        while (j > 0)
+        {
+            ops.push_back(EditOp::TargetGap);
+            j--;
+        }
+        while (i > 0)
+        {
+            ops.push_back(EditOp::ProfileGap);
+            i--;
+        }
+        std::reverse(ops.begin(), ops.end());
+    }
+
+    std::vector<EditOp> align_linear(const std::string& profile, const std::string& target, const Scores& scores)
+    {
+        const RowKernel& kernel = row_kernel(scores);
+        QueryProfile query(scores, profile);
+        const auto n = (uint32_t)profile.size();
+        const auto m = (uint32_t)target.size();
+        const size_t width = n + 1;
+        const auto block = std::max<uint32_t>(1, (uint32_t)std::ceil(std::sqrt((double)m)));
+
+        // Score rows 0, block, 2 * block, ... are kept; everything else is recomputed on demand.
+        std::vector<int32_t> checkpoints((m / block + 1) * width);
+        std::vector<int32_t> rows(2 * width), diag(width);
+        for (uint32_t j = 0; j <= n; j++)
+            checkpoints[j] = scores.gap * (int32_t)j;
+
+        const int32_t* prev = checkpoints.data();
+        for (uint32_t i = 1; i <= m; i++)
+        {
+            int32_t* cur = (0 == i % block) ? &checkpoints[i / block * width] : &rows[(i & 1) * width];
+            kernel.fill(scores, query.row(target[i - 1]), prev, cur, diag.data(), profile.data(), n, target[i - 1],
+                            (int32_t)i);
+            prev = cur;
+        }
+
+        std::vector<EditOp> ops;
+        ops.reserve(n + m);
+        std::vector<int32_t> block_rows(block * width);
+        std::vector<uint8_t> dirs(block * width);
+
+        uint32_t i = m, j = n;
+        while (i > 0 && j > 0)
+        {
+            // Recompute the block of rows (first, i] from the checkpoint row below it.
+            const uint32_t first = (i - 1) / block * block;
+            prev = &checkpoints[first / block * width];
+            for (uint32_t r = first + 1; r <= i; r++)
+            {
+                int32_t* cur = &block_rows[(r - first - 1) * width];
+                kernel.fill(scores, query.row(target[r - 1]), prev, cur, diag.data(), profile.data(), n, target[r - 1],
+                                (int32_t)r);
+                kernel.mark(scores, cur, diag.data(), n, &dirs[(r - first - 1) * width]);
+                prev = cur;
+            }
+
+            while (i > first && j > 0)
+            {
+                switch (dirs[(i - first - 1) * width + j])
+                {
+                    case DIAGONAL:
+                        ops.push_back(EditOp::Match);
+                        i--;
+                        j--;
+                        break;
+                    case UP:
+                        ops.push_back(EditOp::TargetGap);
+                        j--;
+                        break;
+                    default:
+                        ops.push_back(EditOp::ProfileGap);
+                        i--;
+                        break;
+                }
+            }
+        }
+
+        finish_path(ops, i, j);
+        return ops;
+    }
+
+    // align_linear with h and f rows checkpointed, and a traceback that remembers which of h,
+    // the target gaps or the profile gaps the path is in, across blocks.
+    std::vector<EditOp> align_affine(const std::string& profile, const std::string& target, const Scores& scores)
+    {
+        const AffineKernel& kernel = affine_kernel(scores);
+        QueryProfile query(scores, profile);
+        const auto n = (uint32_t)profile.size();
+        const auto m = (uint32_t)target.size();
+        const size_t width = n + 1;
+        const auto block = std::max<uint32_t>(1, (uint32_t)std::ceil(std::sqrt((double)m)));
+
+        std::vector<int32_t> h_checkpoints((m / block + 1) * width), f_checkpoints((m / block + 1) * width);
+        std::vector<int32_t> h_rows(2 * width), f_rows(2 * width), c(width), diag(width);
+        f_checkpoints[0] = NEG_INF;
+        for (uint32_t j = 1; j <= n; j++)
+        {
+            h_checkpoints[j] = scores.gap_open + scores.gap * (int32_t)j;
+            f_checkpoints[j] = NEG_INF;
+        }
+
+        const int32_t* h_prev = h_checkpoints.data();
+        const int32_t* f_prev = f_checkpoints.data();
+        for (uint32_t i = 1; i <= m; i++)
+        {
+            const bool keep = 0 == i % block;
+            int32_t* h = keep ? &h_checkpoints[i / block * width] : &h_rows[(i & 1) * width];
+            int32_t* f = keep ? &f_checkpoints[i / block * width] : &f_rows[(i & 1) * width];
+            kernel.fill(scores, query.row(target[i - 1]), h_prev, f_prev, h, f, c.data(), diag.data(),
+                        profile.data(), n, target[i - 1], (int32_t)i);
+            h_prev = h;
+            f_prev = f;
+        }
+
+        std::vector<EditOp> ops;
+        ops.reserve(n + m);
+        std::vector<int32_t> block_h(block * width), block_f(block * width);
+        std::vector<uint8_t> moves(block * width);
+
+        // The SOURCE the path currently follows; FROM_DIAGONAL stands for h itself.
+        uint8_t state = FROM_DIAGONAL;
+        uint32_t i = m, j = n;
+        while (i > 0 && j > 0)
+        {
+            const uint32_t first = (i - 1) / block * block;
+            h_prev = &h_checkpoints[first / block * width];
+            f_prev = &f_checkpoints[first / block * width];
+            for (uint32_t r = first + 1; r <= i; r++)
+            {
+                int32_t* h = &block_h[(r - first - 1) * width];
+                int32_t* f = &block_f[(r - first - 1) * width];
+                kernel.fill(scores, query.row(target[r - 1]), h_prev, f_prev, h, f, c.data(), diag.data(),
+                            profile.data(), n, target[r - 1], (int32_t)r);
+                kernel.mark(scores, h_prev, h, f, c.data(), diag.data(), n, &moves[(r - first - 1) * width]);
+                h_prev = h;
+                f_prev = f;
+            }
+
+            while (i > first && j > 0)
+            {
+                const uint8_t move = moves[(i - first - 1) * width + j];
+                if (FROM_DIAGONAL == state)
+                    state = move & SOURCE;
+                switch (state)
+                {
+                    case FROM_DIAGONAL:
+                        ops.push_back(EditOp::Match);
+                        i--;
+                        j--;
+                        break;
+                    case FROM_TARGET_GAP:
+                        ops.push_back(EditOp::TargetGap);
+                        if (move & TARGET_GAP_OPENS)
+                            state = FROM_DIAGONAL;
+                        j--;
+                        break;
+                    default:
+                        ops.push_back(EditOp::ProfileGap);
+                        if (move & PROFILE_GAP_OPENS)
+                            state = FROM_DIAGONAL;
+                        i--;
+                        break;
+                }
+            }
+        }
+
+        finish_path(ops, i, j);
+        return ops;
+    }
+
+    // k-mers of this length give the divergence estimate of estimate_band: long enough that
+    // unrelated sequences share few of them, short enough to fit 2-bit codes in 32 bits.
+    constexpr uint32_t BAND_KMER = 12;
+    // Band half-width on top of the length difference even for identical sequences.
+    constexpr uint32_t MIN_BAND = 16;
+
+    // 2-bit codes of every window of BAND_KMER nucleotides, skipping windows with anything else.
+    std::vector<uint32_t> band_kmers(const std::string& sequence)
+    {
+        static constexpr uint32_t mask = (1u << (2 * BAND_KMER)) - 1;
+        std::vector<uint32_t> codes;
+        codes.reserve(sequence.size());
+        uint32_t code = 0, valid = 0;
+        for (const auto& c : sequence)
+        {
+            uint32_t symbol;
+            switch (c)
+            {
+                case 'A': symbol = 0; break;
+                case 'T': symbol = 1; break;
+                case 'C': symbol = 2; break;
+                case 'G': symbol = 3; break;
+                default: valid = 0; continue;
+            }
+            code = ((code << 2) | symbol) & mask;
+            if (++valid >= BAND_KMER)
+                codes.push_back(code);
+        }
+        return codes;
+    }
+
+    // Gotoh over the cells (i, j) with dmin <= j - i <= dmax, stored row by row at j - i - dmin.
+    // With gap_open = 0 the target gap state always reopens, so this is also the linear
+    // recurrence with the same traceback preferences. Returns false, leaving ops alone, when
+    // the path runs along the band edge, where a better one might leave the band.
+    bool align_band(const std::string& profile, const std::string& target, const Scores& scores,
+                    const int32_t& dmin, const int32_t& dmax, std::vector<EditOp>& ops)
+    {
+        const auto n = (int32_t)profile.size();
+        const auto m = (int32_t)target.size();
+        const int32_t width = dmax - dmin + 1;
+        const int32_t open = scores.gap_open + scores.gap;
+
+        // One spare cell per row, so (i - 1, j) of the last band cell reads NEG_INF.
+        const int32_t stride = width + 1;
+        std::vector<int32_t> h(2 * stride, NEG_INF), f(2 * stride, NEG_INF);
+        // Only cells inside the band are written, and only those are read back.
+        std::unique_ptr<uint8_t[]> moves(new uint8_t[(size_t)(m + 1) * width]);
+        for (int32_t j = 0; j <= std::min(n, dmax); j++)
+            h[j - dmin] = 0 == j ? 0 : scores.gap_open + scores.gap * j;
+
+        // Substitution scores of every character against each target character, built on first use.
+        std::vector<std::array<int32_t, 256>> tables;
+        std::array<int16_t, 256> table_of;
+        table_of.fill(-1);
+        for (int32_t i = 1; i <= m; i++)
+        {
+            const char t = target[i - 1];
+            if (table_of[(uint8_t)t] < 0)
+            {
+                table_of[(uint8_t)t] = (int16_t)tables.size();
+                tables.emplace_back();
+                for (uint32_t c = 0; c < 256; c++)
+                    tables.back()[c] = ('-' == t || '-' == (char)c) ? scores.gap : scores.substitution((char)c, t);
+            }
+            const auto& substitution = tables[table_of[(uint8_t)t]];
+
+            const int32_t* h_up = &h[((i - 1) & 1) * stride];
+            const int32_t* f_up = &f[((i - 1) & 1) * stride];
+            int32_t* hr = &h[(i & 1) * stride];
+            int32_t* fr = &f[(i & 1) * stride];
+            uint8_t* mr = &moves[(size_t)i * width];
+            std::fill(hr, hr + stride, NEG_INF);
+            std::fill(fr, fr + stride, NEG_INF);
+
+            // Row i - 1 holds (i - 1, j) at k + 1 and (i - 1, j - 1) at k.
+            int32_t j = std::max(0, i + dmin);
+            const int32_t hi = std::min(n, i + dmax);
+            int32_t left = NEG_INF, left_gap = NEG_INF;
+            if (0 == j)
+            {
+                left = hr[-i - dmin] = fr[-i - dmin] = scores.gap_open + scores.gap * i;
+                j++;
+            }
+            for (; j <= hi; j++)
+            {
+                const int32_t k = j - i - dmin;
+                const int32_t up = h_up[k + 1];
+                const int32_t d = h_up[k] + substitution[(uint8_t)profile[j - 1]];
+                const int32_t e = std::max(left_gap + scores.gap, left + open);
+                const int32_t fv = std::max(f_up[k + 1] + scores.gap, up + open);
+                const int32_t hv = std::max(d, std::max(e, fv));
+
+                uint8_t move = hv == d ? FROM_DIAGONAL : (hv == e ? FROM_TARGET_GAP : FROM_PROFILE_GAP);
+                move |= (e == left + open ? TARGET_GAP_OPENS : 0) | (fv == up + open ? PROFILE_GAP_OPENS : 0);
+                mr[k] = move;
+                hr[k] = left = hv;
+                fr[k] = fv;
+                left_gap = e;
+            }
+        }
+
+        std::vector<EditOp> path;
+        path.reserve(n + m);
+        uint8_t state = FROM_DIAGONAL;
+        int32_t i = m, j = n;
+        while (i > 0 && j > 0)
+        {
+            const int32_t k = j - i - dmin;
+            if (0 == k || width - 1 == k)
+                return false;
+            const uint8_t move = moves[(size_t)i * width + k];
+            if (FROM_DIAGONAL == state)
+                state = move & SOURCE;
+            switch (state)
+            {
+                case FROM_DIAGONAL:
+                    path.push_back(EditOp::Match);
+                    i--;
+                    j--;
+                    break;
+                case FROM_TARGET_GAP:
+                    path.push_back(EditOp::TargetGap);
+                    if (move & TARGET_GAP_OPENS)
+                        state = FROM_DIAGONAL;
+                    j--;
+                    break;
+                default:
+                    path.push_back(EditOp::ProfileGap);
+                    if (move & PROFILE_GAP_OPENS)
+                        state = FROM_DIAGONAL;
+                    i--;
+                    break;
+            }
+        }
+
+        finish_path(path, i, j);
+        ops.swap(path);
+        return true;
+    }
+}
+
+std::vector<EditOp> align_to_profile(const std::string& profile, const std::string& target, const Scores& scores)
+{
+    return scores.affine() ? align_affine(profile, target, scores) : align_linear(profile, target, scores);
+}
+
+uint32_t estimate_band(const std::string& profile, const std::string& target)
+{
+    const auto longest = (uint32_t)std::max(profile.size(), target.size());
+    const std::vector<uint32_t> reference = band_kmers(profile);
+    const std::vector<uint32_t> query = band_kmers(target);
+    if (reference.empty() || query.empty())
+        return longest;
+
+    // Open-addressing set of the profile k-mers at most half full; codes are below 2^24, so
+    // ~0u marks an empty slot.
+    uint32_t bits = 1;
+    while ((1u << bits) < 2 * reference.size())
+        bits++;
+    const uint32_t mask = (1u << bits) - 1;
+    std::vector<uint32_t> slots(mask + 1, ~0u);
+    auto slot = [&](const uint32_t& code)
+    {
+        uint32_t at = (code * 2654435761u) >> (32 - bits);
+        while (~0u != slots[at] && code != slots[at])
+            at = (at + 1) & mask;
+        return at;
+    };
+    for (const auto& code : reference)
+        slots[slot(code)] = code;
+    size_t shared = 0;
+    for (const auto& code : query)
+        shared += code == slots[slot(code)];
+
+    // A k-mer survives a per-base divergence p with probability (1 - p)^k; count every
+    // diverged base as a possible indel.
+    const double survived = (double)shared / (double)query.size();
+    const double divergence = 1. - std::pow(survived, 1. / BAND_KMER);
+    return std::min(longest, MIN_BAND + (uint32_t)std::ceil(divergence * longest));
+}
+
+std::vector<EditOp> align_banded(const std::string& profile, const std::string& target, const Scores& scores)
+{
+    return align_banded(profile, target, scores, estimate_band(profile, target));
+}
+
+std::vector<EditOp> align_banded(const std::string& profile, const std::string& target, const Scores& scores,
+                                 const uint32_t& band)
+{
+    const auto n = (int32_t)profile.size();
+    const auto m = (int32_t)target.size();
+    const auto half = (int32_t)std::min<uint32_t>(band, std::max(n, m));
+    const int32_t dmin = std::min(0, n - m) - half, dmax = std::max(0, n - m) + half;
+
+    // A band as wide as the profile saves nothing over the vectorized full matrix.
+    std::vector<EditOp> ops;
+    if (dmax - dmin >= n)
+        return align_to_profile(profile, target, scores);
+    if (align_band(profile, target, scores, dmin, dmax, ops))
+        return ops;
+    telemetry::count(telemetry::BAND_FALLBACKS);
+    return align_to_profile(profile, target, scores);
+}
+
+bool limit_pairwise_kernels(const std::string& name)
+{
+    KernelLevel level;
+    if ("avx2" == name)
+        level = AVX2_KERNELS;
+    else if ("sse4.1" == name)
+        level = SSE41_KERNELS;
+    else if ("scalar" == name)
+        level = SCALAR_KERNELS;
+    else
+        return false;
+    if (level > supported_level())
+        return false;
+    kernel_limit.store(level, std::memory_order_relaxed);
+    return true;
+}
+
+const char* pairwise_kernel_name()
+{
+    return row_kernel(Scores()).name;
+}
+
+const char* affine_kernel_name()
+{
+    return affine_kernel(Scores()).name;
+}
@@ -0,0 +1,60 @@
+//
+// Global alignment of a target sequence against a consensus profile, with linear or affine gaps.
+//
+
+#ifndef EXP_PAIRWISE_H
+#define EXP_PAIRWISE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "config.h"
+
+// One column of a profile/target alignment, in left-to-right order.
+// Match:      a profile column aligned with a target character
+// TargetGap:  a profile column aligned with '-' in the target
+// ProfileGap: a target character that opens a new gap column in the profile
+enum class EditOp : uint8_t
+{
+    Match,
+    TargetGap,
+    ProfileGap
+};
+
+// Needleman-Wunsch with scores, or Gotoh's three-state recurrence when scores.gap_open is set.
+// The traceback prefers diagonal, then target gap, then profile gap, so the result is the
+// same path a full score matrix traceback would take. Only O(n * sqrt(m)) cells are kept:
+// rows are checkpointed every sqrt(m) and each block is recomputed during the traceback.
+// The default scores run kernels with them built in, a substitution matrix kernels that read
+// a per-character query profile instead of comparing characters.
+std::vector<EditOp> align_to_profile(const std::string& profile, const std::string& target,
+                                     const Scores& scores = Scores());
+
+// Half-width of the diagonal band align_banded searches beyond the length difference: a
+// margin plus the number of bases the shared 12-mers of the two suggest have diverged. The
+// longer length when there are no 12-mers to compare.
+uint32_t estimate_band(const std::string& profile, const std::string& target);
+
+// align_to_profile over the O((n + m) * band) cells within estimate_band of the diagonals
+// from (0, 0) to (m, n), for closely related sequences. Falls back to align_to_profile when
+// the band is as wide as the profile or the path it finds touches the band edge.
+std::vector<EditOp> align_banded(const std::string& profile, const std::string& target,
+                                 const Scores& scores = Scores());
+// align_banded with a half-width of band instead of estimate_band's, e.g. to test the edges.
+std::vector<EditOp> align_banded(const std::string& profile, const std::string& target, const Scores& scores,
+                                 const uint32_t& band);
+
+// Keeps the kernels picked from then on to name ("avx2", "sse4.1" or "scalar") or below, so
+// tests and benchmarks can run every kernel on one CPU; there is no SSE4.1 affine kernel, so
+// "sse4.1" runs the scalar one there. False, changing nothing, for an unknown name or one
+// this CPU or build can not run.
+bool limit_pairwise_kernels(const std::string& name);
+
+// Name of the row kernel picked for this CPU, within limit_pairwise_kernels
+// ("avx2", "sse4.1" or "scalar").
+const char* pairwise_kernel_name();
+// Name of the affine row kernel picked for this CPU, within limit_pairwise_kernels
+// ("avx2" or "scalar").
+const char* affine_kernel_name();
+
+#endif //EXP_PAIRWISE_H
@@ -0,0 +1,132 @@
+//
+// Double buffering with an optional producer thread that fills one buffer while the caller
+// works on the other.
+//
+
+#ifndef EXP_PREFETCH_H
+#define EXP_PREFETCH_H
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Hands out two preallocated buffers in turn. fill runs with mutex held, the mutex guarding
+// whatever it reads, and returns false while there is nothing to fill from. Without a
+// thread, next() fills the buffer it returns. With one, next() returns the buffer the thread
+// filled during the caller's previous step and asks it for the other one, so each buffer is
+// filled from the state one step before the caller gets to use it. Writers that settle()
+// first keep that state exactly the one as of the request, whatever the thread's timing.
+template<typename T>
+class Prefetcher
+{
+public:
+    using Fill = std::function<bool(T&)>;
+
+    Prefetcher(std::mutex& mutex, std::array<T, 2> buffers, Fill fill, const bool& threaded);
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+    // Stops the thread, dropping a request it has not started on.
+    ~Prefetcher();
+
+    // The next filled buffer, nullptr if fill had nothing to fill it from. It stays the
+    // caller's until the following call. Call without mutex held, from one thread at a time.
+    T* next();
+    // Drops a buffer filled from state the caller has since replaced. Call with mutex held.
+    void discard();
+    // Waits for a fill the thread was asked for, so a change made after it can not race it.
+    // Call with mutex held through lock.
+    void settle(std::unique_lock<std::mutex>& lock);
+
+private:
+    enum State { IDLE, REQUESTED, READY };
+
+    void run();
+
+    std::mutex&                 _mutex;
+    std::array<T, 2>            _buffers;
+    Fill                        _fill;
+    // The caller's buffer; the thread fills the other one. Guarded by _mutex, as are the rest.
+    uint32_t                    _current;
+    State                       _state;
+    bool                        _stopping;
+    std::condition_variable     _wake, _done;
+    std::thread                 _thread;
+};
+
+template<typename T>
+Prefetcher<T>::Prefetcher(std::mutex& mutex, std::array<T, 2> buffers, Fill fill, const bool& threaded) :
+        _mutex(mutex),
+        _buffers(std::move(buffers)),
+        _fill(std::move(fill)),
+        _current(0),
+        _state(IDLE),
+        _stopping(false)
+{
+    if (threaded)
+        _thread = std::thread(&Prefetcher::run, this);
+}
+
+template<typename T>
+Prefetcher<T>::~Prefetcher()
+{
+    if (!_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+    _thread.join();
+}
+
+template<typename T>
+T* Prefetcher<T>::next()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_thread.joinable())
+        return _fill(_buffers[_current]) ? &_buffers[_current] : nullptr;
+
+    _done.wait(lock, [this]() { return REQUESTED != _state; });
+    if (READY == _state)
+        _current ^= 1;
+    else if (!_fill(_buffers[_current]))
+        return nullptr;
+    // The caller is done with the other buffer now that it asks for a new one.
+    _state = REQUESTED;
+    lock.unlock();
+    _wake.notify_one();
+    return &_buffers[_current];
+}
+
+template<typename T>
+void Prefetcher<T>::discard()
+{
+    if (READY == _state)
+        _state = IDLE;
+}
+
+template<typename T>
+void Prefetcher<T>::settle(std::unique_lock<std::mutex>& lock)
+{
+    _done.wait(lock, [this]() { return REQUESTED != _state; });
+}
+
+template<typename T>
+void Prefetcher<T>::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _wake.wait(lock, [this]() { return REQUESTED == _state || _stopping; });
+        if (_stopping)
+            return;
+        _state = _fill(_buffers[_current ^ 1]) ? READY : IDLE;
+        _done.notify_all();
+    }
+}
+
+#endif //EXP_PREFETCH_H
@@ -0,0 +1,186 @@
+#include "profile.h"
+#include "utils.h"
+#include "scoring.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+    constexpr std::array<char, 4> nucleotide = {'A', 'T', 'C', 'G'};
+
+    const std::array<ColumnProfile::Symbol, 256>& symbol_table()
+    {
+        static const std::array<ColumnProfile::Symbol, 256> table = []()
+        {
+            std::array<ColumnProfile::Symbol, 256> t{};
+            t.fill(ColumnProfile::OTHER);
+            t['A'] = ColumnProfile::A;
+            t['T'] = ColumnProfile::T;
+            t['C'] = ColumnProfile::C;
+            t['G'] = ColumnProfile::G;
+            t['-'] = ColumnProfile::GAP;
+            return t;
+        }();
+        return table;
+    }
+}
+
+ColumnProfile::Symbol ColumnProfile::symbol(const char& c)
+{
+    return symbol_table()[(uint8_t)c];
+}
+
+void ColumnProfile::append(const std::string& row)
+{
+    if (0 == _rows)
+    {
+        _columns.assign(row.size(), Column{});
+        _joins.assign(row.size(), 0);
+    }
+    assert(row.size() == _columns.size());
+
+    const auto& table = symbol_table();
+    for (size_t i = 0; i < row.size(); i++)
+    {
+        const Symbol s = table[(uint8_t)row[i]];
+        _columns[i][s]++;
+        if (s < GAP)
+            _totals[s]++;
+        else if (GAP == s)
+        {
+            if (i > 0 && '-' == row[i - 1])
+                _joins[i]++;
+            else
+                _gap_runs++;
+        }
+        else if (OTHER == s)
+        {
+            if (_other.empty())
+                _other.resize(_columns.size());
+            _other[i].push_back(row[i]);
+        }
+    }
+    _rows++;
+}
+
+void ColumnProfile::insert_gap_columns(const std::vector<EditOp>& ops)
+{
+    Column gap_column{};
+    gap_column[GAP] = (int32_t)_rows;
+
+    const auto rows = (int32_t)_rows;
+    std::vector<Column> widened;
+    std::vector<int32_t> joins;
+    widened.reserve(ops.size());
+    joins.reserve(ops.size());
+    // Gaps of the old column left of the current run of new ones, -1 at the start.
+    int32_t before = -1;
+    bool inserting = false;
+    size_t c = 0;
+    for (const auto& op : ops)
+    {
+        if (EditOp::ProfileGap == op)
+        {
+            joins.push_back(inserting ? rows : std::max(before, 0));
+            widened.push_back(gap_column);
+            inserting = true;
+            continue;
+        }
+
+        const int32_t gaps = _columns[c][GAP];
+        if (inserting)
+        {
+            // Every row without a gap on either side of the new columns gets a new run.
+            const int32_t either = before < 0 ? gaps : before + gaps - _joins[c];
+            _gap_runs += rows - either;
+            joins.push_back(gaps);
+        }
+        else
+            joins.push_back(_joins[c]);
+        widened.push_back(_columns[c++]);
+        before = gaps;
+        inserting = false;
+    }
+    if (inserting)
+        _gap_runs += rows - std::max(before, 0);
+    _columns.swap(widened);
+    _joins.swap(joins);
+
+    if (!_other.empty())
+    {
+        std::vector<std::string> other;
+        other.reserve(ops.size());
+        auto o = _other.begin();
+        for (const auto& op : ops)
+            other.emplace_back(EditOp::ProfileGap == op ? std::string() : std::move(*o++));
+        _other.swap(other);
+    }
+}
+
+void ColumnProfile::clear()
+{
+    _columns.clear();
+    _other.clear();
+    _joins.clear();
+    _totals.fill(0);
+    _gap_runs = 0;
+    _rows = 0;
+}
+
+std::string ColumnProfile::consensus() const
+{
+    std::string res;
+    res.reserve(_columns.size());
+    std::array<int64_t, 4> weight{};
+    for (const auto& column : _columns)
+    {
+        for (int j = 0; j < 4; j++)
+            weight[j] = (int64_t)column[j] * column[j] * _totals[j];
+        res.push_back(nucleotide[argmax(weight.begin(), weight.end())]);
+    }
+    return res;
+}
+
+const ColumnProfile::Column& ColumnProfile::operator[](const size_t& column) const
+{
+    return _columns[column];
+}
+
+int32_t ColumnProfile::count(const size_t& column, const char& c) const
+{
+    const Symbol s = symbol(c);
+    if (OTHER != s)
+        return _columns[column][s];
+    if (_other.empty())
+        return 0;
+    return (int32_t)std::count(_other[column].begin(), _other[column].end(), c);
+}
+
+int32_t ColumnProfile::other_pairs(const size_t& column) const
+{
+    if (_other.empty() || _other[column].size() < 2)
+        return 0;
+    return identical_pairs(_other[column]);
+}
+
+const std::string& ColumnProfile::others(const size_t& column) const
+{
+    static const std::string none;
+    return _other.empty() ? none : _other[column];
+}
+
+int64_t ColumnProfile::gap_runs() const
+{
+    return _gap_runs;
+}
+
+size_t ColumnProfile::size() const
+{
+    return _columns.size();
+}
+
+uint32_t ColumnProfile::rows() const
+{
+    return _rows;
+}
@@ -0,0 +1,65 @@
+//
+// Per-column symbol counts of the rows aligned so far, kept up to date as rows are added.
+//
+
+#ifndef EXP_PROFILE_H
+#define EXP_PROFILE_H
+
+#include <array>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "pairwise.h"
+
+class ColumnProfile
+{
+public:
+    // Count slots of a column. Anything that is not a nucleotide or '-' lands in OTHER.
+    enum Symbol : uint8_t
+    {
+        A = 0,
+        T = 1,
+        C = 2,
+        G = 3,
+        GAP = 4,
+        OTHER = 5
+    };
+    using Column = std::array<int32_t, 6>;
+
+    static Symbol symbol(const char& c);
+
+    // Adds an aligned row; the first row sets the number of columns.
+    void append(const std::string& row);
+    // Opens an all-gap column for every EditOp::ProfileGap in ops, in one pass.
+    void insert_gap_columns(const std::vector<EditOp>& ops);
+    void clear();
+
+    // Per column, the nucleotide maximising count^2 * (its total over all columns),
+    // ties going to A, T, C, G in that order.
+    [[nodiscard]] std::string consensus() const;
+
+    [[nodiscard]] const Column& operator[](const size_t& column) const;
+    // Rows holding exactly c in the column, for any c including symbols counted as OTHER.
+    [[nodiscard]] int32_t count(const size_t& column, const char& c) const;
+    // Pairs of rows holding the same OTHER symbol in the column.
+    [[nodiscard]] int32_t other_pairs(const size_t& column) const;
+    // The OTHER symbols of the column, in no particular order.
+    [[nodiscard]] const std::string& others(const size_t& column) const;
+    // Runs of consecutive gaps over all rows, which the affine scores charge gap_open for.
+    [[nodiscard]] int64_t gap_runs() const;
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] uint32_t rows() const;
+
+private:
+    std::vector<Column>         _columns;
+    // The OTHER symbols of each column, only allocated once the first one shows up.
+    std::vector<std::string>    _other;
+    // Rows with a gap both in the column and in the one before it.
+    std::vector<int32_t>        _joins;
+    std::array<int64_t, 4>      _totals{};
+    int64_t                     _gap_runs = 0;
+    uint32_t                    _rows = 0;
+};
+
+#endif //EXP_PROFILE_H
@@ -0,0 +1,375 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    constexpr char REPLAY_MAGIC[8] = { 'E', 'X', 'P', 'R', 'P', 'L', 'A', 'Y' };
+    constexpr uint32_t REPLAY_VERSION = 1;
+
+    struct ReplayHeader
+    {
+        char        magic[8];
+        uint32_t    version, capacity, seq_num, size;
+        uint64_t    pushed;
+        uint64_t    prioritized;
+        double      max_priority;
+    };
+    static_assert(48 == sizeof(ReplayHeader), "ReplayHeader must not be padded");
+
+    // Slots per ReplayChunk: a push after a snapshot copies one chunk, 2 * CHUNK_SLOTS * seq_num
+    // states and the rest, so this bounds the stall while keeping snapshots a few pointers.
+    constexpr uint32_t CHUNK_SLOTS = 256;
+
+    template<typename T>
+    void write_array(std::ostream& out, const T* data, const size_t& count)
+    {
+        out.write((const char*)data, (std::streamsize)(count * sizeof(T)));
+    }
+
+    // Copies count Ts from data + offset, and advances offset past them.
+    template<typename T>
+    void read_array(const char* data, size_t& offset, T* into, const size_t& count)
+    {
+        memcpy((void*)into, data + offset, count * sizeof(T));
+        offset += count * sizeof(T);
+    }
+}
+
+SumTree::SumTree(const uint32_t& capacity) :
+        _leaves(1),
+        _nodes()
+{
+    while (_leaves < capacity)
+        _leaves <<= 1;
+    _nodes.assign(2 * (size_t)_leaves, 0.);
+}
+
+void SumTree::update(const uint32_t& slot, const double& priority)
+{
+    size_t node = _leaves + slot;
+    _nodes[node] = priority;
+    for (node >>= 1; node > 0; node >>= 1)
+        _nodes[node] = _nodes[2 * node] + _nodes[2 * node + 1];
+}
+
+uint32_t SumTree::find(double prefix) const
+{
+    size_t node = 1;
+    while (node < _leaves)
+    {
+        node <<= 1;
+        if (prefix >= _nodes[node])
+        {
+            prefix -= _nodes[node];
+            node++;
+        }
+    }
+    return (uint32_t)(node - _leaves);
+}
+
+double SumTree::get(const uint32_t& slot) const
+{
+    return _nodes[_leaves + slot];
+}
+
+double SumTree::total() const
+{
+    return _nodes[1];
+}
+
+void SumTree::assign(const double* leaves, const uint32_t& count)
+{
+    std::fill(_nodes.begin(), _nodes.end(), 0.);
+    std::copy_n(leaves, count, _nodes.begin() + _leaves);
+    for (size_t node = _leaves - 1; node > 0; node--)
+        _nodes[node] = _nodes[2 * node] + _nodes[2 * node + 1];
+}
+
+struct ReplayChunk
+{
+    std::vector<state_type>     states, next_states;    // slots x seq_num, row-major
+    std::vector<int64_t>        actions;
+    std::vector<float>          rewards;
+    std::vector<int32_t>        dones;
+    std::vector<uint8_t>        demonstrations;
+    std::vector<double>         priorities;             // empty without prioritized replay
+    uint64_t                    snapshots;              // ReplayMemory::_snapshots when last copied
+
+    ReplayChunk(const uint32_t& slots, const uint32_t& seq_num, const bool& prioritized) :
+            states((size_t)slots * seq_num),
+            next_states((size_t)slots * seq_num),
+            actions(slots),
+            rewards(slots),
+            dones(slots),
+            demonstrations(slots),
+            priorities(prioritized ? slots : 0),
+            snapshots(0)
+    {
+
+    }
+};
+
+void ReplaySnapshot::save(std::ostream& out) const
+{
+    ReplayHeader header{};
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+    header.version = REPLAY_VERSION;
+    header.capacity = _capacity;
+    header.seq_num = _seq_num;
+    header.size = _size;
+    header.pushed = _pushed;
+    header.prioritized = _prioritized;
+    header.max_priority = _max_priority;
+    write_array(out, &header, 1);
+
+    // The filled slots are always the first _size ones; each field is written across the
+    // chunks before the next one.
+    auto write_field = [&](auto field, const size_t& width)
+    {
+        for (uint32_t first = 0; first < _size; first += CHUNK_SLOTS)
+            write_array(out, ((*_chunks[first / CHUNK_SLOTS]).*field).data(),
+                        std::min(CHUNK_SLOTS, _size - first) * width);
+    };
+    write_field(&ReplayChunk::states, _seq_num);
+    write_field(&ReplayChunk::next_states, _seq_num);
+    write_field(&ReplayChunk::actions, 1);
+    write_field(&ReplayChunk::rewards, 1);
+    write_field(&ReplayChunk::dones, 1);
+    write_field(&ReplayChunk::demonstrations, 1);
+    if (_prioritized)
+        write_field(&ReplayChunk::priorities, 1);
+}
+
+uint32_t ReplaySnapshot::size() const
+{
+    return _size;
+}
+
+ReplayMemory::ReplayMemory(const uint32_t& capacity, const uint32_t& seq_num, const bool& prioritized,
+                           const float& priority_alpha, const float& priority_epsilon) :
+        _capacity(capacity),
+        _seq_num(seq_num),
+        _size(0),
+        _pushed(0),
+        _chunks(),
+        _snapshots(0),
+        _picked(capacity, false),
+        _prioritized(prioritized),
+        _priority_alpha(priority_alpha),
+        _priority_epsilon(priority_epsilon),
+        _priorities(prioritized ? capacity : 1),
+        _max_priority(1.)
+{
+    for (uint32_t first = 0; first < capacity; first += CHUNK_SLOTS)
+        _chunks.push_back(std::make_shared<ReplayChunk>(std::min(CHUNK_SLOTS, capacity - first), seq_num, prioritized));
+}
+
+void ReplayMemory::push(const std::vector<state_type>& state, const int64_t& action,
+                        const std::vector<state_type>& next_state, const float& reward, const int32_t& done,
+                        const bool& demonstration)
+{
+    const auto slot = (uint32_t)(_pushed++ % _capacity);
+    auto& chunk = writable(slot);
+    const uint32_t i = slot % CHUNK_SLOTS;
+    std::copy(state.begin(), state.end(), chunk.states.begin() + (size_t)i * _seq_num);
+    std::copy(next_state.begin(), next_state.end(), chunk.next_states.begin() + (size_t)i * _seq_num);
+    chunk.actions[i] = action;
+    chunk.rewards[i] = reward;
+    chunk.dones[i] = done;
+    chunk.demonstrations[i] = demonstration;
+    // New transitions get the highest priority so far, so each is replayed at least once soon.
+    if (_prioritized)
+    {
+        chunk.priorities[i] = _max_priority;
+        _priorities.update(slot, _max_priority);
+    }
+    _size = std::min(_size + 1, _capacity);
+}
+
+uint32_t ReplayMemory::size() const
+{
+    return _size;
+}
+
+ReplayMemory::Batch ReplayMemory::make_batch(const uint32_t& batch_size) const
+{
+    // Page-locked staging only helps when the batch is later copied to a GPU.
+    auto options = torch::TensorOptions().pinned_memory(torch::cuda::is_available());
+    return {
+        torch::empty({ batch_size, _seq_num }, options.dtype(torch::kFloat32)),
+        torch::empty({ batch_size, 1 }, options.dtype(torch::kInt64)),
+        torch::empty({ batch_size, _seq_num }, options.dtype(torch::kFloat32)),
+        torch::empty({ batch_size, _seq_num }, options.dtype(torch::kBool)),
+        torch::empty({ batch_size, 1 }, options.dtype(torch::kFloat32)),
+        torch::empty({ batch_size, 1 }, options.dtype(torch::kFloat32)),
+        torch::ones({ batch_size, 1 }, options.dtype(torch::kFloat32)),
+        torch::zeros({ batch_size, 1 }, options.dtype(torch::kFloat32)),
+        std::vector<uint32_t>(batch_size)
+    };
+}
+
+void ReplayMemory::sample(Batch& batch, std::default_random_engine& rand, const double& beta)
+{
+    const auto batch_size = (uint32_t)batch.states.size(0);
+    assert(batch_size <= _size);
+
+    if (_prioritized)
+    {
+        auto* weights = batch.weights.data_ptr<float>();
+        const double segment = _priorities.total() / batch_size;
+        std::uniform_real_distribution<double> offset(0., 1.);
+        float max_weight = 0.f;
+        for (uint32_t i = 0; i < batch_size; i++)
+        {
+            const uint32_t t = std::min(_priorities.find((i + offset(rand)) * segment), _size - 1);
+            const double probability = _priorities.get(t) / _priorities.total();
+            batch.slots[i] = t;
+            weights[i] = (float)std::pow(_size * probability, -beta);
+            max_weight = std::max(max_weight, weights[i]);
+        }
+        for (uint32_t i = 0; i < batch_size; i++)
+            weights[i] /= max_weight;
+    }
+    else
+    {
+        for (uint32_t i = 0, j = _size - batch_size; j < _size; i++, j++)
+        {
+            auto t = std::uniform_int_distribution<uint32_t>(0, j)(rand);
+            if (_picked[t])
+                t = j;
+            _picked[t] = true;
+            batch.slots[i] = t;
+        }
+        for (const auto& t : batch.slots)
+            _picked[t] = false;
+    }
+
+    auto* states = batch.states.data_ptr<float>();
+    auto* actions = batch.actions.data_ptr<int64_t>();
+    auto* next_states = batch.next_states.data_ptr<float>();
+    auto* next_taken = batch.next_taken.data_ptr<bool>();
+    auto* rewards = batch.rewards.data_ptr<float>();
+    auto* dones = batch.dones.data_ptr<float>();
+    auto* demonstrations = batch.demonstrations.data_ptr<float>();
+    for (uint32_t i = 0; i < batch_size; i++)
+    {
+        const ReplayChunk& chunk = *_chunks[batch.slots[i] / CHUNK_SLOTS];
+        const uint32_t t = batch.slots[i] % CHUNK_SLOTS;
+        const state_type* next_state = &chunk.next_states[(size_t)t * _seq_num];
+        std::copy_n(&chunk.states[(size_t)t * _seq_num], _seq_num, states + (size_t)i * _seq_num);
+        std::copy_n(next_state, _seq_num, next_states + (size_t)i * _seq_num);
+        bool* taken = next_taken + (size_t)i * _seq_num;
+        std::fill_n(taken, _seq_num, false);
+        for (uint32_t k = 0; k < _seq_num && next_state[k] >= 0; k++)
+            taken[next_state[k]] = true;
+        actions[i] = chunk.actions[t];
+        rewards[i] = chunk.rewards[t];
+        dones[i] = (float)chunk.dones[t];
+        demonstrations[i] = (float)chunk.demonstrations[t];
+    }
+}
+
+void ReplayMemory::update_priorities(const std::vector<uint32_t>& slots, const std::vector<float>& td_errors)
+{
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        const double priority = std::pow(std::abs(td_errors[i]) + _priority_epsilon, _priority_alpha);
+        writable(slots[i]).priorities[slots[i] % CHUNK_SLOTS] = priority;
+        _priorities.update(slots[i], priority);
+        _max_priority = std::max(_max_priority, priority);
+    }
+}
+
+bool ReplayMemory::prioritized() const
+{
+    return _prioritized;
+}
+
+void ReplayMemory::save(std::ostream& out) const
+{
+    view().save(out);
+}
+
+ReplaySnapshot ReplayMemory::snapshot()
+{
+    ReplaySnapshot res = view();
+    _snapshots++;
+    return res;
+}
+
+void ReplayMemory::load(const char* data, const size_t& size)
+{
+    ReplayHeader header{};
+    size_t offset = 0;
+    if (size < sizeof(header))
+        throw std::runtime_error("Truncated replay memory image");
+    read_array(data, offset, &header, 1);
+    if (0 != memcmp(header.magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)))
+        throw std::runtime_error("Not a replay memory image");
+    if (REPLAY_VERSION != header.version)
+        throw std::runtime_error("Unsupported replay memory image version " + std::to_string(header.version));
+    if (_capacity != header.capacity || _seq_num != header.seq_num || _prioritized != (bool)header.prioritized
+        || header.size > _capacity)
+        throw std::runtime_error("The replay memory image does not match replay_memory_size, the sequences "
+                                 "or prioritized_replay");
+
+    // Checked up front, so a bad image leaves the memory as it was.
+    const size_t rows = (size_t)header.size * _seq_num;
+    const size_t slot_bytes = sizeof(int64_t) + sizeof(float) + sizeof(int32_t) + sizeof(uint8_t)
+                              + (_prioritized ? sizeof(double) : 0);
+    if (size - offset < 2 * rows * sizeof(state_type) + header.size * slot_bytes)
+        throw std::runtime_error("Truncated replay memory image");
+
+    auto read_field = [&](auto field, const size_t& width)
+    {
+        for (uint32_t first = 0; first < header.size; first += CHUNK_SLOTS)
+            read_array(data, offset, (writable(first).*field).data(),
+                       std::min(CHUNK_SLOTS, header.size - first) * width);
+    };
+    read_field(&ReplayChunk::states, _seq_num);
+    read_field(&ReplayChunk::next_states, _seq_num);
+    read_field(&ReplayChunk::actions, 1);
+    read_field(&ReplayChunk::rewards, 1);
+    read_field(&ReplayChunk::dones, 1);
+    read_field(&ReplayChunk::demonstrations, 1);
+    if (_prioritized)
+    {
+        read_field(&ReplayChunk::priorities, 1);
+        std::vector<double> priorities(header.size);
+        for (uint32_t slot = 0; slot < header.size; slot++)
+            priorities[slot] = _chunks[slot / CHUNK_SLOTS]->priorities[slot % CHUNK_SLOTS];
+        _priorities.assign(priorities.data(), header.size);
+    }
+    _size = header.size;
+    _pushed = header.pushed;
+    _max_priority = header.max_priority;
+}
+
+ReplayChunk& ReplayMemory::writable(const uint32_t& slot)
+{
+    auto& chunk = _chunks[slot / CHUNK_SLOTS];
+    if (chunk->snapshots != _snapshots)
+    {
+        chunk = std::make_shared<ReplayChunk>(*chunk);
+        chunk->snapshots = _snapshots;
+    }
+    return *chunk;
+}
+
+ReplaySnapshot ReplayMemory::view() const
+{
+    ReplaySnapshot res;
+    res._capacity = _capacity;
+    res._seq_num = _seq_num;
+    res._size = _size;
+    res._pushed = _pushed;
+    res._prioritized = _prioritized;
+    res._max_priority = _max_priority;
+    res._chunks.assign(_chunks.begin(), _chunks.end());
+    return res;
+}
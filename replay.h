@@ -0,0 +1,136 @@
+//
+// Fixed-capacity replay memory laid out as one array per transition field in each chunk of slots.
+//
+
+#ifndef EXP_REPLAY_H
+#define EXP_REPLAY_H
+
+#include <memory>
+#include <ostream>
+#include <random>
+#include <vector>
+#include "torch/torch.h"
+#include "utils.h"
+
+// Binary tree over per-slot priorities where each node holds the sum of its children,
+// so updating a priority and finding the slot owning a prefix sum are both O(log n).
+class SumTree
+{
+public:
+    explicit SumTree(const uint32_t& capacity);
+
+    // Recomputes the ancestors from their children rather than adding the change, so the
+    // sums are a function of the leaves alone, bit for bit what assign() gives for them.
+    void update(const uint32_t& slot, const double& priority);
+    // Slot whose cumulative priority range contains prefix, for prefix in [0, total()).
+    [[nodiscard]] uint32_t find(double prefix) const;
+    [[nodiscard]] double get(const uint32_t& slot) const;
+    [[nodiscard]] double total() const;
+    // Sets the first count leaves, zeroes the rest and recomputes the sums in O(n).
+    void assign(const double* leaves, const uint32_t& count);
+
+private:
+    uint32_t                _leaves;
+    std::vector<double>     _nodes;     // _nodes[1] is the root, leaves start at _leaves
+};
+
+// Consecutive slots of a ReplayMemory, one array per transition field.
+struct ReplayChunk;
+
+// The filled slots of a ReplayMemory as they were when it was taken. It shares the memory's
+// chunks, which the memory copies before it next writes to them, so taking one costs a
+// pointer per chunk and the memory can go on while it is saved.
+class ReplaySnapshot
+{
+public:
+    // The image ReplayMemory::save() wrote at the time.
+    void save(std::ostream& out) const;
+    [[nodiscard]] uint32_t size() const;
+
+private:
+    friend class ReplayMemory;
+
+    uint32_t                                    _capacity = 0, _seq_num = 0, _size = 0;
+    uint64_t                                    _pushed = 0;
+    bool                                        _prioritized = false;
+    double                                      _max_priority = 1.;
+    std::vector<std::shared_ptr<const ReplayChunk>> _chunks;
+};
+
+class ReplayMemory
+{
+public:
+    // Preallocated batch tensors, refilled in place by sample().
+    struct Batch
+    {
+        torch::Tensor states;       // {batch, seq_num} float
+        torch::Tensor actions;      // {batch, 1} int64
+        torch::Tensor next_states;  // {batch, seq_num} float
+        torch::Tensor next_taken;   // {batch, seq_num} bool, actions already taken in next_states
+        torch::Tensor rewards;      // {batch, 1} float
+        torch::Tensor dones;        // {batch, 1} float
+        torch::Tensor weights;      // {batch, 1} float, importance-sampling weights
+        torch::Tensor demonstrations;   // {batch, 1} float, 1 for demonstration transitions
+        std::vector<uint32_t> slots;
+    };
+
+    // With prioritized set, sampling is proportional to priority^priority_alpha instead of
+    // uniform, with priority |TD error| + priority_epsilon.
+    ReplayMemory(const uint32_t& capacity, const uint32_t& seq_num, const bool& prioritized = false,
+                 const float& priority_alpha = config::priority_alpha,
+                 const float& priority_epsilon = config::priority_epsilon);
+    // Copies would share chunks without copying them on write; take a snapshot() instead.
+    ReplayMemory(const ReplayMemory&) = delete;
+    ReplayMemory& operator=(const ReplayMemory&) = delete;
+    ReplayMemory(ReplayMemory&&) = default;
+    ReplayMemory& operator=(ReplayMemory&&) = default;
+
+    // Overwrites the oldest transition once the memory is full.
+    void push(const std::vector<state_type>& state, const int64_t& action,
+              const std::vector<state_type>& next_state, const float& reward, const int32_t& done,
+              const bool& demonstration = false);
+
+    [[nodiscard]] uint32_t size() const;
+
+    [[nodiscard]] Batch make_batch(const uint32_t& batch_size) const;
+    // Draws batch.states.size(0) transitions and writes them straight into the batch
+    // tensors. Uniform mode picks distinct transitions in O(batch) with Floyd's algorithm,
+    // and all weights are 1. Prioritized mode draws one transition per equal slice of the
+    // total priority and weights it by (size * P(i))^-beta, normalized to a maximum of 1.
+    void sample(Batch& batch, std::default_random_engine& rand, const double& beta = 1.);
+    // Sets the priorities of the last sampled slots from their absolute TD errors.
+    void update_priorities(const std::vector<uint32_t>& slots, const std::vector<float>& td_errors);
+
+    [[nodiscard]] bool prioritized() const;
+
+    // Binary image of the memory: a versioned header, then every field array over the
+    // size() filled slots, so load() is a few copies per chunk.
+    void save(std::ostream& out) const;
+    // The memory as it is now, for saving elsewhere without holding up push(). Each chunk
+    // written after it is copied once first.
+    [[nodiscard]] ReplaySnapshot snapshot();
+    // Restores a save() image, e.g. straight from a mapped file. Throws std::runtime_error
+    // if it is truncated, of another version, or saved with another capacity or seq_num.
+    void load(const char* data, const size_t& size);
+
+private:
+    // The chunk holding slot, copied first if a snapshot taken since it was last written
+    // may share it.
+    ReplayChunk& writable(const uint32_t& slot);
+    [[nodiscard]] ReplaySnapshot view() const;
+
+    uint32_t                    _capacity, _seq_num, _size;
+    uint64_t                    _pushed;
+
+    std::vector<std::shared_ptr<ReplayChunk>> _chunks;
+    uint64_t                    _snapshots;
+
+    std::vector<bool>           _picked;
+
+    bool                        _prioritized;
+    float                       _priority_alpha, _priority_epsilon;
+    SumTree                     _priorities;
+    double                      _max_priority;
+};
+
+#endif //EXP_REPLAY_H
@@ -0,0 +1,158 @@
+#include "rollout.h"
+#include "telemetry.h"
+
+Rollout::Rollout(const Environment& env, DQN& agent, const uint32_t& workers, const double& replay_ratio) :
+        _env(env),
+        _agent(agent),
+        _workers(std::max<uint32_t>(1, workers)),
+        _replay_ratio(replay_ratio),
+        _episodes(0),
+        _claimed(0),
+        _finished(0),
+        _updates(0),
+        _steps(0),
+        _running(0)
+{
+
+}
+
+Rollout::~Rollout()
+{
+    join();
+}
+
+void Rollout::start(const uint64_t& episodes)
+{
+    join();
+    _episodes = episodes;
+    _claimed = 0;
+    _finished = 0;
+    _updates = 0;
+    _steps = 0;
+    _running = _workers;
+
+    // The net is tiny; intra-op threads would only contend with the actors.
+    torch::set_num_threads(1);
+
+    for (uint32_t i = 0; i < _workers; i++)
+        _actors.emplace_back(&Rollout::act, this, i);
+    _learner = std::thread(&Rollout::learn, this);
+}
+
+void Rollout::join()
+{
+    for (auto& actor : _actors)
+        actor.join();
+    _actors.clear();
+    if (_learner.joinable())
+        _learner.join();
+}
+
+uint64_t Rollout::finished() const
+{
+    return _finished;
+}
+
+uint64_t Rollout::updates() const
+{
+    return _updates;
+}
+
+void Rollout::act(const uint32_t& worker)
+{
+    Environment env(_env);
+    InferenceNet net = _agent.inference();
+    std::default_random_engine rand((uint32_t)time(nullptr) + worker);
+    ActionSet available(_agent.seq_num());
+
+    while (_claimed++ < _episodes)
+    {
+        _agent.snapshot(net);
+        const double epsilon = _agent.epsilon();
+        available.reset();
+
+        auto state = env.reset();
+        while (true)
+        {
+            auto action = _agent.select(net, state, available, rand, epsilon);
+            auto [next_state, reward, done] = env.step(action);
+            _agent.push({ state, action, next_state, reward, done });
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _steps++;
+            }
+            _stepped.notify_one();
+            if (!done)
+            {
+                break;
+            }
+            state = std::move(next_state);
+        }
+        _agent.reset();
+        _finished++;
+        telemetry::count(telemetry::EPISODES);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running--;
+    }
+    _stepped.notify_one();
+}
+
+void Rollout::learn()
+{
+    // Only waits when it is replay_ratio updates per step ahead, e.g. at the start, so it
+    // does not retrain the first few transitions over and over.
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _stepped.wait(lock, [&]() { return _updates < _replay_ratio * (double)_steps || 0 == _running; });
+        if (0 == _running)
+            return;
+        lock.unlock();
+        _agent.update();
+        _updates++;
+        lock.lock();
+    }
+}
+
+void play_episode(Environment& env, DQN& agent)
+{
+    auto state = env.reset();
+    while (true)
+    {
+        auto action = agent.select(state);
+        auto [next_state, reward, done] = env.step(action);
+        agent.push({ state, action, next_state, reward, done });
+        agent.update();
+        if (!done)
+        {
+            break;
+        }
+        state = std::move(next_state);
+    }
+    agent.reset();
+    telemetry::count(telemetry::EPISODES);
+}
+
+int32_t warm_start(const Environment& env, DQN& agent, const std::vector<state_type>& order,
+                   const uint32_t& repeats)
+{
+    Environment demo(env);
+    auto state = demo.reset();
+    std::vector<Transition> episode;
+    for (const auto& action : order)
+    {
+        auto [next_state, reward, done] = demo.step(action);
+        episode.push_back({ state, action, next_state, reward, done });
+        state = std::move(next_state);
+    }
+
+    for (uint32_t r = 0; r < repeats; r++)
+    {
+        for (const auto& transition : episode)
+            agent.push(transition, true);
+    }
+    return demo.calc_sum_of_pairs();
+}
@@ -0,0 +1,68 @@
+//
+// Parallel rollouts: actor threads with their own Environment feed one DQN learner thread.
+//
+
+#ifndef EXP_ROLLOUT_H
+#define EXP_ROLLOUT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include "dqn.h"
+#include "environment.h"
+
+class Rollout
+{
+public:
+    // Every actor plays on its own copy of env, sharing its sequences and cache. The learner
+    // calls DQN::update() at most replay_ratio times per step the actors have taken.
+    Rollout(const Environment& env, DQN& agent, const uint32_t& workers, const double& replay_ratio);
+    Rollout(const Rollout&) = delete;
+    Rollout& operator=(const Rollout&) = delete;
+    ~Rollout();
+
+    // Plays `episodes` episodes across the workers while the learner updates alongside. The
+    // actors never wait for it: with more of them than it keeps up with, it falls below
+    // replay_ratio, and it stops with them rather than catching up. Returns immediately;
+    // see finished(), updates() and join().
+    void start(const uint64_t& episodes);
+    void join();
+
+    [[nodiscard]] uint64_t finished() const;
+    // DQN::update() calls the learner has made in this run.
+    [[nodiscard]] uint64_t updates() const;
+
+private:
+    void act(const uint32_t& worker);
+    void learn();
+
+    const Environment&                  _env;
+    DQN&                                _agent;
+    uint32_t                            _workers;
+    double                              _replay_ratio;
+    uint64_t                            _episodes;
+
+    std::vector<std::thread>            _actors;
+    std::thread                         _learner;
+    std::atomic<uint64_t>               _claimed, _finished, _updates;
+
+    // Steps the actors have taken and actors still playing, guarded by _mutex; _stepped
+    // wakes the learner when either changes.
+    std::mutex                          _mutex;
+    std::condition_variable             _stepped;
+    uint64_t                            _steps;
+    uint32_t                            _running;
+};
+
+// One serial select -> step -> push -> update episode on the calling thread.
+void play_episode(Environment& env, DQN& agent);
+
+// Plays order (e.g. a guide_order) on a copy of env and pushes the episode `repeats` times
+// as demonstrations. Returns the sum of pairs it reached.
+int32_t warm_start(const Environment& env, DQN& agent, const std::vector<state_type>& order,
+                   const uint32_t& repeats);
+
+#endif //EXP_ROLLOUT_H
@@ -0,0 +1,248 @@
+#include "scoring.h"
+#include "profile.h"
+
+#include <algorithm>
+#include <array>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(EXP_SCORING_NO_SIMD)
+#define EXP_SCORING_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Symbols with their own counter; OTHER is whatever is left of the rows.
+    constexpr uint32_t COUNTED = ColumnProfile::OTHER;
+    // Per-column byte counters are flushed to 32 bits before they can wrap.
+    constexpr uint32_t FLUSH_ROWS = 255;
+
+    // Adds one row of symbol codes to counts[s * n + j], one byte counter per symbol and column.
+    using CountRow = void (*)(const uint8_t* codes, uint32_t n, uint8_t* counts);
+
+    struct CountKernel
+    {
+        const char* name;
+        CountRow count;
+    };
+
+    void count_row_scalar(const uint8_t* codes, uint32_t n, uint8_t* counts)
+    {
+        for (uint32_t j = 0; j < n; j++)
+        {
+            if (codes[j] < COUNTED)
+                counts[codes[j] * n + j]++;
+        }
+    }
+
+#ifdef EXP_SCORING_X86
+    // A lane compares equal to -1, so subtracting the compare mask counts it.
+
+    __attribute__((target("sse2")))
+    void count_row_sse2(const uint8_t* codes, uint32_t n, uint8_t* counts)
+    {
+        uint32_t j = 0;
+        for (; j + 16 <= n; j += 16)
+        {
+            const __m128i c = _mm_loadu_si128((const __m128i*)(codes + j));
+            for (uint32_t s = 0; s < COUNTED; s++)
+            {
+                auto* dst = (__m128i*)(counts + s * n + j);
+                const __m128i eq = _mm_cmpeq_epi8(c, _mm_set1_epi8((char)s));
+                _mm_storeu_si128(dst, _mm_sub_epi8(_mm_loadu_si128(dst), eq));
+            }
+        }
+        for (; j < n; j++)
+        {
+            if (codes[j] < COUNTED)
+                counts[codes[j] * n + j]++;
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void count_row_avx2(const uint8_t* codes, uint32_t n, uint8_t* counts)
+    {
+        uint32_t j = 0;
+        for (; j + 32 <= n; j += 32)
+        {
+            const __m256i c = _mm256_loadu_si256((const __m256i*)(codes + j));
+            for (uint32_t s = 0; s < COUNTED; s++)
+            {
+                auto* dst = (__m256i*)(counts + s * n + j);
+                const __m256i eq = _mm256_cmpeq_epi8(c, _mm256_set1_epi8((char)s));
+                _mm256_storeu_si256(dst, _mm256_sub_epi8(_mm256_loadu_si256(dst), eq));
+            }
+        }
+        for (; j < n; j++)
+        {
+            if (codes[j] < COUNTED)
+                counts[codes[j] * n + j]++;
+        }
+    }
+#endif
+
+    const CountKernel& count_kernel()
+    {
+        static const CountKernel kernel = []() -> CountKernel
+        {
+#ifdef EXP_SCORING_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return { "avx2", count_row_avx2 };
+            if (__builtin_cpu_supports("sse2"))
+                return { "sse2", count_row_sse2 };
+#endif
+            return { "scalar", count_row_scalar };
+        }();
+        return kernel;
+    }
+
+    inline int64_t nucleotide_pairs(const int64_t& count)
+    {
+        return count * (count - 1) / 2;
+    }
+
+    // column_sum_of_pairs under a substitution matrix, from the A, T, C, G counts of the column
+    // and its OTHER symbols: every pair of residue kinds is looked up once.
+    int64_t matrix_column(const Scores& scores, const int64_t& rows, const int64_t& gaps,
+                          const std::array<int64_t, 4>& bases, std::string others)
+    {
+        static constexpr char nucleotide[] = {'A', 'T', 'C', 'G'};
+        std::vector<std::pair<char, int64_t>> kinds;
+        for (uint32_t s = 0; s < ColumnProfile::GAP; s++)
+        {
+            if (bases[s] > 0)
+                kinds.emplace_back(nucleotide[s], bases[s]);
+        }
+        std::sort(others.begin(), others.end());
+        for (auto run = others.begin(); run != others.end();)
+        {
+            auto end = std::find_if(run, others.end(), [&](const char& c) { return c != *run; });
+            kinds.emplace_back(*run, end - run);
+            run = end;
+        }
+
+        const SubstitutionMatrix& matrix = *scores.matrix;
+        const int64_t residues = rows - gaps;
+        int64_t score = scores.gap * (nucleotide_pairs(rows) - nucleotide_pairs(residues));
+        for (size_t a = 0; a < kinds.size(); a++)
+        {
+            score += nucleotide_pairs(kinds[a].second) * matrix(kinds[a].first, kinds[a].first);
+            for (size_t b = a + 1; b < kinds.size(); b++)
+                score += kinds[a].second * kinds[b].second * matrix(kinds[a].first, kinds[b].first);
+        }
+        return score;
+    }
+}
+
+int32_t identical_pairs(std::string symbols)
+{
+    std::sort(symbols.begin(), symbols.end());
+    int32_t pairs = 0;
+    for (auto run = symbols.begin(); run != symbols.end();)
+    {
+        auto end = std::find_if(run, symbols.end(), [&](const char& c) { return c != *run; });
+        pairs += (int32_t)nucleotide_pairs(end - run);
+        run = end;
+    }
+    return pairs;
+}
+
+int32_t sum_of_pairs(const ColumnProfile& profile, const Scores& scores)
+{
+    int64_t score = 0;
+    const int64_t rows = profile.rows();
+    for (size_t i = 0; i < profile.size(); i++)
+    {
+        const auto& column = profile[i];
+        if (scores.matrix)
+        {
+            const std::array<int64_t, 4> bases = { column[0], column[1], column[2], column[3] };
+            score += matrix_column(scores, rows, column[ColumnProfile::GAP], bases, profile.others(i));
+            continue;
+        }
+        int64_t matches = profile.other_pairs(i);
+        for (uint32_t s = 0; s < ColumnProfile::GAP; s++)
+            matches += nucleotide_pairs(column[s]);
+        score += column_sum_of_pairs(rows, column[ColumnProfile::GAP], matches, scores);
+    }
+    // Each run of gaps opens once against every other row.
+    score += scores.gap_open * (rows - 1) * profile.gap_runs();
+    return (int32_t)score;
+}
+
+int32_t sum_of_pairs(const std::vector<std::string>& rows, const Scores& scores)
+{
+    if (rows.empty())
+        return 0;
+
+    const CountKernel& kernel = count_kernel();
+    const auto n = (uint32_t)rows[0].size();
+    std::vector<uint8_t> codes(n), block(COUNTED * n, 0);
+    std::vector<int32_t> counts(COUNTED * n, 0);
+    std::vector<bool> has_other(n, false);
+
+    auto flush = [&]()
+    {
+        for (size_t k = 0; k < block.size(); k++)
+            counts[k] += block[k];
+        std::fill(block.begin(), block.end(), 0);
+    };
+
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        const std::string& row = rows[r];
+        for (uint32_t j = 0; j < n; j++)
+        {
+            codes[j] = ColumnProfile::symbol(row[j]);
+            if (ColumnProfile::OTHER == codes[j])
+                has_other[j] = true;
+        }
+        kernel.count(codes.data(), n, block.data());
+        if (0 == (r + 1) % FLUSH_ROWS)
+            flush();
+    }
+    flush();
+
+    int64_t score = 0;
+    const auto total = (int64_t)rows.size();
+    std::string other;
+    for (uint32_t j = 0; j < n; j++)
+    {
+        other.clear();
+        if (has_other[j])
+        {
+            for (const auto& row : rows)
+            {
+                if (ColumnProfile::OTHER == ColumnProfile::symbol(row[j]))
+                    other.push_back(row[j]);
+            }
+        }
+        if (scores.matrix)
+        {
+            const std::array<int64_t, 4> bases = { counts[j], counts[n + j], counts[2 * n + j], counts[3 * n + j] };
+            score += matrix_column(scores, total, counts[ColumnProfile::GAP * n + j], bases, other);
+            continue;
+        }
+        int64_t matches = identical_pairs(other);
+        for (uint32_t s = 0; s < ColumnProfile::GAP; s++)
+            matches += nucleotide_pairs(counts[s * n + j]);
+        score += column_sum_of_pairs(total, counts[ColumnProfile::GAP * n + j], matches, scores);
+    }
+
+    if (scores.affine())
+    {
+        int64_t runs = 0;
+        for (const auto& row : rows)
+        {
+            for (uint32_t j = 0; j < n; j++)
+                runs += '-' == row[j] && (0 == j || '-' != row[j - 1]);
+        }
+        score += scores.gap_open * (total - 1) * runs;
+    }
+    return (int32_t)score;
+}
+
+const char* scoring_kernel_name()
+{
+    return count_kernel().name;
+}
@@ -0,0 +1,44 @@
+//
+// Sum-of-pairs scoring from per-column symbol counts.
+//
+
+#ifndef EXP_SCORING_H
+#define EXP_SCORING_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "config.h"
+
+class ColumnProfile;
+
+// Score of all row pairs of one column holding `gaps` gaps out of `rows` symbols, of which
+// `matches` pairs are identical residues. A pair with a gap on either side scores scores.gap.
+// Match/mismatch only; the sum_of_pairs functions below also handle a substitution matrix.
+inline int64_t column_sum_of_pairs(const int64_t& rows, const int64_t& gaps, const int64_t& matches,
+                                   const Scores& scores = Scores())
+{
+    const int64_t residues = rows - gaps;
+    const int64_t residue_pairs = residues * (residues - 1) / 2;
+    return scores.gap * (rows * (rows - 1) / 2 - residue_pairs)
+           + scores.match * matches
+           + scores.mismatch * (residue_pairs - matches);
+}
+
+// Number of pairs of equal characters in symbols.
+int32_t identical_pairs(std::string symbols);
+
+// Both add gap_open once per run of gaps in a row and other row, see ColumnProfile::gap_runs.
+
+// O(columns) from a profile that already holds every row.
+int32_t sum_of_pairs(const ColumnProfile& profile, const Scores& scores = Scores());
+
+// O(rows * columns) for equal-length gapped rows: rows are reduced to 3-bit symbol codes, one
+// per byte, and counted per column with a vector compare/accumulate kernel.
+int32_t sum_of_pairs(const std::vector<std::string>& rows, const Scores& scores = Scores());
+
+// Name of the counting kernel picked for this CPU ("avx2", "sse2" or "scalar").
+const char* scoring_kernel_name();
+
+#endif //EXP_SCORING_H
@@ -0,0 +1,103 @@
+#include "substitution.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    // Bases each IUPAC code stands for, one bit each for A, C, G and T.
+    struct Code
+    {
+        char    symbol;
+        uint8_t bases;
+    };
+
+    constexpr Code iupac_codes[] = {
+            {'A', 0b0001}, {'C', 0b0010}, {'G', 0b0100}, {'T', 0b1000}, {'U', 0b1000},
+            {'R', 0b0101}, {'Y', 0b1010}, {'S', 0b0110}, {'W', 0b1001}, {'K', 0b1100},
+            {'M', 0b0011}, {'B', 0b1110}, {'D', 0b1101}, {'H', 0b1011}, {'V', 0b0111},
+            {'N', 0b1111}
+    };
+}
+
+SubstitutionMatrix::SubstitutionMatrix(std::string name, const int32_t& fill) :
+        _name(std::move(name))
+{
+    _scores.fill(fill);
+}
+
+void SubstitutionMatrix::set(const char& a, const char& b, const int32_t& score)
+{
+    for (const char x : { (char)std::toupper((uint8_t)a), (char)std::tolower((uint8_t)a) })
+        for (const char y : { (char)std::toupper((uint8_t)b), (char)std::tolower((uint8_t)b) })
+            _scores[(uint8_t)x * 256 + (uint8_t)y] = score;
+}
+
+std::shared_ptr<const SubstitutionMatrix> SubstitutionMatrix::iupac(const int32_t& match, const int32_t& mismatch)
+{
+    std::shared_ptr<SubstitutionMatrix> matrix(new SubstitutionMatrix("iupac", mismatch));
+    for (const auto& a : iupac_codes)
+    {
+        for (const auto& b : iupac_codes)
+        {
+            const double shared = __builtin_popcount(a.bases & b.bases);
+            const double f = shared / (__builtin_popcount(a.bases) * __builtin_popcount(b.bases));
+            matrix->set(a.symbol, b.symbol, (int32_t)std::lround(f * match + (1 - f) * mismatch));
+        }
+    }
+    return matrix;
+}
+
+std::shared_ptr<const SubstitutionMatrix> SubstitutionMatrix::load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+        throw std::runtime_error("Can not open the substitution matrix " + path);
+
+    std::vector<char> columns;
+    std::vector<std::pair<std::pair<char, char>, int32_t>> entries;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line.substr(0, line.find('#')));
+        std::string token;
+        if (!(in >> token))
+            continue;
+        if (columns.empty())
+        {
+            do
+                columns.push_back(token[0]);
+            while (in >> token);
+            continue;
+        }
+
+        const char row = token[0];
+        for (const char& column : columns)
+        {
+            int32_t score;
+            if (!(in >> score))
+                throw std::runtime_error(path + ": short row for " + std::string(1, row));
+            entries.push_back({ { row, column }, score });
+        }
+    }
+    if (entries.empty())
+        throw std::runtime_error(path + ": no scores");
+
+    int32_t lowest = entries.front().second;
+    for (const auto& e : entries)
+        lowest = std::min(lowest, e.second);
+    std::shared_ptr<SubstitutionMatrix> matrix(new SubstitutionMatrix(path, lowest));
+    for (const auto& e : entries)
+        matrix->set(e.first.first, e.first.second, e.second);
+    return matrix;
+}
+
+const std::string& SubstitutionMatrix::name() const
+{
+    return _name;
+}
@@ -0,0 +1,43 @@
+//
+// Residue substitution scores looked up per character pair.
+//
+
+#ifndef EXP_SUBSTITUTION_H
+#define EXP_SUBSTITUTION_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+class SubstitutionMatrix
+{
+public:
+    // IUPAC nucleotide codes scored by the chance that both stand for the same base: with f
+    // the fraction of base pairs the two codes share, round(f * match + (1 - f) * mismatch).
+    // Plain bases get match and mismatch, N against anything gets the average; characters
+    // that are not IUPAC codes get mismatch.
+    static std::shared_ptr<const SubstitutionMatrix> iupac(const int32_t& match, const int32_t& mismatch);
+    // A matrix in the NCBI text format BLOSUM62 is distributed in: '#' comment lines, a header
+    // row of residue characters, then one row per character. Lookups are case-insensitive
+    // and pairs the file does not list get its lowest score.
+    static std::shared_ptr<const SubstitutionMatrix> load(const std::string& path);
+
+    [[nodiscard]] int32_t operator()(const char& a, const char& b) const
+    {
+        return _scores[(uint8_t)a * 256 + (uint8_t)b];
+    }
+
+    // "iupac" or the path the matrix was loaded from.
+    [[nodiscard]] const std::string& name() const;
+
+private:
+    explicit SubstitutionMatrix(std::string name, const int32_t& fill);
+
+    void set(const char& a, const char& b, const int32_t& score);
+
+    std::string                     _name;
+    std::array<int32_t, 256 * 256>  _scores;
+};
+
+#endif //EXP_SUBSTITUTION_H
@@ -0,0 +1,235 @@
+#include "telemetry.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+namespace telemetry
+{
+    namespace
+    {
+        // One per thread, only ever written by it. Relaxed atomics keep the reads of the
+        // reporter well-defined without costing the writer more than a plain add.
+        struct ThreadStats
+        {
+            std::array<std::atomic<uint64_t>, COUNTERS>     counters{};
+            std::array<std::atomic<uint64_t>, TIMERS>       calls{}, nanoseconds{};
+        };
+
+        struct Registry
+        {
+            std::mutex                                  mutex;
+            // Kept after their thread exits, so totals never go down.
+            std::vector<std::unique_ptr<ThreadStats>>   threads;
+            std::chrono::steady_clock::time_point       start = std::chrono::steady_clock::now();
+        };
+
+        Registry& registry()
+        {
+            static Registry r;
+            return r;
+        }
+
+        ThreadStats& local()
+        {
+            thread_local ThreadStats* stats = []()
+            {
+                Registry& r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                r.threads.push_back(std::make_unique<ThreadStats>());
+                return r.threads.back().get();
+            }();
+            return *stats;
+        }
+
+        inline void add(std::atomic<uint64_t>& value, const uint64_t& n)
+        {
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        constexpr const char* counter_names[COUNTERS] = {
+                "episodes", "steps", "cache_hits", "transitions", "updates", "band_fallbacks"
+        };
+        constexpr const char* timer_names[TIMERS] = {
+                "select", "step", "profile", "pairwise", "reward", "push",
+                "sample", "forward", "backward", "target_copy"
+        };
+
+        // The timers that do not nest in another one, which the console line splits time between.
+        constexpr Timer top_level[] = { SELECT, STEP, PUSH, SAMPLE, FORWARD, BACKWARD, TARGET_COPY };
+
+        std::string clock(const double& seconds)
+        {
+            const auto s = (uint64_t)seconds;
+            char text[32];
+            snprintf(text, sizeof(text), "%02llu:%02llu:%02llu", (unsigned long long)(s / 3600),
+                     (unsigned long long)(s % 3600 / 60), (unsigned long long)(s % 60));
+            return text;
+        }
+    }
+
+    const char* name(const Counter& counter)
+    {
+        return counter_names[counter];
+    }
+
+    const char* name(const Timer& timer)
+    {
+        return timer_names[timer];
+    }
+
+    void count(const Counter& counter, const uint64_t& n)
+    {
+        add(local().counters[counter], n);
+    }
+
+    void record(const Timer& timer, const uint64_t& nanoseconds)
+    {
+        ThreadStats& stats = local();
+        add(stats.calls[timer], 1);
+        add(stats.nanoseconds[timer], nanoseconds);
+    }
+
+    Snapshot snapshot()
+    {
+        Registry& r = registry();
+        Snapshot res;
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (const auto& stats : r.threads)
+        {
+            for (uint32_t i = 0; i < COUNTERS; i++)
+                res.counters[i] += stats->counters[i].load(std::memory_order_relaxed);
+            for (uint32_t i = 0; i < TIMERS; i++)
+            {
+                res.calls[i] += stats->calls[i].load(std::memory_order_relaxed);
+                res.nanoseconds[i] += stats->nanoseconds[i].load(std::memory_order_relaxed);
+            }
+        }
+        res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - r.start).count();
+        return res;
+    }
+
+    void write_json(const Snapshot& snapshot, std::ostream& out)
+    {
+        out << "{\n  \"seconds\": " << snapshot.seconds << ",\n  \"counters\": {";
+        for (uint32_t i = 0; i < COUNTERS; i++)
+            out << (i ? ", " : "") << "\"" << counter_names[i] << "\": " << snapshot.counters[i];
+        out << "},\n  \"timers\": {";
+        for (uint32_t i = 0; i < TIMERS; i++)
+        {
+            out << (i ? "," : "") << "\n    \"" << timer_names[i] << "\": {\"calls\": " << snapshot.calls[i]
+                << ", \"seconds\": " << (double)snapshot.nanoseconds[i] * 1e-9 << "}";
+        }
+        out << "\n  }\n}\n";
+    }
+
+    void write_prometheus(const Snapshot& snapshot, std::ostream& out)
+    {
+        out << "# TYPE exp_uptime_seconds gauge\nexp_uptime_seconds " << snapshot.seconds << "\n";
+        for (uint32_t i = 0; i < COUNTERS; i++)
+        {
+            out << "# TYPE exp_" << counter_names[i] << "_total counter\n"
+                << "exp_" << counter_names[i] << "_total " << snapshot.counters[i] << "\n";
+        }
+        out << "# TYPE exp_timer_calls_total counter\n";
+        for (uint32_t i = 0; i < TIMERS; i++)
+            out << "exp_timer_calls_total{timer=\"" << timer_names[i] << "\"} " << snapshot.calls[i] << "\n";
+        out << "# TYPE exp_timer_seconds_total counter\n";
+        for (uint32_t i = 0; i < TIMERS; i++)
+        {
+            out << "exp_timer_seconds_total{timer=\"" << timer_names[i] << "\"} "
+                << (double)snapshot.nanoseconds[i] * 1e-9 << "\n";
+        }
+    }
+
+    Reporter::Reporter(const uint64_t& episodes, const double& interval, std::string path) :
+            _episodes(episodes),
+            _interval(interval),
+            _path(std::move(path)),
+            _begin(snapshot())
+    {
+        _thread = std::thread(&Reporter::run, this);
+    }
+
+    Reporter::~Reporter()
+    {
+        stop();
+    }
+
+    void Reporter::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stopping)
+                return;
+            _stopping = true;
+        }
+        _wake.notify_all();
+        _thread.join();
+        report(true);
+    }
+
+    void Reporter::run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_wake.wait_for(lock, _interval, [this]() { return _stopping; }))
+        {
+            lock.unlock();
+            report(false);
+            lock.lock();
+        }
+    }
+
+    void Reporter::report(const bool& last)
+    {
+        const Snapshot now = snapshot();
+        const uint64_t done = now.counters[EPISODES] - _begin.counters[EPISODES];
+        const double seconds = now.seconds - _begin.seconds;
+        const double rate = seconds > 0 ? (double)done / seconds : 0.;
+
+        std::ostringstream line;
+        line << "\r" << done << "/" << _episodes << " episodes  " << std::fixed << std::setprecision(1)
+             << rate << "/s  " << clock(seconds) << "/"
+             << clock(rate > 0 && _episodes > done ? (double)(_episodes - done) / rate : 0.);
+
+        double timed = 0;
+        for (const auto& timer : top_level)
+            timed += (double)(now.nanoseconds[timer] - _begin.nanoseconds[timer]);
+        if (timed > 0)
+        {
+            line << " ";
+            for (const auto& timer : top_level)
+            {
+                const auto spent = (double)(now.nanoseconds[timer] - _begin.nanoseconds[timer]);
+                if (spent > 0)
+                    line << " " << timer_names[timer] << " " << std::setprecision(0) << 100 * spent / timed << "%";
+            }
+        }
+        // Blanks out whatever is left of a longer previous line.
+        std::string text = line.str();
+        const size_t width = text.size();
+        if (width < _width)
+            text.append(_width - width, ' ');
+        _width = width;
+        std::cerr << text << (last ? "\n" : "") << std::flush;
+
+        if (_path.empty())
+            return;
+        // Written aside and renamed over the old file, so a scraper never reads half of it.
+        const std::string partial = _path + ".tmp";
+        {
+            std::ofstream file(partial);
+            if (!file.is_open())
+                return;
+            const bool json = _path.size() >= 5 && 0 == _path.compare(_path.size() - 5, 5, ".json");
+            if (json)
+                write_json(now, file);
+            else
+                write_prometheus(now, file);
+        }
+        std::rename(partial.c_str(), _path.c_str());
+    }
+}
@@ -0,0 +1,117 @@
+//
+// Training telemetry: per-thread counters and scoped timers, reported from a background thread.
+//
+
+#ifndef EXP_TELEMETRY_H
+#define EXP_TELEMETRY_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace telemetry
+{
+    enum Counter : uint8_t
+    {
+        EPISODES = 0,
+        STEPS,
+        CACHE_HITS,
+        TRANSITIONS,
+        UPDATES,
+        BAND_FALLBACKS,     // align_banded paths that touched the band edge and were redone in full
+        COUNTERS
+    };
+
+    // PROFILE, PAIRWISE and REWARD are the parts of STEP; SAMPLE, FORWARD, BACKWARD and
+    // TARGET_COPY those of an update.
+    enum Timer : uint8_t
+    {
+        SELECT = 0,
+        STEP,
+        PROFILE,
+        PAIRWISE,
+        REWARD,
+        PUSH,
+        SAMPLE,
+        FORWARD,
+        BACKWARD,
+        TARGET_COPY,
+        TIMERS
+    };
+
+    [[nodiscard]] const char* name(const Counter& counter);
+    [[nodiscard]] const char* name(const Timer& timer);
+
+    // Adds to the calling thread's own counter: no lock and no shared cache line.
+    void count(const Counter& counter, const uint64_t& n = 1);
+    void record(const Timer& timer, const uint64_t& nanoseconds);
+
+    // Times its own lifetime into timer.
+    class Scope
+    {
+    public:
+        explicit Scope(const Timer& timer) : _timer(timer), _start(std::chrono::steady_clock::now()) {}
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope()
+        {
+            record(_timer, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - _start).count());
+        }
+
+    private:
+        Timer                                   _timer;
+        std::chrono::steady_clock::time_point   _start;
+    };
+
+    // Totals over every thread that ever counted, since the process started.
+    struct Snapshot
+    {
+        std::array<uint64_t, COUNTERS>  counters{};
+        std::array<uint64_t, TIMERS>    calls{}, nanoseconds{};
+        double                          seconds = 0;    // since the process started
+    };
+
+    [[nodiscard]] Snapshot snapshot();
+    void write_json(const Snapshot& snapshot, std::ostream& out);
+    // Prometheus text exposition format, metric names prefixed with exp_.
+    void write_prometheus(const Snapshot& snapshot, std::ostream& out);
+
+    // Every interval seconds, rewrites one console line with the episode progress, rate,
+    // ETA and where the time went, and replaces the file at path (JSON if it ends in .json,
+    // Prometheus text otherwise, none if empty). The line is on stderr so stdout stays the
+    // alignment.
+    class Reporter
+    {
+    public:
+        Reporter(const uint64_t& episodes, const double& interval, std::string path);
+        Reporter(const Reporter&) = delete;
+        Reporter& operator=(const Reporter&) = delete;
+        ~Reporter();
+
+        // Reports once more and ends the console line.
+        void stop();
+
+    private:
+        void run();
+        void report(const bool& last);
+
+        uint64_t                    _episodes;
+        std::chrono::duration<double> _interval;
+        std::string                 _path;
+        Snapshot                    _begin;
+        size_t                      _width = 0;     // of the last console line
+        bool                        _stopping = false;
+        std::mutex                  _mutex;
+        std::condition_variable     _wake;
+        std::thread                 _thread;
+    };
+}
+
+#endif //EXP_TELEMETRY_H
@@ -0,0 +1,56 @@
+//
+// The check macro and case runner shared by the test executables.
+//
+
+#ifndef EXP_TEST_H
+#define EXP_TEST_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+// Failed CHECKs so far.
+inline uint32_t test_failures = 0;
+
+// Prints the condition and a printf-style message when condition is false, and carries on.
+#define CHECK(condition, ...)                                                   \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            std::fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #condition); \
+            std::fprintf(stderr, __VA_ARGS__);                                  \
+            std::fprintf(stderr, "\n");                                         \
+            test_failures++;                                                    \
+        }                                                                       \
+    } while (false)
+
+struct TestCase
+{
+    const char*             name;
+    std::function<void()>   body;
+};
+
+// Runs the cases named in argv, or all of them, printing PASS or FAIL for each. Returns
+// the number that failed, for the exit status.
+inline int run_tests(const std::vector<TestCase>& cases, const int& argc, char** argv)
+{
+    uint32_t failed = 0;
+    for (const auto& c : cases)
+    {
+        if (argc > 1 && std::none_of(argv + 1, argv + argc, [&](const char* name) { return 0 == strcmp(name, c.name); }))
+            continue;
+        const uint32_t before = test_failures;
+        c.body();
+        const bool ok = before == test_failures;
+        std::printf("%s %s\n", ok ? "PASS" : "FAIL", c.name);
+        std::fflush(stdout);
+        failed += !ok;
+    }
+    return (int)failed;
+}
+
+#endif //EXP_TEST_H
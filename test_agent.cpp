@@ -0,0 +1,337 @@
+//
+// Short training runs of the DQN agent. Built only with libtorch.
+//
+// usage: test_agent [NAME...]
+// As test_core. Each case trains a few dozen episodes on a small random family.
+//
+
+#include "batch.h"
+#include "dqn.h"
+#include "environment.h"
+#include "rollout.h"
+#include "checkpoint.h"
+#include "config.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    namespace fs = std::filesystem;
+
+    constexpr uint32_t FAMILY_SIZE = 5;
+
+    std::vector<std::string> random_family(const uint32_t& seed)
+    {
+        std::mt19937 rng(seed);
+        std::string root;
+        for (uint32_t i = 0; i < 40; i++)
+            root.push_back("ATCG"[rng() % 4]);
+        std::vector<std::string> res;
+        for (uint32_t s = 0; s < FAMILY_SIZE; s++)
+        {
+            std::string member;
+            for (const char& c : root)
+            {
+                if (0 != rng() % 10)
+                    member.push_back(c);
+                if (0 == rng() % 10)
+                    member.push_back("ATCG"[rng() % 4]);
+            }
+            res.push_back(member);
+        }
+        return res;
+    }
+
+    // Small enough that updates start within two episodes.
+    Config small_config()
+    {
+        Config config;
+        config.episodes = 100;
+        config.batch_size = 8;
+        config.replay_memory_size = 64;
+        config.net_update_iteration = 16;
+        return config;
+    }
+
+    // A directory under the system temporary one, removed with everything in it.
+    class TemporaryDirectory
+    {
+    public:
+        explicit TemporaryDirectory(const std::string& name) :
+                _path(fs::temp_directory_path() / (name + "_" + std::to_string(std::random_device{}())))
+        {
+            fs::create_directories(_path);
+        }
+        ~TemporaryDirectory()
+        {
+            std::error_code error;
+            fs::remove_all(_path, error);
+        }
+
+        [[nodiscard]] std::string path(const std::string& name) const { return (_path / name).string(); }
+
+    private:
+        fs::path _path;
+    };
+
+    bool finite(const NetWeights& weights)
+    {
+        for (const auto* v : { &weights.input_weight, &weights.l1_weight, &weights.l2_weight, &weights.output_weight })
+        {
+            if (!std::all_of(v->begin(), v->end(), [](const float& x) { return std::isfinite(x); }))
+                return false;
+        }
+        return true;
+    }
+
+    // Serial training with and without the prefetch thread and prioritized replay changes
+    // the net, keeps it finite and counts every gradient step; agents destroyed right after
+    // an update, with a prefetch requested or ready, shut down cleanly.
+    void dqn_prefetch()
+    {
+        const auto family = random_family(1);
+        for (const bool prefetch : { false, true })
+        {
+            for (const bool prioritized : { false, true })
+            {
+                Config config = small_config();
+                config.prefetch = prefetch;
+                config.prioritized_replay = prioritized;
+                config.updates_per_step = 2;
+                Environment env(family, config);
+                DQN agent(FAMILY_SIZE, env.encoding(), config);
+                const auto before = agent.weights();
+                for (uint32_t e = 0; e < 30; e++)
+                    play_episode(env, agent);
+                const auto after = agent.weights();
+                CHECK(before.l1_weight != after.l1_weight, "prefetch %d prioritized %d: no training",
+                      prefetch, prioritized);
+                CHECK(finite(after), "prefetch %d prioritized %d: weights not finite", prefetch, prioritized);
+                // Each update() that finds a batch takes both of its gradient steps, and counts both.
+                const uint32_t total = 30 * FAMILY_SIZE * config.updates_per_step, steps = agent.checkpoint().steps;
+                CHECK(0 == steps % config.updates_per_step && steps <= total
+                      && steps + (config.batch_size - 1) * config.updates_per_step >= total,
+                      "prefetch %d prioritized %d: %u gradient steps", prefetch, prioritized, steps);
+            }
+        }
+
+        Config config = small_config();
+        config.prefetch = true;
+        config.prioritized_replay = true;
+        Environment env(family, config);
+        for (uint32_t trial = 0; trial < 20; trial++)
+        {
+            DQN agent(FAMILY_SIZE, env.encoding(), config);
+            for (uint32_t e = 0; e < 2 + trial % 3; e++)
+                play_episode(env, agent);
+        }
+    }
+
+    // A restore replaces the replay memory under a prefetched batch drawn from the old one;
+    // training goes on from the checkpoint's counters.
+    void dqn_restore_prefetch()
+    {
+        const auto family = random_family(2);
+        const TemporaryDirectory directory("exp_test_agent");
+        Config config = small_config();
+        Environment env(family, config);
+        {
+            DQN agent(FAMILY_SIZE, env.encoding(), config);
+            for (uint32_t e = 0; e < 3; e++)
+                play_episode(env, agent);
+            write_checkpoint(agent.checkpoint(), directory.path("checkpoint"));
+        }
+
+        config.prefetch = true;
+        config.prioritized_replay = true;
+        DQN agent(FAMILY_SIZE, env.encoding(), config);
+        for (uint32_t e = 0; e < 20; e++)
+            play_episode(env, agent);
+        agent.restore(directory.path("checkpoint"));
+        CHECK(3 == agent.episodes(), "%u episodes after restore", agent.episodes());
+        for (uint32_t e = 0; e < 10; e++)
+            play_episode(env, agent);
+        CHECK(13 == agent.episodes(), "%u episodes after training on", agent.episodes());
+        CHECK(finite(agent.weights()), "weights not finite");
+    }
+
+    // Checkpointing and resuming from it trains the same nets over the following episodes as
+    // going on uninterrupted does, with and without the prefetch thread and prioritized replay.
+    void dqn_resume_reproducible()
+    {
+        torch::set_num_threads(1);
+        const auto family = random_family(3);
+        const TemporaryDirectory directory("exp_test_agent");
+        for (const bool prefetch : { false, true })
+        {
+            for (const bool prioritized : { false, true })
+            {
+                Config config = small_config();
+                config.prefetch = prefetch;
+                config.prioritized_replay = prioritized;
+                config.updates_per_step = 2;
+                const auto path = directory.path("checkpoint_" + std::to_string(prefetch) + std::to_string(prioritized));
+                Environment env(family, config);
+                DQN uninterrupted(FAMILY_SIZE, env.encoding(), config);
+                for (uint32_t e = 0; e < 10; e++)
+                    play_episode(env, uninterrupted);
+                write_checkpoint(uninterrupted.checkpoint(), path);
+                Environment copy(env);
+                for (uint32_t e = 0; e < 10; e++)
+                    play_episode(env, uninterrupted);
+
+                DQN resumed(FAMILY_SIZE, copy.encoding(), config);
+                resumed.restore(path);
+                for (uint32_t e = 0; e < 10; e++)
+                    play_episode(copy, resumed);
+
+                const auto expected = uninterrupted.weights(), weights = resumed.weights();
+                CHECK(expected.l1_weight == weights.l1_weight && expected.output_weight == weights.output_weight,
+                      "prefetch %d prioritized %d: the resumed run diverged", prefetch, prioritized);
+                const auto expected_state = uninterrupted.checkpoint(), state = resumed.checkpoint();
+                CHECK(expected_state.steps == state.steps && expected_state.episodes == state.episodes
+                      && expected_state.rand == state.rand && expected_state.prefetch_rand == state.prefetch_rand,
+                      "prefetch %d prioritized %d: %u and %u steps, %u and %u episodes", prefetch, prioritized,
+                      expected_state.steps, state.steps, expected_state.episodes, state.episodes);
+            }
+        }
+    }
+
+    std::string replay_image(const Checkpoint& checkpoint)
+    {
+        std::ostringstream out;
+        checkpoint.replay->save(out);
+        return out.str();
+    }
+
+    // A checkpoint that does not load leaves the agent as it was: eval net, counters, random
+    // engines and replay memory.
+    void dqn_restore_corrupt()
+    {
+        const auto family = random_family(5);
+        const TemporaryDirectory directory("exp_test_agent");
+        Config config = small_config();
+        config.prioritized_replay = true;
+        Environment env(family, config);
+        {
+            DQN agent(FAMILY_SIZE, env.encoding(), config);
+            for (uint32_t e = 0; e < 6; e++)
+                play_episode(env, agent);
+            write_checkpoint(agent.checkpoint(), directory.path("good"));
+        }
+
+        const std::vector<std::pair<std::string, std::string>> corruptions = {
+            { "agent.pt", "not a torch archive" },
+            { "replay.bin", "EXPRPLAY" },
+            { "state", "version = 1\nseq_num = 5\nepisodes = 6\nsteps = 1\nepsilon = 0.5\nrand = x\n" } };
+        for (const auto& [file, contents] : corruptions)
+        {
+            const auto path = directory.path("bad_" + file);
+            fs::copy(directory.path("good"), path);
+            std::ofstream(fs::path(path) / file, std::ios::binary | std::ios::trunc) << contents;
+
+            DQN agent(FAMILY_SIZE, env.encoding(), config);
+            for (uint32_t e = 0; e < 3; e++)
+                play_episode(env, agent);
+            const auto weights = agent.weights();
+            const auto before = agent.checkpoint();
+            bool thrown = false;
+            try
+            {
+                agent.restore(path);
+            }
+            catch (const std::runtime_error&)
+            {
+                thrown = true;
+            }
+            CHECK(thrown, "a bad %s loaded", file.c_str());
+            const auto after = agent.checkpoint();
+            const auto kept = agent.weights();
+            CHECK(weights.l1_weight == kept.l1_weight && weights.output_weight == kept.output_weight,
+                  "a bad %s changed the eval net", file.c_str());
+            CHECK(before.episodes == after.episodes && before.steps == after.steps && before.epsilon == after.epsilon
+                  && before.rand == after.rand && before.prefetch_rand == after.prefetch_rand,
+                  "a bad %s changed the counters", file.c_str());
+            CHECK(replay_image(before) == replay_image(after), "a bad %s changed the replay memory", file.c_str());
+            play_episode(env, agent);
+        }
+    }
+
+    // The rollout learner stays within replay_ratio updates per actor step, and the actors
+    // finish every episode whatever it does.
+    void rollout_pacing()
+    {
+        const auto family = random_family(4);
+        for (const bool prefetch : { false, true })
+        {
+            for (const double ratio : { 1., 0.25 })
+            {
+                Config config = small_config();
+                config.prefetch = prefetch;
+                Environment env(family, config);
+                DQN agent(FAMILY_SIZE, env.encoding(), config);
+                const uint64_t episodes = 30;
+                uint64_t updates;
+                {
+                    Rollout rollout(env, agent, 3, ratio);
+                    rollout.start(episodes);
+                    rollout.join();
+                    updates = rollout.updates();
+                    CHECK(episodes == rollout.finished(), "prefetch %d ratio %g: %lu episodes finished",
+                          prefetch, ratio, (unsigned long)rollout.finished());
+                }
+                CHECK(episodes == agent.episodes(), "prefetch %d ratio %g: agent counted %u episodes",
+                      prefetch, ratio, agent.episodes());
+                const double steps = (double)(episodes * FAMILY_SIZE);
+                CHECK(0 < updates && (double)updates <= ratio * steps, "prefetch %d ratio %g: %lu updates for %g steps",
+                      prefetch, ratio, (unsigned long)updates, steps);
+                const uint32_t gradient_steps = agent.checkpoint().steps;
+                CHECK(0 < gradient_steps && gradient_steps <= updates * config.updates_per_step,
+                      "prefetch %d ratio %g: %u gradient steps in %lu updates", prefetch, ratio, gradient_steps,
+                      (unsigned long)updates);
+            }
+        }
+    }
+
+    // Output names stay unique when a suffixed name is an input's own, in any order.
+    void batch_job_names()
+    {
+        const std::vector<std::vector<std::string>> cases = {
+            { "a/x_2.fa", "b/x.fa", "c/x.fa" },
+            { "b/x.fa", "c/x.fa", "a/x_1.fa", "d/x.fa" },
+            { "x.fa", "x.fasta", "x_1.fa", "x_2.fa", "y/x.fa" } };
+        for (const auto& paths : cases)
+        {
+            const auto names = job_names(paths);
+            std::vector<std::string> sorted = names;
+            std::sort(sorted.begin(), sorted.end());
+            CHECK(names.size() == paths.size() && sorted.end() == std::adjacent_find(sorted.begin(), sorted.end()),
+                  "duplicate names for %s, ...", paths[0].c_str());
+            for (size_t i = 0; i < paths.size(); i++)
+                CHECK(0 == names[i].rfind(fs::path(paths[i]).stem().string(), 0), "%s named %s",
+                      paths[i].c_str(), names[i].c_str());
+        }
+        CHECK((job_names({ "a/x.fa", "b/y.fa", "c/x.fa" }) == std::vector<std::string>{ "x", "y", "x_2" }),
+              "a/x.fa b/y.fa c/x.fa");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    return run_tests({
+        { "dqn_prefetch", dqn_prefetch },
+        { "dqn_restore_prefetch", dqn_restore_prefetch },
+        { "dqn_resume_reproducible", dqn_resume_reproducible },
+        { "dqn_restore_corrupt", dqn_restore_corrupt },
+        { "rollout_pacing", rollout_pacing },
+        { "batch_job_names", batch_job_names }
+    }, argc, argv);
+}
@@ -0,0 +1,942 @@
+//
+// Checks the alignment core against the straightforward implementations it replaced.
+//
+// usage: test_core [NAME...]
+// Runs the named cases, or all of them, on randomized inputs from fixed seeds. Every
+// mismatch is printed; the exit status is the number of failed cases.
+//
+
+#include "alignment.h"
+#include "environment.h"
+#include "packed.h"
+#include "pairwise.h"
+#include "prefetch.h"
+#include "profile.h"
+#include "scoring.h"
+#include "substitution.h"
+#include "telemetry.h"
+#include "config.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // The scoring schemes every score is checked under.
+    std::vector<std::pair<const char*, Scores>> schemes()
+    {
+        Scores affine;
+        affine.gap_open = -4;
+        affine.gap = -1;
+        Scores matrix;
+        matrix.matrix = SubstitutionMatrix::iupac(matrix.match, matrix.mismatch);
+        Scores both = affine;
+        both.matrix = SubstitutionMatrix::iupac(both.match, both.mismatch);
+        return { { "linear", Scores() }, { "affine", affine }, { "matrix", matrix }, { "affine+matrix", both } };
+    }
+
+    // Mostly A, T, C and G, with the odd IUPAC code or other symbol.
+    std::string random_sequence(std::mt19937& rng, const uint32_t& length)
+    {
+        static const char others[] = "NRYn*";
+        std::string res;
+        for (uint32_t i = 0; i < length; i++)
+            res.push_back(0 == rng() % 40 ? others[rng() % 5] : "ATCG"[rng() % 4]);
+        return res;
+    }
+
+    // Equal-length rows of random_sequence symbols and gaps, some in runs.
+    std::vector<std::string> random_rows(std::mt19937& rng, const uint32_t& rows, const uint32_t& width)
+    {
+        std::vector<std::string> res;
+        for (uint32_t r = 0; r < rows; r++)
+        {
+            std::string row = random_sequence(rng, width);
+            for (uint32_t i = 0; i < width; i++)
+            {
+                if (0 == rng() % 5)
+                {
+                    const uint32_t run = 1 + rng() % 4;
+                    for (uint32_t k = i; k < std::min(width, i + run); k++)
+                        row[k] = '-';
+                }
+            }
+            res.push_back(row);
+        }
+        return res;
+    }
+
+    // Sequence families of related members, as the environment sees them.
+    std::vector<std::string> random_family(std::mt19937& rng, const uint32_t& count, const uint32_t& length)
+    {
+        const std::string root = random_sequence(rng, length);
+        std::vector<std::string> res;
+        for (uint32_t s = 0; s < count; s++)
+        {
+            std::string member;
+            for (const char& c : root)
+            {
+                const auto x = rng() % 20;
+                if (0 == x)
+                    continue;
+                member.push_back(1 == x ? "ATCG"[rng() % 4] : c);
+                if (2 == x)
+                    member.push_back("ATCG"[rng() % 4]);
+            }
+            if (member.empty())
+                member.push_back('A');
+            res.push_back(member);
+        }
+        return res;
+    }
+
+    // The baseline's scoring of one pair of aligned rows, extended by the affine and matrix
+    // schemes: every column independently, then gap_open once per run in either row.
+    int64_t reference_pair_score(const std::string& a, const std::string& b, const Scores& scores)
+    {
+        int64_t score = 0;
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            if ('-' == a[i] || '-' == b[i])
+                score += scores.gap;
+            else if (scores.matrix)
+                score += (*scores.matrix)(a[i], b[i]);
+            else
+                score += a[i] == b[i] ? scores.match : scores.mismatch;
+        }
+        for (const auto* row : { &a, &b })
+        {
+            for (size_t i = 0; i < row->size(); i++)
+                score += scores.gap_open * ('-' == (*row)[i] && (0 == i || '-' != (*row)[i - 1]));
+        }
+        return score;
+    }
+
+    // The baseline's calc_sum_of_pairs: a rescan of every pair of rows.
+    int64_t reference_sum_of_pairs(const std::vector<std::string>& rows, const Scores& scores)
+    {
+        int64_t score = 0;
+        for (size_t j = 0; j < rows.size(); j++)
+        {
+            for (size_t k = j + 1; k < rows.size(); k++)
+                score += reference_pair_score(rows[j], rows[k], scores);
+        }
+        return score;
+    }
+
+    // The baseline's Environment::profile: per column, the nucleotide maximising its count
+    // squared times its total over all columns, first one on ties.
+    std::string reference_consensus(const std::vector<std::string>& rows)
+    {
+        static const char nucleotide[] = "ATCG";
+        std::vector<std::array<int64_t, 4>> table(rows[0].size(), std::array<int64_t, 4>{});
+        std::array<int64_t, 4> totals{};
+        for (const auto& row : rows)
+        {
+            for (size_t i = 0; i < row.size(); i++)
+            {
+                const char* n = std::strchr(nucleotide, row[i]);
+                if (row[i] && n)
+                {
+                    table[i][n - nucleotide]++;
+                    totals[n - nucleotide]++;
+                }
+            }
+        }
+        std::string res;
+        for (auto& column : table)
+        {
+            for (size_t j = 0; j < 4; j++)
+                column[j] = column[j] * column[j] * totals[j];
+            res.push_back(nucleotide[std::max_element(column.begin(), column.end()) - column.begin()]);
+        }
+        return res;
+    }
+
+    // Random ops aligning a target of target_length against width profile columns.
+    std::vector<EditOp> random_ops(std::mt19937& rng, const uint32_t& width, const uint32_t& target_length)
+    {
+        std::vector<EditOp> ops;
+        uint32_t columns = 0, target = 0;
+        while (columns < width || target < target_length)
+        {
+            const auto x = rng() % 8;
+            if (columns < width && target < target_length && x < 6)
+            {
+                ops.push_back(EditOp::Match);
+                columns++;
+                target++;
+            }
+            else if (columns < width && (target == target_length || 6 == x))
+            {
+                ops.push_back(EditOp::TargetGap);
+                columns++;
+            }
+            else
+            {
+                ops.push_back(EditOp::ProfileGap);
+                target++;
+            }
+        }
+        return ops;
+    }
+
+    // rows with a '-' opened wherever ops has EditOp::ProfileGap, by string insertion.
+    void reference_insert_gap_columns(std::vector<std::string>& rows, const std::vector<EditOp>& ops)
+    {
+        for (size_t i = 0; i < ops.size(); i++)
+        {
+            if (EditOp::ProfileGap == ops[i])
+            {
+                for (auto& row : rows)
+                    row.insert(i, 1, '-');
+            }
+        }
+    }
+
+    ColumnProfile profile_of(const std::vector<std::string>& rows)
+    {
+        ColumnProfile profile;
+        for (const auto& row : rows)
+            profile.append(row);
+        return profile;
+    }
+
+    void check_profile(const ColumnProfile& profile, const std::vector<std::string>& rows)
+    {
+        CHECK(profile.size() == rows[0].size(), "%zu columns, expected %zu", profile.size(), rows[0].size());
+        if (profile.size() != rows[0].size())
+            return;
+        for (size_t i = 0; i < profile.size(); i++)
+        {
+            for (const char& c : std::string("ATCG-N"))
+            {
+                const auto expected = std::count_if(rows.begin(), rows.end(),
+                                                    [&](const std::string& row) { return row[i] == c; });
+                CHECK(profile.count(i, c) == expected, "column %zu has %d '%c', expected %ld",
+                      i, profile.count(i, c), c, (long)expected);
+            }
+        }
+        const auto consensus = profile.consensus();
+        CHECK(consensus == reference_consensus(rows), "consensus %s", consensus.c_str());
+    }
+
+    // The baseline's Environment::pairwise_alignment, with its scores taken from scores: the
+    // full (m + 1) x (n + 1) matrix, traced back preferring diagonal, then a target gap.
+    std::vector<EditOp> reference_align_linear(const std::string& profile, const std::string& target,
+                                               const Scores& scores)
+    {
+        const auto match = [&](const char& a, const char& b)
+        {
+            return ('-' == a || '-' == b) ? scores.gap : scores.substitution(a, b);
+        };
+        const size_t n = profile.size(), m = target.size();
+        std::vector<std::vector<int>> score(m + 1, std::vector<int>(n + 1));
+        for (size_t i = 0; i <= m; i++)
+            score[i][0] = scores.gap * (int)i;
+        for (size_t j = 0; j <= n; j++)
+            score[0][j] = scores.gap * (int)j;
+        for (size_t i = 1; i <= m; i++)
+        {
+            for (size_t j = 1; j <= n; j++)
+                score[i][j] = std::max(score[i - 1][j - 1] + match(profile[j - 1], target[i - 1]),
+                                       std::max(score[i - 1][j], score[i][j - 1]) + scores.gap);
+        }
+
+        std::vector<EditOp> ops;
+        size_t i = m, j = n;
+        while (i > 0 && j > 0)
+        {
+            if (score[i][j] == score[i - 1][j - 1] + match(profile[j - 1], target[i - 1]))
+            {
+                ops.push_back(EditOp::Match);
+                i--;
+                j--;
+            }
+            else if (score[i][j] == score[i][j - 1] + scores.gap)
+            {
+                ops.push_back(EditOp::TargetGap);
+                j--;
+            }
+            else
+            {
+                ops.push_back(EditOp::ProfileGap);
+                i--;
+            }
+        }
+        ops.insert(ops.end(), j, EditOp::TargetGap);
+        ops.insert(ops.end(), i, EditOp::ProfileGap);
+        std::reverse(ops.begin(), ops.end());
+        return ops;
+    }
+
+    // Score of the alignment ops describe under scores, gap_open once per run of either gap.
+    int64_t path_score(const std::string& profile, const std::string& target, const std::vector<EditOp>& ops,
+                       const Scores& scores)
+    {
+        int64_t score = 0;
+        size_t i = 0, j = 0;
+        for (size_t k = 0; k < ops.size(); k++)
+        {
+            const bool opens = 0 == k || ops[k - 1] != ops[k];
+            switch (ops[k])
+            {
+                case EditOp::Match:
+                    score += ('-' == profile[j] || '-' == target[i]) ? scores.gap
+                                                                     : scores.substitution(profile[j], target[i]);
+                    i++;
+                    j++;
+                    break;
+                case EditOp::TargetGap:
+                    score += scores.gap + (opens ? scores.gap_open : 0);
+                    j++;
+                    break;
+                default:
+                    score += scores.gap + (opens ? scores.gap_open : 0);
+                    i++;
+                    break;
+            }
+        }
+        return score;
+    }
+
+    // Best affine score by Gotoh's recurrence over the full matrices: h any alignment of the
+    // prefixes, e those ending in a target gap, f in a profile gap.
+    int64_t reference_affine_score(const std::string& profile, const std::string& target, const Scores& scores)
+    {
+        const int64_t none = INT32_MIN;
+        const size_t n = profile.size(), m = target.size();
+        const int64_t open = scores.gap_open + scores.gap;
+        std::vector<std::vector<int64_t>> h(m + 1, std::vector<int64_t>(n + 1, none)), e = h, f = h;
+        h[0][0] = 0;
+        for (size_t j = 1; j <= n; j++)
+            h[0][j] = e[0][j] = scores.gap_open + scores.gap * (int64_t)j;
+        for (size_t i = 1; i <= m; i++)
+        {
+            h[i][0] = f[i][0] = scores.gap_open + scores.gap * (int64_t)i;
+            for (size_t j = 1; j <= n; j++)
+            {
+                e[i][j] = std::max(e[i][j - 1] + scores.gap, h[i][j - 1] + open);
+                f[i][j] = std::max(f[i - 1][j] + scores.gap, h[i - 1][j] + open);
+                const int64_t d = h[i - 1][j - 1] + (('-' == profile[j - 1] || '-' == target[i - 1])
+                                                     ? scores.gap : scores.substitution(profile[j - 1], target[i - 1]));
+                h[i][j] = std::max(d, std::max(e[i][j], f[i][j]));
+            }
+        }
+        return h[m][n];
+    }
+
+    // The pairwise kernels this CPU and build can run, best first.
+    std::vector<std::string> pairwise_kernels()
+    {
+        std::vector<std::string> res;
+        for (const char* name : { "avx2", "sse4.1", "scalar" })
+        {
+            if (limit_pairwise_kernels(name))
+                res.emplace_back(name);
+        }
+        limit_pairwise_kernels(res.front());
+        return res;
+    }
+
+    // Profile/target pairs: related and unrelated, empty and single characters, profiles
+    // with gap columns, lengths either side of the kernels' vector widths.
+    std::vector<std::pair<std::string, std::string>> random_pairs(std::mt19937& rng, const uint32_t& count)
+    {
+        std::vector<std::pair<std::string, std::string>> res = {
+            { "", "" }, { "", "A" }, { "A", "" }, { "A", "A" }, { "A", "C" }, { "-", "A" },
+            { "", "ACGTACGT" }, { "ACGTACGT", "" }, { "A", "ACGTACGT" }, { "ACGTACGT", "T" } };
+        while (res.size() < count)
+        {
+            const uint32_t length = rng() % 4 ? 1 + rng() % 40 : 1 + rng() % 300;
+            if (rng() % 2)
+            {
+                const auto family = random_family(rng, 2, length);
+                res.emplace_back(family[0], family[1]);
+            }
+            else
+            {
+                res.emplace_back(random_sequence(rng, length), random_sequence(rng, 1 + rng() % (2 * length)));
+            }
+            if (0 == rng() % 4)
+                res.back().first = random_rows(rng, 1, (uint32_t)res.back().first.size())[0];
+        }
+        return res;
+    }
+
+    void profile_consensus()
+    {
+        std::mt19937 rng(1);
+        for (uint32_t trial = 0; trial < 200; trial++)
+        {
+            auto rows = random_rows(rng, 1 + rng() % 12, 1 + rng() % 150);
+            auto profile = profile_of(rows);
+            check_profile(profile, rows);
+
+            // Gap columns opened by a new row, then that row itself.
+            const auto target_length = 1 + rng() % 150;
+            const auto ops = random_ops(rng, (uint32_t)rows[0].size(), target_length);
+            profile.insert_gap_columns(ops);
+            reference_insert_gap_columns(rows, ops);
+            check_profile(profile, rows);
+            const auto row = random_rows(rng, 1, (uint32_t)ops.size())[0];
+            profile.append(row);
+            rows.push_back(row);
+            check_profile(profile, rows);
+
+            for (const auto& [name, scores] : schemes())
+            {
+                const auto expected = reference_sum_of_pairs(rows, scores);
+                const auto score = sum_of_pairs(profile, scores);
+                CHECK(score == expected, "%s sum of pairs %d, expected %ld", name, score, (long)expected);
+            }
+        }
+    }
+
+    // Every step's reward is the new row's score against the rows before it, over
+    // max_reward; the final sum of pairs that of all rows.
+    void environment_reward()
+    {
+        std::mt19937 rng(2);
+        for (uint32_t trial = 0; trial < 40; trial++)
+        {
+            const auto family = random_family(rng, 2 + rng() % 9, 10 + rng() % 120);
+            for (const auto& [name, scores] : schemes())
+            {
+                Config config;
+                config.scores = scores;
+                Environment env(family, config);
+                std::vector<state_type> order(family.size());
+                for (size_t i = 0; i < order.size(); i++)
+                    order[i] = (state_type)i;
+                std::shuffle(order.begin(), order.end(), rng);
+
+                env.reset();
+                for (size_t k = 0; k < order.size(); k++)
+                {
+                    const float reward = std::get<1>(env.step(order[k]));
+                    const auto rows = env.alignment();
+                    int64_t expected = 0;
+                    for (size_t j = 0; j < k; j++)
+                        expected += reference_pair_score(rows[k], rows[j], scores);
+                    const float expected_reward = (float)expected / (float)env.max_reward();
+                    CHECK(reward == expected_reward, "%s step %zu reward %g, expected %g",
+                          name, k, reward, expected_reward);
+                }
+                const auto rows = env.alignment();
+                const auto expected = reference_sum_of_pairs(rows, scores);
+                const auto score = env.calc_sum_of_pairs();
+                CHECK(score == expected, "%s sum of pairs %d, expected %ld", name, score, (long)expected);
+            }
+        }
+    }
+
+    // Both sum_of_pairs overloads against the rescan, over widths either side of the
+    // counting kernel's vector lengths.
+    void scoring_sum_of_pairs()
+    {
+        std::mt19937 rng(4);
+        for (uint32_t trial = 0; trial < 300; trial++)
+        {
+            const uint32_t width = trial < 100 ? 1 + trial : 1 + rng() % 400;
+            const auto rows = random_rows(rng, 2 + rng() % 40, width);
+            const auto profile = profile_of(rows);
+            for (const auto& [name, scores] : schemes())
+            {
+                const auto expected = reference_sum_of_pairs(rows, scores);
+                const auto from_rows = sum_of_pairs(rows, scores);
+                const auto from_profile = sum_of_pairs(profile, scores);
+                CHECK(from_rows == expected, "%s width %u: rows %d, expected %ld", name, width, from_rows, (long)expected);
+                CHECK(from_profile == expected, "%s width %u: profile %d, expected %ld",
+                      name, width, from_profile, (long)expected);
+            }
+
+            std::string symbols;
+            for (const auto& row : rows)
+                symbols.push_back(row[0]);
+            int32_t pairs = 0;
+            for (size_t j = 0; j < symbols.size(); j++)
+                for (size_t k = j + 1; k < symbols.size(); k++)
+                    pairs += symbols[j] == symbols[k];
+            CHECK(identical_pairs(symbols) == pairs, "identical_pairs(%s) %d, expected %d",
+                  symbols.c_str(), identical_pairs(symbols), pairs);
+        }
+    }
+
+    // Gap-run rows against the baseline's: every earlier row gets its '-' by string
+    // insertion as each row is aligned.
+    void alignment_materialize()
+    {
+        std::mt19937 rng(3);
+        for (uint32_t trial = 0; trial < 200; trial++)
+        {
+            std::vector<std::string> sequences;
+            for (uint32_t s = 1 + rng() % 10; s > 0; s--)
+                sequences.push_back(random_sequence(rng, 1 + rng() % 100));
+            const auto packed = pack_sequences(sequences);
+
+            Alignment alignment;
+            std::vector<std::string> rows;
+            for (uint32_t k = 0; k < sequences.size(); k++)
+            {
+                const auto& target = sequences[k];
+                if (0 == k)
+                {
+                    alignment.append(k, (uint32_t)target.size());
+                    rows.push_back(target);
+                    continue;
+                }
+                const auto ops = random_ops(rng, (uint32_t)rows[0].size(), (uint32_t)target.size());
+                alignment.append(k, (uint32_t)target.size(), ops);
+                reference_insert_gap_columns(rows, ops);
+                std::string row;
+                auto t = target.begin();
+                for (const auto& op : ops)
+                    row.push_back(EditOp::TargetGap == op ? '-' : *t++);
+                rows.push_back(row);
+            }
+
+            CHECK(alignment.rows() == rows.size(), "%u rows, expected %zu", alignment.rows(), rows.size());
+            CHECK(alignment.width() == rows[0].size(), "width %u, expected %zu", alignment.width(), rows[0].size());
+            const auto materialized = alignment.materialize(packed);
+            CHECK(materialized == rows, "trial %u rows differ", trial);
+        }
+    }
+
+    // align_to_profile on every kernel against the baseline's full-matrix traceback, with
+    // the compiled-in, other linear and substitution matrix scores.
+    void pairwise_traceback()
+    {
+        Scores runtime;
+        runtime.match = 2;
+        runtime.mismatch = -3;
+        runtime.gap = -2;
+        Scores matrix;
+        matrix.matrix = SubstitutionMatrix::iupac(matrix.match, matrix.mismatch);
+        const std::vector<std::pair<const char*, Scores>> linear = {
+            { "default", Scores() }, { "runtime", runtime }, { "matrix", matrix } };
+
+        std::mt19937 rng(6);
+        const auto pairs = random_pairs(rng, 400);
+        for (const auto& kernel : pairwise_kernels())
+        {
+            limit_pairwise_kernels(kernel);
+            for (const auto& [name, scores] : linear)
+            {
+                for (const auto& [profile, target] : pairs)
+                {
+                    CHECK(align_to_profile(profile, target, scores) == reference_align_linear(profile, target, scores),
+                          "%s kernel, %s scores: %s against %s", kernel.c_str(), name, profile.c_str(), target.c_str());
+                }
+            }
+        }
+        pairwise_kernels();
+    }
+
+    // The affine paths of every kernel are valid alignments scoring the Gotoh optimum, and
+    // the kernels agree on them.
+    void pairwise_affine_optimal()
+    {
+        Scores steep;
+        steep.gap_open = -10;
+        steep.gap = -2;
+        auto schemes_checked = schemes();
+        schemes_checked.erase(std::remove_if(schemes_checked.begin(), schemes_checked.end(),
+                                             [](const auto& s) { return !s.second.affine(); }),
+                              schemes_checked.end());
+        schemes_checked.emplace_back("steep", steep);
+
+        std::mt19937 rng(7);
+        const auto pairs = random_pairs(rng, 300);
+        const auto kernels = pairwise_kernels();
+        for (const auto& [name, scores] : schemes_checked)
+        {
+            for (const auto& [profile, target] : pairs)
+            {
+                const auto expected = reference_affine_score(profile, target, scores);
+                std::vector<EditOp> first;
+                for (const auto& kernel : kernels)
+                {
+                    limit_pairwise_kernels(kernel);
+                    const auto ops = align_to_profile(profile, target, scores);
+                    const auto columns = std::count(ops.begin(), ops.end(), EditOp::Match);
+                    const auto target_gaps = std::count(ops.begin(), ops.end(), EditOp::TargetGap);
+                    CHECK(columns + target_gaps == (long)profile.size()
+                          && (size_t)(ops.size() - target_gaps) == target.size(),
+                          "%s kernel, %s scores: %s against %s is no alignment",
+                          kernel.c_str(), name, profile.c_str(), target.c_str());
+                    const auto score = path_score(profile, target, ops, scores);
+                    CHECK(score == expected, "%s kernel, %s scores: %s against %s scores %ld, best %ld",
+                          kernel.c_str(), name, profile.c_str(), target.c_str(), (long)score, (long)expected);
+                    if (first.empty())
+                        first = ops;
+                    CHECK(ops == first, "%s kernel, %s scores: %s against %s differs from %s",
+                          kernel.c_str(), name, profile.c_str(), target.c_str(), kernels[0].c_str());
+                }
+            }
+        }
+        pairwise_kernels();
+    }
+
+    // Whether the path of ops keeps off the diagonals dmin and dmax wherever the banded
+    // traceback looks at it, i.e. before it reaches row or column 0.
+    bool strictly_inside(const std::vector<EditOp>& ops, const int32_t& dmin, const int32_t& dmax)
+    {
+        int32_t i = 0, j = 0;
+        for (const auto& op : ops)
+        {
+            i += EditOp::TargetGap != op;
+            j += EditOp::ProfileGap != op;
+            if (i > 0 && j > 0 && (j - i <= dmin || j - i >= dmax))
+                return false;
+        }
+        return true;
+    }
+
+    // align_banded against the full matrix: related pairs under every scheme and band, and
+    // paths built to stay inside the band, to run along its edge, and to go down column 0.
+    void banded_alignment()
+    {
+        const auto fallbacks = []() { return telemetry::snapshot().counters[telemetry::BAND_FALLBACKS]; };
+        std::mt19937 rng(8);
+        uint32_t inside = 0, outside = 0;
+        for (uint32_t trial = 0; trial < 60; trial++)
+        {
+            const auto family = random_family(rng, 2, 50 + rng() % 350);
+            const auto& profile = family[0];
+            const auto& target = family[1];
+            const auto n = (int32_t)profile.size(), m = (int32_t)target.size();
+            for (const auto& [name, scores] : schemes())
+            {
+                const auto expected = align_to_profile(profile, target, scores);
+                const auto optimum = path_score(profile, target, expected, scores);
+                for (const uint32_t band : { 1u, 3u, 8u, 32u, estimate_band(profile, target) })
+                {
+                    const auto ops = align_banded(profile, target, scores, band);
+                    const int32_t dmin = std::min(0, n - m) - (int32_t)band, dmax = std::max(0, n - m) + (int32_t)band;
+                    // A path the band holds is found; one that leaves it may come back without
+                    // touching the edge, so the band's best is all there is to check then.
+                    if (strictly_inside(expected, dmin, dmax))
+                    {
+                        inside++;
+                        CHECK(ops == expected, "%s scores, band %u: %s against %s differs from the full matrix",
+                              name, band, profile.c_str(), target.c_str());
+                    }
+                    else
+                    {
+                        outside++;
+                        CHECK(path_score(profile, target, ops, scores) <= optimum, "%s scores, band %u: %s against %s",
+                              name, band, profile.c_str(), target.c_str());
+                    }
+                }
+            }
+        }
+        CHECK(inside > 0 && outside > 0, "%u paths inside the band, %u outside", inside, outside);
+
+        const std::string profile = random_sequence(rng, 200);
+        const auto expect = [&](const std::string& target, const uint32_t& band, const bool& fallback,
+                                const char* what)
+        {
+            for (const auto& [name, scores] : schemes())
+            {
+                const auto before = fallbacks();
+                CHECK(align_banded(profile, target, scores, band) == align_to_profile(profile, target, scores),
+                      "%s, band %u, %s scores: differs from the full matrix", what, band, name);
+                CHECK(fallback == (fallbacks() > before), "%s, band %u, %s scores: %s", what, band, name,
+                      fallback ? "kept a path along the band edge" : "fell back");
+            }
+        };
+        // Five bases dropped at the start and five added at the end: the path runs five
+        // diagonals off the main one and back, at equal lengths.
+        const std::string shifted = profile.substr(5) + "ACGTA";
+        expect(shifted, 8, false, "shifted inside the band");
+        expect(shifted, 5, true, "shifted onto the band edge");
+        expect(shifted, 2, true, "shifted out of the band");
+        // Eight bases inserted at the start go down column 0, which the band holds down to
+        // row band; with the band at 8 the path leaves column 0 on the band edge.
+        const std::string inserted = "GGTTCCAA" + profile.substr(0, profile.size() - 8);
+        expect(inserted, 12, false, "column 0 inside the band");
+        expect(inserted, 8, true, "column 0 to the band edge");
+        expect(inserted, 4, true, "column 0 out of the band");
+        expect(profile, 1, false, "identical, narrowest band");
+    }
+
+    // SubstitutionMatrix::iupac scores against the share of bases two codes stand for.
+    void substitution_iupac()
+    {
+        const auto matrix = SubstitutionMatrix::iupac(5, -3);
+        const std::string bases = "ACGT";
+        for (const char& a : bases)
+        {
+            for (const char& b : bases)
+            {
+                const int32_t expected = a == b ? 5 : -3;
+                CHECK((*matrix)(a, b) == expected, "%c %c: %d", a, b, (*matrix)(a, b));
+                CHECK((*matrix)((char)std::tolower(a), b) == expected, "%c %c lower case", a, b);
+            }
+        }
+        // T and U are one base; R is A or G, N any of four, so N against a base is the average.
+        CHECK(5 == (*matrix)('U', 'T') && 5 == (*matrix)('u', 't'), "U against T: %d", (*matrix)('U', 'T'));
+        CHECK(1 == (*matrix)('R', 'A') && -3 == (*matrix)('R', 'C'), "R: %d %d", (*matrix)('R', 'A'), (*matrix)('R', 'C'));
+        CHECK(-1 == (*matrix)('N', 'A') && -1 == (*matrix)('A', 'N') && -1 == (*matrix)('N', 'N'), "N: %d %d %d",
+              (*matrix)('N', 'A'), (*matrix)('A', 'N'), (*matrix)('N', 'N'));
+        // R and Y share no base; S = C|G and K = G|T share G, a quarter of the pairs.
+        CHECK(-3 == (*matrix)('R', 'Y') && -1 == (*matrix)('S', 'K'), "R Y %d, S K %d",
+              (*matrix)('R', 'Y'), (*matrix)('S', 'K'));
+        CHECK(-3 == (*matrix)('*', 'A') && -3 == (*matrix)('X', 'X') && -3 == (*matrix)('-', '-'),
+              "non-IUPAC characters");
+        for (uint32_t a = 0; a < 256; a++)
+        {
+            for (uint32_t b = 0; b < 256; b++)
+                CHECK((*matrix)((char)a, (char)b) == (*matrix)((char)b, (char)a), "%u %u asymmetric", a, b);
+        }
+        CHECK("iupac" == matrix->name(), "name %s", matrix->name().c_str());
+    }
+
+    // SubstitutionMatrix::load on NCBI-format files, and its errors.
+    void substitution_load()
+    {
+        const auto path = (std::filesystem::temp_directory_path()
+                           / ("exp_test_matrix_" + std::to_string(std::random_device{}()))).string();
+        const auto write = [&](const std::string& text)
+        {
+            std::ofstream file(path);
+            file << text;
+        };
+        const auto throws = [&]()
+        {
+            try
+            {
+                SubstitutionMatrix::load(path);
+            }
+            catch (const std::runtime_error&)
+            {
+                return true;
+            }
+            return false;
+        };
+
+        write("#  Matrix made by hand\n"
+              "#\n"
+              "   A  R  N\n"
+              "A  4 -1 -2   # trailing comment\n"
+              "\n"
+              "R -1  5  0\n"
+              "N -2  0  6\n");
+        const auto matrix = SubstitutionMatrix::load(path);
+        CHECK(4 == (*matrix)('A', 'A') && 5 == (*matrix)('R', 'R') && 6 == (*matrix)('N', 'N'), "diagonal");
+        CHECK(-1 == (*matrix)('A', 'R') && -1 == (*matrix)('R', 'A') && 0 == (*matrix)('N', 'R'), "off diagonal");
+        CHECK(4 == (*matrix)('a', 'A') && -2 == (*matrix)('n', 'a'), "lower case");
+        CHECK(-2 == (*matrix)('A', 'W') && -2 == (*matrix)('*', '*'), "unlisted pairs: %d %d",
+              (*matrix)('A', 'W'), (*matrix)('*', '*'));
+        CHECK(path == matrix->name(), "name %s", matrix->name().c_str());
+
+        // Rows keep the header's order even when they are not square.
+        write("   A  C\nC  1  2\nA  3  4\n");
+        const auto rows = SubstitutionMatrix::load(path);
+        CHECK(1 == (*rows)('C', 'A') && 2 == (*rows)('C', 'C') && 3 == (*rows)('A', 'A') && 4 == (*rows)('A', 'C'),
+              "row order");
+
+        write("   A  C\nA  1\n");
+        CHECK(throws(), "short row accepted");
+        write("# nothing\n   A  C\n");
+        CHECK(throws(), "matrix without scores accepted");
+        write("   A  C\nA  1  x\n");
+        CHECK(throws(), "non-numeric score accepted");
+        std::filesystem::remove(path);
+        CHECK(throws(), "missing file accepted");
+    }
+
+    // Every character decodes back exactly, across word boundaries and side-channel runs.
+    void packed_round_trip()
+    {
+        std::mt19937 rng(5);
+        static const char alphabet[] = "ATCGATCGATCGatcgNNnRY-*\x01\xff";
+        for (uint32_t trial = 0; trial < 500; trial++)
+        {
+            const uint32_t length = trial < 130 ? trial : rng() % 2000;
+            std::string sequence;
+            for (uint32_t i = 0; i < length; i++)
+                sequence.push_back(alphabet[rng() % (sizeof(alphabet) - 1)]);
+
+            const PackedSequence packed(sequence);
+            CHECK(packed.size() == sequence.size(), "size %zu, expected %zu", packed.size(), sequence.size());
+            CHECK(packed.unpack() == sequence, "length %u: unpack differs", length);
+            std::string decoded(sequence.size(), '\0');
+            packed.decode(decoded.data());
+            CHECK(decoded == sequence, "length %u: decode differs", length);
+            for (uint32_t i = 0; i < length; i++)
+                CHECK(packed[i] == sequence[i], "length %u: [%u] is %d, expected %d", length, i, packed[i], sequence[i]);
+        }
+
+        const std::vector<std::string> sequences = { "ACGT", "", "NNNN", "acgtRYK" };
+        const auto packed = pack_sequences(sequences);
+        CHECK(packed.size() == sequences.size(), "%zu packed sequences", packed.size());
+        for (size_t s = 0; s < std::min(packed.size(), sequences.size()); s++)
+            CHECK(packed[s].unpack() == sequences[s], "sequence %zu: %s", s, packed[s].unpack().c_str());
+    }
+
+    // A buffer stamped with the fill that wrote it, in every element, and the generation
+    // of the source it was filled from.
+    struct Stamped
+    {
+        std::vector<uint64_t>   fill;
+        uint32_t                generation = 0;
+    };
+
+    struct Source
+    {
+        std::mutex      mutex;
+        uint64_t        fills = 0;
+        uint32_t        generation = 0;
+        uint64_t        available = ~0ull;  // fills allowed before fill() reports nothing
+        bool            slow = false;
+    };
+
+    Prefetcher<Stamped> make_prefetcher(Source& source, const bool& threaded)
+    {
+        return Prefetcher<Stamped>(source.mutex, { Stamped{ std::vector<uint64_t>(4096) }, Stamped{ std::vector<uint64_t>(4096) } },
+                                   [&source](Stamped& buffer)
+                                   {
+                                       if (source.fills >= source.available)
+                                           return false;
+                                       if (source.slow)
+                                           std::this_thread::sleep_for(std::chrono::microseconds(200));
+                                       std::fill(buffer.fill.begin(), buffer.fill.end(), source.fills++);
+                                       buffer.generation = source.generation;
+                                       return true;
+                                   }, threaded);
+    }
+
+    // Every buffer handed out is the next fill in order, whole, and left alone by the
+    // thread while the caller holds it; discard() drops a fill from an older generation.
+    void prefetch_handoff()
+    {
+        for (const bool threaded : { false, true })
+        {
+            for (const bool slow : { false, true })
+            {
+                Source source;
+                source.slow = slow;
+                auto prefetcher = make_prefetcher(source, threaded);
+                for (uint64_t step = 0; step < 300; step++)
+                {
+                    Stamped* buffer = prefetcher.next();
+                    CHECK(nullptr != buffer, "threaded %d: step %lu got no buffer", threaded, (unsigned long)step);
+                    if (nullptr == buffer)
+                        break;
+                    CHECK(buffer->fill.front() == step, "threaded %d: step %lu got fill %lu",
+                          threaded, (unsigned long)step, (unsigned long)buffer->fill.front());
+                    // "Train" on it while the thread fills the other one.
+                    std::this_thread::sleep_for(std::chrono::microseconds(step % 3 * 100));
+                    CHECK(std::all_of(buffer->fill.begin(), buffer->fill.end(),
+                                      [&](const uint64_t& x) { return x == step; }),
+                          "threaded %d: step %lu buffer changed while in use", threaded, (unsigned long)step);
+                }
+
+                // As restore() does: replace the source, then drop what came from the old one.
+                for (uint32_t generation = 1; generation <= 50; generation++)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(source.mutex);
+                        source.generation = generation;
+                        prefetcher.discard();
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(generation % 2 * 300));
+                    Stamped* buffer = prefetcher.next();
+                    CHECK(nullptr != buffer && buffer->generation == generation,
+                          "threaded %d: generation %u after discard", threaded, generation);
+                }
+            }
+        }
+
+        // Writers that settle() first never show up in a fill requested before them, however
+        // slow it is: each buffer holds the generation as of the step before its caller's.
+        for (const bool threaded : { false, true })
+        {
+            Source source;
+            source.slow = true;
+            auto prefetcher = make_prefetcher(source, threaded);
+            for (uint32_t generation = 1; generation <= 100; generation++)
+            {
+                Stamped* buffer = prefetcher.next();
+                const uint32_t expected = threaded && generation > 1 ? generation - 2 : generation - 1;
+                CHECK(nullptr != buffer && buffer->generation == expected,
+                      "threaded %d: step %u saw generation %u", threaded, generation,
+                      nullptr == buffer ? 0 : buffer->generation);
+                std::unique_lock<std::mutex> lock(source.mutex);
+                prefetcher.settle(lock);
+                source.generation = generation;
+            }
+        }
+
+        // Nothing to fill from yet: next() says so, then picks up once there is.
+        for (const bool threaded : { false, true })
+        {
+            Source source;
+            source.available = 0;
+            auto prefetcher = make_prefetcher(source, threaded);
+            CHECK(nullptr == prefetcher.next(), "threaded %d: filled from nothing", threaded);
+            {
+                std::lock_guard<std::mutex> lock(source.mutex);
+                source.available = 2;
+            }
+            Stamped* first = prefetcher.next();
+            CHECK(nullptr != first && 0 == first->fill.front(), "threaded %d: first fill", threaded);
+            Stamped* second = prefetcher.next();
+            CHECK(nullptr != second && 1 == second->fill.front(), "threaded %d: second fill", threaded);
+            if (threaded)
+                CHECK(nullptr == prefetcher.next(), "threaded: filled past the source");
+        }
+    }
+
+    // Destruction joins the thread whatever it is doing: idle, asked for a fill it has not
+    // started, in the middle of a slow one, or done with it.
+    void prefetch_shutdown()
+    {
+        for (uint32_t trial = 0; trial < 400; trial++)
+        {
+            Source source;
+            source.slow = 0 == trial % 2;
+            auto prefetcher = make_prefetcher(source, true);
+            for (uint32_t step = 0; step < trial % 4; step++)
+                prefetcher.next();
+            if (0 == trial % 3)
+                std::this_thread::sleep_for(std::chrono::microseconds(100 * (trial % 5)));
+        }
+    }
+
+    const std::vector<TestCase>& cases()
+    {
+        static const std::vector<TestCase> table = {
+            { "profile_consensus", profile_consensus },
+            { "environment_reward", environment_reward },
+            { "alignment_materialize", alignment_materialize },
+            { "pairwise_traceback", pairwise_traceback },
+            { "pairwise_affine_optimal", pairwise_affine_optimal },
+            { "banded_alignment", banded_alignment },
+            { "substitution_iupac", substitution_iupac },
+            { "substitution_load", substitution_load },
+            { "scoring_sum_of_pairs", scoring_sum_of_pairs },
+            { "packed_round_trip", packed_round_trip },
+            { "prefetch_handoff", prefetch_handoff },
+            { "prefetch_shutdown", prefetch_shutdown }
+        };
+        return table;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    return run_tests(cases(), argc, argv);
+}
@@ -10,14 +10,16 @@
 #include <algorithm>
 #include <vector>
 #include <cmath>
-#include <iomanip>
-#include <chrono>
 #include <map>
 #include <iostream>
 #include <string>
 
 typedef int32_t    state_type;
 
+#define MATCH_REWARD        2
+#define MISMATCH_PENALTY    -1
+#define GAP_PENALTY         -2
+
 namespace config{
     constexpr float init_epsilon = 0.8f;
     constexpr float final_epsilon = 0.f;
@@ -28,6 +30,29 @@ namespace config{
     constexpr uint32_t replay_memory_size = 5000;
     constexpr uint32_t batch_size = 128;
     constexpr uint32_t episodes = 50000;
+    // Also push a -1 reward transition for every taken action the net ranks above the
+    // greedy pick, as select() used to when it retried on invalid actions.
+    constexpr bool penalize_invalid_actions = false;
+    // Prioritized replay: P(i) ~ priority^priority_alpha, IS weights annealed from
+    // priority_beta up to 1 over the episodes.
+    constexpr bool prioritized_replay = false;
+    constexpr float priority_alpha = 0.6f;
+    constexpr float priority_beta = 0.4f;
+    constexpr float priority_epsilon = 1e-5f;
+    // Describe sequences to the net by their k-mer sketches and distances as well. Changes
+    // the net's input width, so models only load into agents with the same setting.
+    constexpr bool kmer_features = false;
+    // Warm start: how many times the guide-tree episode is pushed before training, and the
+    // weight of the large-margin loss that makes demonstrated actions beat every other
+    // available one by demonstration_margin (0 disables it).
+    constexpr uint32_t warm_start = 0;
+    constexpr float demonstration_weight = 0.f;
+    constexpr float demonstration_margin = 0.8f;
+    // Learner: gradient steps per update(), i.e. per environment step, and whether a thread
+    // samples and collates the next batch while the current one trains. A prefetched batch
+    // misses the transitions and priorities of the step it was drawn ahead of.
+    constexpr uint32_t updates_per_step = 1;
+    constexpr bool prefetch = false;
 }
 
 
@@ -47,32 +72,5 @@ std::vector<std::string> load_sequence(const std::string& path);
 
 void print_sequences(const std::vector<std::string>& ss);
 
-class ProgressBar {
-public:
-    explicit ProgressBar(const uint64_t& p = 0);
-    ProgressBar(const ProgressBar&) = delete;
-    ProgressBar& operator=(const ProgressBar&) = delete;
-
-    uint64_t operator+(const uint64_t& increment) const;
-    uint64_t& operator+=(const uint64_t& increment);
-    ProgressBar& operator=(const uint64_t& progress);
-    bool operator<(const int& iteration);
-    uint64_t& operator++();
-    uint64_t operator++(int);
-
-    [[nodiscard]] uint64_t iteration() const;
-    [[nodiscard]] bool finish() const;
-
-    explicit operator uint64_t() const;
-private:
-    void print_progress_bar() const;
-    void calc_time();
-
-    uint64_t _iteration, _progress;
-    std::chrono::steady_clock::time_point _start_point, _pre_point;
-    uint64_t _time_count, _iteration_per_sec, _total_time, _left_time;
-    double _speed;
-};
-
 
 #endif //EXP_UTILS_H